@@ -0,0 +1,175 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../tcpserver.h"
+
+// usage: accept-bench [epoll|io_uring] [cycles] [idle] [hugepages] [port]
+//
+// first opens and closes cycles connections one after another, then opens
+// idle connections, echoes one message on each and leaves them open to see
+// how much memory each one costs the server.
+
+static tcp_server_t server;
+static tcp_server_attr_t attrs;
+static uint16_t port = 18089;
+static uint32_t connected;
+static uint32_t disconnected;
+
+static int bench_on_connect(int sfd, void *user) {
+    (void)sfd;
+    (void)user;
+    __atomic_add_fetch(&connected, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static int bench_on_disconnect(int sfd, void *user) {
+    (void)sfd;
+    (void)user;
+    __atomic_add_fetch(&disconnected, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static int bench_on_readable(int sfd, void *data, uint32_t len, void *user) {
+    tcp_server_write((tcp_server_t *)user, sfd, data, len, 0);
+    return 0;
+}
+
+static void* bench_server(void *arg) {
+    (void)arg;
+    tcp_server_setup(&server, port, &attrs, &server);
+    return NULL;
+}
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long bench_rss(void) {
+    long pages = 0, resident = 0;
+    FILE *file = fopen("/proc/self/statm", "r");
+    if(file) {
+        if(fscanf(file, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(file);
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static void bench_wait(uint32_t *counter, uint32_t value) {
+    int retry;
+    for(retry = 0; retry < 5000 && __atomic_load_n(counter, __ATOMIC_RELAXED) < value; retry++) {
+        usleep(1000);
+    }
+}
+
+static int bench_connect(void) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    //
+    int retry;
+    for(retry = 0; retry < 200; retry++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            return fd;
+        }
+        close(fd);
+        usleep(10000);
+    }
+    return -1;
+}
+
+int main(int argc, char **argv) {
+    const char *backend = argc > 1 ? argv[1] : "epoll";
+    int cycles = argc > 2 ? atoi(argv[2]) : 20000;
+    int idle   = argc > 3 ? atoi(argv[3]) : 2000;
+    attrs.hugepages = argc > 4 ? (uint32_t)atoi(argv[4]) : 0;
+    if(argc > 5) {
+        port = (uint16_t)atoi(argv[5]);
+    }
+    //
+    attrs.on_connect    = bench_on_connect;
+    attrs.on_disconnect = bench_on_disconnect;
+    attrs.on_readable   = bench_on_readable;
+    attrs.threads = 1;
+    attrs.backend = strcmp(backend, "io_uring") == 0 ? TCP_SERVER_BACKEND_IO_URING : TCP_SERVER_BACKEND_EPOLL;
+    // both ends of every idle connection live in this process.
+    struct rlimit limit;
+    if(getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        (void) setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    //
+    pthread_t thread;
+    pthread_create(&thread, NULL, bench_server, NULL);
+    //
+    int i, fd;
+    char message[64];
+    memset(message, 'x', sizeof(message));
+    // the first connection waits for the listener to come up.
+    fd = bench_connect();
+    if(fd < 0) {
+        fprintf(stderr, "connect failed\n");
+        return 1;
+    }
+    close(fd);
+    bench_wait(&disconnected, 1);
+    //
+    double start = bench_now();
+    for(i = 0; i < cycles; i++) {
+        fd = bench_connect();
+        if(fd < 0) {
+            fprintf(stderr, "connect failed\n");
+            return 1;
+        }
+        close(fd);
+    }
+    bench_wait(&disconnected, (uint32_t)cycles + 1);
+    double elapsed = bench_now() - start;
+    //
+    long before = bench_rss();
+    int *fds = (int *)malloc(sizeof(int) * idle);
+    for(i = 0; i < idle; i++) {
+        fds[i] = bench_connect();
+        if(fds[i] < 0) {
+            fprintf(stderr, "connect failed after %d idle connections\n", i);
+            return 1;
+        }
+        if(send(fds[i], message, sizeof(message), 0) != sizeof(message) ||
+           recv(fds[i], message, sizeof(message), MSG_WAITALL) != sizeof(message)) {
+            fprintf(stderr, "echo failed\n");
+            return 1;
+        }
+    }
+    bench_wait(&connected, (uint32_t)(cycles + 1 + idle));
+    long after = bench_rss();
+    //
+    tcp_server_stats_t stats;
+    tcp_server_stats(&server, &stats);
+    printf("%-8s hugepages=%u accept+close/s=%.0f idle=%d rss/conn=%.0fB pool: chunks=%lu mapped=%luKiB used=%luKiB\n",
+           backend, attrs.hugepages, cycles / elapsed, idle, (double)(after - before) / idle,
+           (unsigned long)stats.pool_chunks, (unsigned long)(stats.pool_bytes >> 10),
+           (unsigned long)(stats.pool_used >> 10));
+    //
+    for(i = 0; i < idle; i++) {
+        close(fds[i]);
+    }
+    free(fds);
+    tcp_server_shutdown(&server);
+    pthread_join(thread, NULL);
+    //
+    return 0;
+}
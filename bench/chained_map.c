@@ -0,0 +1,192 @@
+#include "chained_map.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct chained_map_node{
+    uint32_t key;
+    void* value;
+    struct chained_map_node *next;
+} chained_map_node_t;
+
+typedef chained_map_node_t* chained_map_node_ptr;
+
+typedef struct {
+    chained_map_node_ptr *data;
+    uint32_t capacity;
+    uint32_t limit;
+    uint32_t size;
+} chained_map_private;
+
+
+uint32_t chained_map_index(uint32_t capacity, uint32_t key){
+    return key & (capacity - 1);
+}
+
+int chained_map_set(chained_map_node_ptr *container, uint32_t index, chained_map_node_t *new_node){
+    assert(container);
+
+    chained_map_node_t *node = container[index];
+    if(node){
+        new_node->next = node;
+    }
+
+    container[index] = new_node;
+
+    return 0;
+}
+
+int chained_map_resize(chained_map_private *private) {
+    assert(private);
+
+    chained_map_node_ptr *container;
+    uint32_t new_capacity = private->capacity << 1;
+    container = (chained_map_node_ptr*)malloc(sizeof(chained_map_node_ptr) * new_capacity);
+    memset(container, 0, sizeof(chained_map_node_ptr) * new_capacity);
+    //
+    uint32_t i, index;
+    chained_map_node_t *node, *swap;
+    for(i = 0; i < private->capacity; i++) {
+        swap = private->data[i];
+        while(swap) {
+            node = swap;
+            swap = node->next;
+            node->next = NULL;
+
+            index = chained_map_index(new_capacity, node->key);
+            (void)chained_map_set(container, index, node);
+        }
+    }
+    //
+    free(private->data);
+    //
+    private->capacity = new_capacity;
+    private->data     = container;
+    private->limit    = private->capacity * 0.75;
+    //
+    return 0;
+}
+
+int chained_map_init(chained_map_t *hash, uint32_t capacity) {
+    assert(hash);
+    assert(capacity > 1);
+    assert((capacity & (capacity -1)) == 0);
+    //
+    chained_map_private *private = (chained_map_private*)malloc(sizeof(chained_map_private));
+    private->data = (chained_map_node_ptr*)malloc(sizeof(chained_map_node_ptr) * capacity);
+    memset(private->data, 0, sizeof(chained_map_node_ptr) * capacity);
+    private->capacity = capacity;
+    private->size = 0;
+    //
+    private->limit = private->capacity * 0.75;
+    //
+    hash->priv = private;
+    //
+    return 0;
+}
+
+int chained_map_add(chained_map_t *hash, uint32_t key, void* value) {
+    assert(hash);
+    chained_map_private *private = (chained_map_private*)hash->priv;
+    assert(private);
+
+    if(private->limit < private->size) {
+        (void) chained_map_resize(private);
+    }
+
+    chained_map_node_t *new_node = (chained_map_node_t *)malloc(sizeof(chained_map_node_t));
+    memset(new_node, 0, sizeof(chained_map_node_t));
+    new_node->key   = key;
+    new_node->value = value;
+
+    uint32_t index = chained_map_index(private->capacity, key);
+    (void)chained_map_set(private->data, index, new_node);
+    private->size += 1;
+
+    return 0;
+}
+
+void* chained_map_del(chained_map_t *hash, uint32_t key) {
+    assert(hash);
+    chained_map_private *private = (chained_map_private*)hash->priv;
+    assert(private);
+
+    uint32_t index;
+    void* value = NULL;
+    chained_map_node_t *prev = NULL, *node = NULL, *next = NULL;
+    index = chained_map_index(private->capacity, key);
+    next = private->data[index];
+    while(next) {
+        node = next;
+        next = node->next;
+        //
+        if(node->key != key){
+            prev = node;
+            continue;
+        }
+        //
+        if(prev == NULL){
+            private->data[index] = next;
+        } else {
+            prev->next = next;
+        }
+        //
+        value = node->value;
+        free(node);
+        private->size -= 1;
+        //
+        break;
+    }
+
+    return value;
+}
+
+void* chained_map_get(chained_map_t *hash, uint32_t key) {
+    assert(hash);
+    chained_map_private *private = (chained_map_private*)hash->priv;
+    assert(private);
+
+    uint32_t index;
+    void* value = NULL;
+    chained_map_node_t *node = NULL, *next = NULL;
+    index = chained_map_index(private->capacity, key);
+    next = private->data[index];
+    while(next) {
+        node = next;
+        next = node->next;
+        //
+        if(node->key == key){
+            value = node->value;
+            break;
+        }
+    }
+
+    return value;
+}
+
+int chained_map_free(chained_map_t *hash) {
+    assert(hash);
+    chained_map_private *private = (chained_map_private*)hash->priv;
+    assert(private);
+
+    uint32_t i;
+    chained_map_node_t *node, *next;
+    for(i = 0; i < private->capacity; i++) {
+        next = private->data[i];
+        while(next) {
+            node = next;
+            next = node->next;
+            //
+            free(node);
+            //
+        }
+    }
+    //
+    free(private->data);
+    free(private);
+    //
+    hash->priv = NULL;
+    //
+    return 0;
+}
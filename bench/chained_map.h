@@ -0,0 +1,22 @@
+#ifndef CHAINED_MAP_H
+#define CHAINED_MAP_H
+
+#include <stdint.h>
+
+// the original separate-chaining hash_map, kept as a baseline for benchmarks.
+
+typedef struct{
+    void *priv;
+} chained_map_t;
+
+int chained_map_init(chained_map_t *hash, uint32_t capacity);
+
+int chained_map_add(chained_map_t *hash, uint32_t key, void* value);
+
+void* chained_map_get(chained_map_t *hash, uint32_t key);
+
+void* chained_map_del(chained_map_t *hash, uint32_t key);
+
+int chained_map_free(chained_map_t *hash);
+
+#endif // CHAINED_MAP_H
@@ -0,0 +1,146 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../tcpserver.h"
+
+// usage: echo-bench [epoll|io_uring] [connections] [rounds] [size] [depth] [port] [workers] [work_us]
+//
+// every round sends depth messages on each connection and reads the echoes
+// back, so the server sees all connections become readable in the same
+// batch. the server answers every message with its own write, after
+// sleeping work_us in on_readable, on workers threads when non zero.
+
+static tcp_server_t server;
+static tcp_server_attr_t attrs;
+static uint16_t port = 18088;
+static uint32_t size = 64;
+static uint32_t work_us = 0;
+
+static int bench_on_readable(int sfd, void *data, uint32_t len, void *user) {
+    // stands in for a handler that waits on something else, a disk or a database.
+    if(work_us > 0) {
+        usleep(work_us);
+    }
+    uint32_t offset, chunk;
+    for(offset = 0; offset < len; offset += chunk) {
+        chunk = len - offset < size ? len - offset : size;
+        tcp_server_write((tcp_server_t *)user, sfd, (char *)data + offset, chunk, 0);
+    }
+    return 0;
+}
+
+static void* bench_server(void *arg) {
+    (void)arg;
+    tcp_server_setup(&server, port, &attrs, &server);
+    return NULL;
+}
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench_connect(void) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    //
+    int retry;
+    for(retry = 0; retry < 200; retry++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            int opt = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+            return fd;
+        }
+        close(fd);
+        usleep(10000);
+    }
+    return -1;
+}
+
+int main(int argc, char **argv) {
+    const char *backend = argc > 1 ? argv[1] : "epoll";
+    int conns  = argc > 2 ? atoi(argv[2]) : 32;
+    int rounds = argc > 3 ? atoi(argv[3]) : 20000;
+    size       = argc > 4 ? (uint32_t)atoi(argv[4]) : 64;
+    int depth  = argc > 5 ? atoi(argv[5]) : 1;
+    if(argc > 6) {
+        port = (uint16_t)atoi(argv[6]);
+    }
+    uint32_t workers = argc > 7 ? (uint32_t)atoi(argv[7]) : 0;
+    work_us = argc > 8 ? (uint32_t)atoi(argv[8]) : 0;
+    //
+    memset(&attrs, 0, sizeof(attrs));
+    attrs.on_readable = bench_on_readable;
+    attrs.workers = workers;
+    attrs.backend = strcmp(backend, "io_uring") == 0 ? TCP_SERVER_BACKEND_IO_URING : TCP_SERVER_BACKEND_EPOLL;
+    //
+    pthread_t thread;
+    pthread_create(&thread, NULL, bench_server, NULL);
+    //
+    int i, d, r, *fds = malloc(sizeof(int) * conns);
+    for(i = 0; i < conns; i++) {
+        fds[i] = bench_connect();
+        if(fds[i] < 0) {
+            fprintf(stderr, "connect failed\n");
+            return 1;
+        }
+    }
+    //
+    char *msg = malloc(size), *echo = malloc((size_t)size * depth);
+    memset(msg, 'x', size);
+    //
+    tcp_server_stats_t before, after;
+    tcp_server_stats(&server, &before);
+    double start = bench_now();
+    for(r = 0; r < rounds; r++) {
+        for(i = 0; i < conns; i++) {
+            for(d = 0; d < depth; d++) {
+                send(fds[i], msg, size, 0);
+            }
+        }
+        for(i = 0; i < conns; i++) {
+            int got = 0, want = (int)size * depth;
+            while(got < want) {
+                int n = recv(fds[i], echo + got, want - got, 0);
+                if(n <= 0) {
+                    fprintf(stderr, "connection lost\n");
+                    return 1;
+                }
+                got += n;
+            }
+        }
+    }
+    double elapsed = bench_now() - start;
+    tcp_server_stats(&server, &after);
+    //
+    double messages = (double)conns * rounds * depth;
+    printf("%-8s conns=%d size=%u depth=%d workers=%u msgs/s=%.0f syscalls/msg=%.2f events/poll=%.2f\n",
+           backend, conns, size, depth, workers, messages / elapsed,
+           (after.syscalls - before.syscalls) / messages,
+           (double)(after.events - before.events) / (after.polls - before.polls));
+    //
+    for(i = 0; i < conns; i++) {
+        close(fds[i]);
+    }
+    tcp_server_shutdown(&server);
+    pthread_join(thread, NULL);
+    //
+    free(fds);
+    free(msg);
+    free(echo);
+    //
+    return 0;
+}
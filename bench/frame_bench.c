@@ -0,0 +1,78 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../framer.h"
+
+// usage: frame-bench [line bytes] [megabytes]
+//
+// cuts `megabytes` of text into "\r\n" terminated lines of about `line
+// bytes` each, the way the delimiter framing does, with framer_find, a
+// byte at a time loop and memmem. reports ns per line and GB/s.
+
+static uint64_t bench_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static const char* bench_bytes(const char *data, size_t len, const char *needle, size_t needle_len) {
+    size_t pos;
+    for(pos = 0; pos + needle_len <= len; pos++) {
+        if(data[pos] == needle[0] && memcmp(data + pos, needle, needle_len) == 0) {
+            return data + pos;
+        }
+    }
+    return NULL;
+}
+
+static const char* bench_memmem(const char *data, size_t len, const char *needle, size_t needle_len) {
+    return (const char *)memmem(data, len, needle, needle_len);
+}
+
+static const char* bench_framer(const char *data, size_t len, const char *needle, size_t needle_len) {
+    return framer_find(data, len, needle, needle_len);
+}
+
+static void bench_run(const char *name, const char *(*find)(const char *, size_t, const char *, size_t),
+                      const char *data, size_t len) {
+    uint64_t start = bench_ns(), lines = 0, elapsed;
+    const char *pos = data, *end;
+    while((end = find(pos, data + len - pos, "\r\n", 2)) != NULL) {
+        pos = end + 2;
+        lines += 1;
+    }
+    elapsed = bench_ns() - start;
+    printf("%-8s %10lu lines %8.1f ns/line %6.2f GB/s\n", name, (unsigned long)lines,
+           lines ? (double)elapsed / lines : 0.0, (double)len / elapsed);
+}
+
+int main(int argc, char **argv) {
+    size_t line = argc > 1 ? (size_t)atoi(argv[1]) : 128;
+    size_t len  = (argc > 2 ? (size_t)atoi(argv[2]) : 256) << 20;
+    char *data = malloc(len);
+    size_t i, next = 0;
+    uint32_t seed = 2463534242u;
+    // printable text with a lone '\r' or '\n' now and then.
+    for(i = 0; i < len; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        data[i] = (seed & 255) == 0 ? "\r\n"[seed >> 8 & 1] : (char)(' ' + seed % 95);
+        if(i == next && i + 1 < len) {
+            data[i++] = '\r';
+            data[i]   = '\n';
+            next = i + 1 + line / 2 + seed % (line + 1);
+        }
+    }
+    //
+    bench_run("framer", bench_framer, data, len);
+    bench_run("bytes", bench_bytes, data, len);
+    bench_run("memmem", bench_memmem, data, len);
+    //
+    free(data);
+    return 0;
+}
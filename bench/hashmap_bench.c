@@ -0,0 +1,159 @@
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../hashmap.h"
+#include "chained_map.h"
+
+// usage: hashmap-bench [keys]
+//
+// inserts, looks up and deletes the same key set in the open-addressing
+// hash_map and in the old chained map, and reports heap bytes per entry.
+// then grows each map from 1k slots to `keys` entries and reports the
+// latency distribution of single inserts, which is where resizes show.
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t bench_heap(void) {
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+static void bench_report(const char *name, const char *op, uint32_t count, double elapsed) {
+    printf("%-8s %-7s %8.1f Mops/s %7.1f ns/op\n", name, op, count / elapsed / 1e6, elapsed * 1e9 / count);
+}
+
+static int bench_compare(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t bench_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void bench_latency(const char *name, uint64_t *samples, uint32_t count) {
+    qsort(samples, count, sizeof(uint64_t), bench_compare);
+    printf("%-8s %-7s p50 %5lu ns  p99 %6lu ns  p99.9 %7lu ns  max %9lu ns\n", name, "growth",
+           (unsigned long)samples[count / 2],
+           (unsigned long)samples[(uint64_t)count * 99 / 100],
+           (unsigned long)samples[(uint64_t)count * 999 / 1000],
+           (unsigned long)samples[count - 1]);
+}
+
+int main(int argc, char **argv) {
+    uint32_t i, count = argc > 1 ? (uint32_t)atoi(argv[1]) : 1000000;
+    //
+    uint32_t *keys = malloc(sizeof(uint32_t) * count);
+    uint32_t seed = 2463534242u;
+    for(i = 0; i < count; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        keys[i] = seed;
+    }
+    // lookups and deletes run in a different order than the inserts.
+    uint32_t *order = malloc(sizeof(uint32_t) * count), j, swap;
+    for(i = 0; i < count; i++) {
+        order[i] = keys[i];
+    }
+    for(i = count - 1; i > 0; i--) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        j = seed % (i + 1);
+        swap = order[i];
+        order[i] = order[j];
+        order[j] = swap;
+    }
+    //
+    double start;
+    size_t heap;
+    volatile uintptr_t sink = 0;
+    //
+    hash_map_t open;
+    heap = bench_heap();
+    start = bench_now();
+    hash_map_init(&open, 32);
+    for(i = 0; i < count; i++) {
+        hash_map_add(&open, keys[i], (void *)(uintptr_t)(i + 1));
+    }
+    bench_report("open", "insert", count, bench_now() - start);
+    printf("%-8s %-7s %8.1f bytes/entry\n", "open", "memory", (double)(bench_heap() - heap) / hash_map_size(&open));
+    start = bench_now();
+    for(i = 0; i < count; i++) {
+        sink += (uintptr_t)hash_map_get(&open, order[i]);
+    }
+    bench_report("open", "lookup", count, bench_now() - start);
+    start = bench_now();
+    for(i = 0; i < count; i++) {
+        sink += (uintptr_t)hash_map_get(&open, order[i] ^ 0x5bd1e995u);
+    }
+    bench_report("open", "miss", count, bench_now() - start);
+    start = bench_now();
+    for(i = 0; i < count; i++) {
+        sink += (uintptr_t)hash_map_del(&open, order[i]);
+    }
+    bench_report("open", "delete", count, bench_now() - start);
+    hash_map_free(&open);
+    //
+    chained_map_t chained;
+    heap = bench_heap();
+    start = bench_now();
+    chained_map_init(&chained, 32);
+    for(i = 0; i < count; i++) {
+        chained_map_add(&chained, keys[i], (void *)(uintptr_t)(i + 1));
+    }
+    bench_report("chained", "insert", count, bench_now() - start);
+    printf("%-8s %-7s %8.1f bytes/entry\n", "chained", "memory", (double)(bench_heap() - heap) / count);
+    start = bench_now();
+    for(i = 0; i < count; i++) {
+        sink += (uintptr_t)chained_map_get(&chained, order[i]);
+    }
+    bench_report("chained", "lookup", count, bench_now() - start);
+    start = bench_now();
+    for(i = 0; i < count; i++) {
+        sink += (uintptr_t)chained_map_get(&chained, order[i] ^ 0x5bd1e995u);
+    }
+    bench_report("chained", "miss", count, bench_now() - start);
+    start = bench_now();
+    for(i = 0; i < count; i++) {
+        sink += (uintptr_t)chained_map_del(&chained, order[i]);
+    }
+    bench_report("chained", "delete", count, bench_now() - start);
+    chained_map_free(&chained);
+    //
+    uint64_t begin, *samples = malloc(sizeof(uint64_t) * count);
+    hash_map_init(&open, 1024);
+    for(i = 0; i < count; i++) {
+        begin = bench_ns();
+        hash_map_add(&open, keys[i], (void *)(uintptr_t)(i + 1));
+        samples[i] = bench_ns() - begin;
+    }
+    hash_map_free(&open);
+    bench_latency("open", samples, count);
+    //
+    chained_map_init(&chained, 1024);
+    for(i = 0; i < count; i++) {
+        begin = bench_ns();
+        chained_map_add(&chained, keys[i], (void *)(uintptr_t)(i + 1));
+        samples[i] = bench_ns() - begin;
+    }
+    chained_map_free(&chained);
+    bench_latency("chained", samples, count);
+    //
+    free(samples);
+    free(keys);
+    free(order);
+    (void)sink;
+    //
+    return 0;
+}
@@ -0,0 +1,157 @@
+#include "mutex_pool.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+
+typedef void*(*mutex_pool_task)(void*);
+
+typedef struct mutex_pool_task_node {
+    void* args;
+    mutex_pool_task task;
+    struct mutex_pool_task_node *next;
+} mutex_pool_task_node_t;
+
+typedef struct {
+    unsigned int thread_count;
+    pthread_t *threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    mutex_pool_task_node_t *head;
+    mutex_pool_task_node_t *tail;
+    unsigned int task_count;
+    int finished;
+} mutex_pool_private;
+
+
+void* mutex_pool_handle(void *ptr) {
+    mutex_pool_private *private = (mutex_pool_private *)ptr;
+    assert(private);
+    while(!private->finished){
+        mutex_pool_task_node_t *node = NULL;
+        {
+            pthread_mutex_lock(&private->mutex);
+
+            // rechecks finished under the lock, the broadcast from
+            // destroy may come before this thread waits.
+            while(private->task_count < 1 && !private->finished) {
+                pthread_cond_wait(&private->cond, &private->mutex);
+            }
+
+            if(private->task_count > 0) {
+                node = private->head;
+                if(node != NULL) {
+                    private->head = node->next;
+                }
+                if(private->head == NULL) {
+                    private->tail = NULL;
+                }
+
+                private->task_count -= 1;
+            }
+
+            pthread_mutex_unlock(&private->mutex);
+        }
+
+        //
+        if(node != NULL) {
+            (void) node->task(node->args);
+            free(node);
+        }
+    }
+
+    return NULL;
+}
+
+
+
+int mutex_pool_init(mutex_pool_t *pool, unsigned int size) {
+    assert(pool);
+    mutex_pool_private *private = (mutex_pool_private *)malloc(sizeof(mutex_pool_private));
+    memset(private, 0, sizeof(mutex_pool_private));
+    private->threads = (pthread_t *)malloc(sizeof(pthread_t) * size);
+    memset(private->threads, 0, sizeof(pthread_t) * size);
+    private->thread_count = size;
+
+    pthread_mutex_init(&private->mutex, NULL);
+    pthread_cond_init(&private->cond, NULL);
+
+    unsigned int i;
+    for(i = 0; i < size; i++){
+        pthread_create(&private->threads[i], NULL, mutex_pool_handle, private);
+    }
+
+    //
+    pool->priv = private;
+
+    return 0;
+}
+
+int mutex_pool_spawn(mutex_pool_t *pool, void *(*__start_routine)(void *), void *__restrict __arg) {
+    assert(pool);
+    mutex_pool_private *private = (mutex_pool_private *)pool->priv;
+    assert(private);
+    {
+        mutex_pool_task_node_t *node;
+        pthread_mutex_lock(&private->mutex);
+        //
+        node = (mutex_pool_task_node_t*)malloc(sizeof(mutex_pool_task_node_t));
+        node->args = __arg;
+        node->task = __start_routine;
+        node->next = NULL;
+        //
+        if(private->head == NULL){
+            private->head = node;
+            private->tail = node;
+        } else {
+            private->tail->next = node;
+            private->tail = node;
+        }
+        //
+        private->task_count += 1;
+        //
+        pthread_cond_signal(&private->cond);
+        pthread_mutex_unlock(&private->mutex);
+    }
+
+    return 0;
+}
+
+int mutex_pool_destroy(mutex_pool_t *pool) {
+    assert(pool);
+    mutex_pool_private *private = (mutex_pool_private *)pool->priv;
+    assert(private);
+
+    pthread_mutex_lock(&private->mutex);
+    private->finished = 1;
+
+    mutex_pool_task_node_t *node;
+    while(private->head != NULL){
+        node = private->head;
+        private->head = node->next;
+        free(node);
+    }
+    private->head = NULL;
+    private->tail = NULL;
+
+    pthread_cond_broadcast(&private->cond);
+    pthread_mutex_unlock(&private->mutex);
+    //
+    unsigned int i;
+    for(i = 0; i < private->thread_count; i++) {
+        pthread_join(private->threads[i], NULL);
+    }
+    //
+    pthread_cond_destroy(&private->cond);
+    pthread_mutex_destroy(&private->mutex);
+
+    free(private->threads);
+    free(private);
+    //
+    pool->priv = NULL;
+
+    return 0;
+}
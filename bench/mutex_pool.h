@@ -0,0 +1,36 @@
+#ifndef MUTEX_POOL_H
+#define MUTEX_POOL_H
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// the original single queue pthread_pool, kept as a baseline for benchmarks.
+
+typedef struct {
+    void *priv;
+} mutex_pool_t;
+
+
+int mutex_pool_init(
+    mutex_pool_t *pool,
+    unsigned int size
+);
+
+int mutex_pool_spawn(
+    mutex_pool_t *pool,
+    void *(*__start_routine)(void *),
+    void *__restrict __arg
+);
+
+int mutex_pool_destroy(
+    mutex_pool_t *pool
+);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MUTEX_POOL_H
@@ -0,0 +1,128 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../pthreadpool.h"
+#include "mutex_pool.h"
+
+// usage: pool-bench [max threads] [budget ms]
+//
+// runs fine grained tasks of 100ns, 1us and 10us on the work stealing
+// pthread_pool and on the old single queue pool, for 1 to max threads
+// in powers of two. "inject" spawns every task from the main thread,
+// "fanout" spawns 64 parents from it that spawn the rest from inside the
+// pool. each run holds about budget ms of work, it reports tasks/s from
+// the first spawn to the last task done.
+
+#define BENCH_FANOUT 64
+
+typedef struct {
+    const char *name;
+    int (*init)(void *pool, unsigned int size);
+    int (*spawn)(void *pool, void *(*fn)(void *), void *arg);
+    int (*destroy)(void *pool);
+} bench_pool_ops;
+
+static const bench_pool_ops *ops;
+static void *pool;
+static uint64_t work_ns;
+static uint64_t children;
+static uint64_t finished;
+
+static uint64_t bench_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void* bench_task(void *arg) {
+    (void)arg;
+    uint64_t until = bench_ns() + work_ns;
+    while(bench_ns() < until) {
+    }
+    __atomic_add_fetch(&finished, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+static void* bench_parent(void *arg) {
+    (void)arg;
+    uint64_t i;
+    for(i = 0; i < children; i++) {
+        ops->spawn(pool, bench_task, NULL);
+    }
+    __atomic_add_fetch(&finished, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+static int bench_pthread_init(void *p, unsigned int size) { return pthread_pool_init((pthread_pool_t *)p, size); }
+static int bench_pthread_spawn(void *p, void *(*fn)(void *), void *arg) { return pthread_pool_spawn((pthread_pool_t *)p, fn, arg); }
+static int bench_pthread_destroy(void *p) { return pthread_pool_destroy((pthread_pool_t *)p); }
+static int bench_mutex_init(void *p, unsigned int size) { return mutex_pool_init((mutex_pool_t *)p, size); }
+static int bench_mutex_spawn(void *p, void *(*fn)(void *), void *arg) { return mutex_pool_spawn((mutex_pool_t *)p, fn, arg); }
+static int bench_mutex_destroy(void *p) { return mutex_pool_destroy((mutex_pool_t *)p); }
+
+static const bench_pool_ops bench_pools[] = {
+    { "stealing", bench_pthread_init, bench_pthread_spawn, bench_pthread_destroy },
+    { "mutex",    bench_mutex_init,   bench_mutex_spawn,   bench_mutex_destroy },
+};
+
+static double bench_run(unsigned int threads, uint64_t tasks, int fanout) {
+    pthread_pool_t stealing;
+    mutex_pool_t mutex;
+    pool = ops == &bench_pools[0] ? (void *)&stealing : (void *)&mutex;
+    ops->init(pool, threads);
+    //
+    uint64_t i, want;
+    __atomic_store_n(&finished, 0, __ATOMIC_RELAXED);
+    uint64_t start = bench_ns();
+    if(fanout) {
+        children = tasks / BENCH_FANOUT;
+        want = BENCH_FANOUT * (children + 1);
+        for(i = 0; i < BENCH_FANOUT; i++) {
+            ops->spawn(pool, bench_parent, NULL);
+        }
+    } else {
+        want = tasks;
+        for(i = 0; i < tasks; i++) {
+            ops->spawn(pool, bench_task, NULL);
+        }
+    }
+    while(__atomic_load_n(&finished, __ATOMIC_RELAXED) < want) {
+        usleep(50);
+    }
+    double elapsed = (bench_ns() - start) / 1e9;
+    //
+    ops->destroy(pool);
+    //
+    return want / elapsed;
+}
+
+int main(int argc, char **argv) {
+    unsigned int max = argc > 1 ? (unsigned int)atoi(argv[1]) : 64;
+    uint64_t budget_ns = (argc > 2 ? (uint64_t)atoi(argv[2]) : 50) * 1000000ull;
+    //
+    static const uint64_t works[] = { 100, 1000, 10000 };
+    unsigned int threads, p, w;
+    int fanout;
+    uint64_t tasks;
+    for(w = 0; w < sizeof(works) / sizeof(works[0]); w++) {
+        work_ns = works[w];
+        tasks = budget_ns / work_ns;
+        for(fanout = 0; fanout < 2; fanout++) {
+            for(threads = 1; threads <= max; threads <<= 1) {
+                printf("work=%5luns %-6s threads=%-2u", (unsigned long)work_ns, fanout ? "fanout" : "inject", threads);
+                for(p = 0; p < sizeof(bench_pools) / sizeof(bench_pools[0]); p++) {
+                    ops = &bench_pools[p];
+                    printf("  %s %9.0f tasks/s", ops->name, bench_run(threads, tasks, fanout));
+                }
+                printf("\n");
+                fflush(stdout);
+            }
+        }
+    }
+    //
+    return 0;
+}
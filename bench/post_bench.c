@@ -0,0 +1,94 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../tcpserver.h"
+
+// usage: post-bench [producers] [posts per producer] [loops] [port]
+//
+// producer threads post empty tasks as fast as they can and the loops run
+// them. the interesting numbers are how many eventfd writes and wakeups a
+// post costs once posts start arriving in bursts.
+
+static tcp_server_t server;
+static tcp_server_attr_t attrs;
+static uint16_t port = 18110;
+static uint64_t posts = 1000000;
+static uint64_t ran;
+
+static void bench_task(void *arg) {
+    (void)arg;
+    __atomic_add_fetch(&ran, 1, __ATOMIC_RELAXED);
+}
+
+static void* bench_server(void *arg) {
+    (void)arg;
+    tcp_server_setup(&server, port, &attrs, &server);
+    return NULL;
+}
+
+static void* bench_producer(void *arg) {
+    (void)arg;
+    uint64_t i;
+    for(i = 0; i < posts; i++) {
+        while(tcp_server_post(&server, bench_task, NULL) != 0) {
+            usleep(1000);
+        }
+    }
+    return NULL;
+}
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    int producers = argc > 1 ? atoi(argv[1]) : 4;
+    if(argc > 2) {
+        posts = (uint64_t)atoll(argv[2]);
+    }
+    memset(&attrs, 0, sizeof(attrs));
+    attrs.threads = argc > 3 ? (uint32_t)atoi(argv[3]) : 1;
+    if(argc > 4) {
+        port = (uint16_t)atoi(argv[4]);
+    }
+    //
+    pthread_t thread, *threads = malloc(sizeof(pthread_t) * producers);
+    pthread_create(&thread, NULL, bench_server, NULL);
+    // setup publishes the server once its loops exist.
+    while(__atomic_load_n(&server.priv, __ATOMIC_ACQUIRE) == NULL) {
+        usleep(1000);
+    }
+    //
+    int i;
+    uint64_t total = posts * producers;
+    double start = bench_now();
+    for(i = 0; i < producers; i++) {
+        pthread_create(&threads[i], NULL, bench_producer, NULL);
+    }
+    for(i = 0; i < producers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    while(__atomic_load_n(&ran, __ATOMIC_RELAXED) < total) {
+        usleep(100);
+    }
+    double elapsed = bench_now() - start;
+    //
+    tcp_server_stats_t stats;
+    tcp_server_stats(&server, &stats);
+    printf("producers=%d loops=%u posts/s=%.0f signals/post=%.4f wakeups/post=%.4f batch avg=%.1f max=%lu\n",
+           producers, attrs.threads ? attrs.threads : 1, total / elapsed,
+           (double)stats.post_signals / stats.posted, (double)stats.wakeups / stats.posted,
+           (double)stats.posted / stats.post_batches, (unsigned long)stats.post_batch_max);
+    //
+    tcp_server_shutdown(&server);
+    pthread_join(thread, NULL);
+    free(threads);
+    //
+    return 0;
+}
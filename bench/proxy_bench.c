@@ -0,0 +1,163 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../tcpserver.h"
+
+// usage: proxy-bench [connections] [rounds] [size] [depth] [port]
+//
+// an echo server listens on port and a proxy in front of it on port + 1.
+// the same workload as echo-bench runs against each, so the difference is
+// what the extra hop costs. last, every proxied connection half closes
+// and has to see the echo server's EOF come back through the proxy.
+
+static tcp_server_t echo;
+static tcp_server_t proxy;
+static tcp_server_attr_t echo_attrs;
+static tcp_server_attr_t proxy_attrs;
+static uint16_t port = 18100;
+
+static int bench_on_readable(int sfd, void *data, uint32_t len, void *user) {
+    tcp_server_write((tcp_server_t *)user, sfd, data, len, 0);
+    return 0;
+}
+
+static void* bench_echo(void *arg) {
+    (void)arg;
+    tcp_server_setup(&echo, port, &echo_attrs, &echo);
+    return NULL;
+}
+
+static void* bench_proxy(void *arg) {
+    (void)arg;
+    tcp_server_setup(&proxy, port + 1, &proxy_attrs, &proxy);
+    return NULL;
+}
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench_connect(uint16_t to) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(to);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    //
+    int retry;
+    for(retry = 0; retry < 200; retry++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            int opt = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+            return fd;
+        }
+        close(fd);
+        usleep(10000);
+    }
+    return -1;
+}
+
+static int bench_run(const char *name, uint16_t to, int conns, int rounds, uint32_t size, int depth) {
+    int i, d, r, ret = 0, *fds = malloc(sizeof(int) * conns);
+    for(i = 0; i < conns; i++) {
+        fds[i] = bench_connect(to);
+        if(fds[i] < 0) {
+            fprintf(stderr, "connect failed\n");
+            return -1;
+        }
+    }
+    //
+    char *msg = malloc(size), *back = malloc((size_t)size * depth);
+    memset(msg, 'x', size);
+    //
+    tcp_server_stats_t before, after;
+    tcp_server_stats(&proxy, &before);
+    double start = bench_now();
+    for(r = 0; r < rounds && ret == 0; r++) {
+        for(i = 0; i < conns; i++) {
+            for(d = 0; d < depth; d++) {
+                send(fds[i], msg, size, 0);
+            }
+        }
+        for(i = 0; i < conns && ret == 0; i++) {
+            size_t got = 0, want = (size_t)size * depth;
+            while(got < want) {
+                ssize_t n = recv(fds[i], back + got, want - got, 0);
+                if(n <= 0) {
+                    fprintf(stderr, "connection lost\n");
+                    ret = -1;
+                    break;
+                }
+                got += (size_t)n;
+            }
+        }
+    }
+    double elapsed = bench_now() - start;
+    tcp_server_stats(&proxy, &after);
+    //
+    double messages = (double)conns * rounds * depth;
+    printf("%-6s conns=%d size=%u depth=%d msgs/s=%.0f MiB/s=%.0f proxy syscalls/msg=%.2f\n",
+           name, conns, size, depth, messages / elapsed, messages * size * 2 / elapsed / (1 << 20),
+           (after.syscalls - before.syscalls) / messages);
+    //
+    // a half close has to travel to upstream, and its answer back.
+    for(i = 0; i < conns && ret == 0 && to != port; i++) {
+        shutdown(fds[i], SHUT_WR);
+        if(recv(fds[i], back, size, 0) != 0) {
+            fprintf(stderr, "half close lost\n");
+            ret = -1;
+        }
+    }
+    for(i = 0; i < conns; i++) {
+        close(fds[i]);
+    }
+    free(fds);
+    free(msg);
+    free(back);
+    //
+    return ret;
+}
+
+int main(int argc, char **argv) {
+    int conns     = argc > 1 ? atoi(argv[1]) : 32;
+    int rounds    = argc > 2 ? atoi(argv[2]) : 20000;
+    uint32_t size = argc > 3 ? (uint32_t)atoi(argv[3]) : 64;
+    int depth     = argc > 4 ? atoi(argv[4]) : 1;
+    if(argc > 5) {
+        port = (uint16_t)atoi(argv[5]);
+    }
+    //
+    memset(&echo_attrs, 0, sizeof(echo_attrs));
+    echo_attrs.on_readable = bench_on_readable;
+    memset(&proxy_attrs, 0, sizeof(proxy_attrs));
+    proxy_attrs.upstream_host = "127.0.0.1";
+    proxy_attrs.upstream_port = port;
+    //
+    pthread_t echo_thread, proxy_thread;
+    pthread_create(&echo_thread, NULL, bench_echo, NULL);
+    pthread_create(&proxy_thread, NULL, bench_proxy, NULL);
+    //
+    int ret = bench_run("direct", port, conns, rounds, size, depth);
+    if(ret == 0) {
+        ret = bench_run("proxy", port + 1, conns, rounds, size, depth);
+    }
+    //
+    usleep(100000);
+    tcp_server_shutdown(&proxy);
+    tcp_server_shutdown(&echo);
+    pthread_join(proxy_thread, NULL);
+    pthread_join(echo_thread, NULL);
+    //
+    return ret == 0 ? 0 : 1;
+}
@@ -0,0 +1,147 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../hashmap.h"
+#include "../sharedmap.h"
+
+// usage: sharedmap-bench [max readers] [ms per step] [keys]
+//
+// one writer keeps deleting and re-adding a slice of the keys while 1, 2,
+// 4 ... max readers look keys up. every value read must be either NULL or
+// the value stored for that key, anything else counts as an error. the
+// same run against a mutex-wrapped hash_map is the baseline.
+
+static uint32_t key_count = 1 << 20;
+static volatile int running;
+static uint64_t errors;
+
+typedef struct {
+    int shared;
+    shared_map_t *map;
+    hash_map_t *locked;
+    pthread_mutex_t *mutex;
+    uint32_t seed;
+    uint64_t ops;
+} bench_worker;
+
+static void* bench_value(uint64_t key) {
+    return (void *)(uintptr_t)(key * 2 + 1);
+}
+
+static uint32_t bench_next(uint32_t *seed) {
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    return *seed;
+}
+
+static void* bench_reader(void *arg) {
+    bench_worker *worker = (bench_worker *)arg;
+    uint64_t key, ops = 0, bad = 0;
+    void *value;
+    while(__atomic_load_n(&running, __ATOMIC_RELAXED)) {
+        key = bench_next(&worker->seed) % key_count;
+        if(worker->shared) {
+            value = shared_map_get(worker->map, key);
+        } else {
+            pthread_mutex_lock(worker->mutex);
+            value = hash_map_get(worker->locked, key);
+            pthread_mutex_unlock(worker->mutex);
+        }
+        if(value != NULL && value != bench_value(key)) {
+            bad += 1;
+        }
+        ops += 1;
+    }
+    worker->ops = ops;
+    __atomic_add_fetch(&errors, bad, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+static void* bench_writer(void *arg) {
+    bench_worker *worker = (bench_worker *)arg;
+    uint64_t key, ops = 0;
+    while(__atomic_load_n(&running, __ATOMIC_RELAXED)) {
+        // churn the lower eighth of the key space.
+        key = bench_next(&worker->seed) % (key_count / 8);
+        if(worker->shared) {
+            shared_map_del(worker->map, key);
+            shared_map_add(worker->map, key, bench_value(key));
+        } else {
+            pthread_mutex_lock(worker->mutex);
+            hash_map_del(worker->locked, key);
+            hash_map_add(worker->locked, key, bench_value(key));
+            pthread_mutex_unlock(worker->mutex);
+        }
+        ops += 2;
+    }
+    worker->ops = ops;
+    return NULL;
+}
+
+static void bench_run(int shared, shared_map_t *map, hash_map_t *locked, pthread_mutex_t *mutex,
+                      int readers, int ms) {
+    bench_worker *workers = calloc(readers + 1, sizeof(bench_worker));
+    pthread_t *threads = calloc(readers + 1, sizeof(pthread_t));
+    int i;
+    running = 1;
+    for(i = 0; i <= readers; i++) {
+        workers[i].shared = shared;
+        workers[i].map    = map;
+        workers[i].locked = locked;
+        workers[i].mutex  = mutex;
+        workers[i].seed   = 2463534242u + i * 7919;
+        pthread_create(&threads[i], NULL, i == 0 ? bench_writer : bench_reader, &workers[i]);
+    }
+    usleep(ms * 1000);
+    running = 0;
+    uint64_t reads = 0;
+    for(i = 0; i <= readers; i++) {
+        pthread_join(threads[i], NULL);
+        if(i > 0) {
+            reads += workers[i].ops;
+        }
+    }
+    printf("%-7s readers=%-3d reads/s=%12.0f writes/s=%10.0f errors=%lu\n",
+           shared ? "shared" : "mutex", readers,
+           reads * 1000.0 / ms, workers[0].ops * 1000.0 / ms,
+           (unsigned long)__atomic_load_n(&errors, __ATOMIC_RELAXED));
+    free(workers);
+    free(threads);
+}
+
+int main(int argc, char **argv) {
+    int max_readers = argc > 1 ? atoi(argv[1]) : 64;
+    int ms = argc > 2 ? atoi(argv[2]) : 1000;
+    if(argc > 3) {
+        key_count = (uint32_t)atoi(argv[3]);
+    }
+    //
+    uint32_t i;
+    shared_map_t map;
+    shared_map_init(&map, 64, 16);
+    hash_map_t locked;
+    hash_map_init(&locked, 16);
+    pthread_mutex_t mutex;
+    pthread_mutex_init(&mutex, NULL);
+    for(i = 0; i < key_count; i++) {
+        shared_map_add(&map, i, bench_value(i));
+        hash_map_add(&locked, i, bench_value(i));
+    }
+    //
+    int readers;
+    for(readers = 1; readers <= max_readers; readers <<= 1) {
+        bench_run(1, &map, NULL, NULL, readers, ms);
+        bench_run(0, NULL, &locked, &mutex, readers, ms);
+    }
+    //
+    shared_map_free(&map);
+    hash_map_free(&locked);
+    pthread_mutex_destroy(&mutex);
+    //
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,169 @@
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../pthreadpool.h"
+#include "mutex_pool.h"
+
+// usage: spawn-bench [threads] [rounds] [spin us]
+//
+// spawn: ns the main thread spends queueing one no-op task, one at a
+// time on both pools and in batches of 64 on pthread_pool, along with
+// how much the heap grew over the rounds once warmed up.
+// dispatch: ns from the spawn until the task starts running on a pool
+// that went idle in between, p50 and p99, for a single task and for the
+// last task of a batch. with spin us the pthread_pool workers spin that
+// long before parking, which shows in the dispatch numbers.
+
+#define BENCH_BATCH 64
+#define BENCH_SAMPLES 2000
+#define BENCH_WARMUP 4
+
+typedef struct {
+    uint64_t spawned;
+    uint64_t started;
+} bench_stamp;
+
+static uint64_t finished;
+static uint32_t spin_us;
+
+static uint64_t bench_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void* bench_noop(void *arg) {
+    (void)arg;
+    __atomic_add_fetch(&finished, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void* bench_stamp_task(void *arg) {
+    bench_stamp *stamp = (bench_stamp *)arg;
+    stamp->started = bench_ns();
+    __atomic_add_fetch(&finished, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void bench_wait(uint64_t want) {
+    while(__atomic_load_n(&finished, __ATOMIC_ACQUIRE) < want) {
+    }
+}
+
+static void bench_init(pthread_pool_t *pool, unsigned int threads) {
+    pthread_pool_attr_t attr;
+    memset(&attr, 0, sizeof(pthread_pool_attr_t));
+    attr.min_threads = threads;
+    attr.max_threads = threads;
+    attr.spin_us     = spin_us;
+    pthread_pool_init_attr(pool, &attr);
+}
+
+static int bench_cmp(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void bench_spawn(const char *name, unsigned int threads, unsigned int rounds, int mode) {
+    pthread_pool_t pool;
+    mutex_pool_t mutex;
+    static void *args[BENCH_BATCH];
+    if(mode == 2) {
+        mutex_pool_init(&mutex, threads);
+    } else {
+        bench_init(&pool, threads);
+    }
+    //
+    unsigned int round, i;
+    uint64_t spent = 0, start;
+    size_t heap = 0;
+    __atomic_store_n(&finished, 0, __ATOMIC_RELAXED);
+    // the first rounds warm the pool up, the rest are measured.
+    for(round = 0; round < BENCH_WARMUP + rounds; round++) {
+        if(round == BENCH_WARMUP) {
+            heap = mallinfo2().uordblks;
+        }
+        start = bench_ns();
+        if(mode == 1) {
+            pthread_pool_spawn_batch(&pool, bench_noop, args, BENCH_BATCH);
+        } else {
+            for(i = 0; i < BENCH_BATCH; i++) {
+                if(mode == 2) {
+                    mutex_pool_spawn(&mutex, bench_noop, NULL);
+                } else {
+                    pthread_pool_spawn(&pool, bench_noop, NULL);
+                }
+            }
+        }
+        spent += round >= BENCH_WARMUP ? bench_ns() - start : 0;
+        bench_wait((uint64_t)(round + 1) * BENCH_BATCH);
+    }
+    long grown = (long)(mallinfo2().uordblks - heap);
+    //
+    if(mode == 2) {
+        mutex_pool_destroy(&mutex);
+    } else {
+        pthread_pool_destroy(&pool);
+    }
+    printf("spawn    %-14s threads=%-2u %7.1f ns/task  heap grew %ld bytes\n", name, threads,
+           (double)spent / ((uint64_t)rounds * BENCH_BATCH), grown);
+}
+
+static void bench_dispatch(const char *name, unsigned int threads, unsigned int batch) {
+    pthread_pool_t pool;
+    bench_init(&pool, threads);
+    //
+    static bench_stamp stamps[BENCH_BATCH];
+    static void *args[BENCH_BATCH];
+    static uint64_t samples[BENCH_SAMPLES];
+    unsigned int s, i;
+    uint64_t last;
+    __atomic_store_n(&finished, 0, __ATOMIC_RELAXED);
+    for(i = 0; i < batch; i++) {
+        args[i] = &stamps[i];
+    }
+    for(s = 0; s < BENCH_SAMPLES; s++) {
+        // let the workers park.
+        usleep(200);
+        stamps[0].spawned = bench_ns();
+        if(batch == 1) {
+            pthread_pool_spawn(&pool, bench_stamp_task, &stamps[0]);
+        } else {
+            pthread_pool_spawn_batch(&pool, bench_stamp_task, args, batch);
+        }
+        bench_wait((uint64_t)(s + 1) * batch);
+        last = 0;
+        for(i = 0; i < batch; i++) {
+            last = stamps[i].started > last ? stamps[i].started : last;
+        }
+        samples[s] = last - stamps[0].spawned;
+    }
+    pthread_pool_destroy(&pool);
+    //
+    qsort(samples, BENCH_SAMPLES, sizeof(uint64_t), bench_cmp);
+    printf("dispatch %-14s threads=%-2u p50 %7lu ns  p99 %7lu ns\n", name, threads,
+           (unsigned long)samples[BENCH_SAMPLES / 2], (unsigned long)samples[BENCH_SAMPLES * 99 / 100]);
+}
+
+int main(int argc, char **argv) {
+    unsigned int max = argc > 1 ? (unsigned int)atoi(argv[1]) : 8;
+    unsigned int rounds = argc > 2 ? (unsigned int)atoi(argv[2]) : 20000;
+    spin_us = argc > 3 ? (uint32_t)atoi(argv[3]) : 0;
+    //
+    unsigned int threads;
+    for(threads = 1; threads <= max; threads <<= 1) {
+        bench_spawn("single", threads, rounds, 0);
+        bench_spawn("batch", threads, rounds, 1);
+        bench_spawn("single mutex", threads, rounds, 2);
+        bench_dispatch("single", threads, 1);
+        bench_dispatch("batch last", threads, BENCH_BATCH);
+        fflush(stdout);
+    }
+    //
+    return 0;
+}
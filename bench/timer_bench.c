@@ -0,0 +1,114 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../timerwheel.h"
+
+// usage: timer-bench [timers] [seconds]
+//
+// arms `timers` idle timers of 30s on a wheel ticking in ms, then plays
+// `seconds` of traffic where every tick a thousandth of them see a read
+// and are pushed back by a full period, and one timer in 64 never hears
+// anything and fires. "move" moves the timer on every read, "stamp" only
+// notes the time of the read and lets the timer catch up when it goes
+// off, like tcp_server's connection deadlines. reports ns per arm, read,
+// cancel and per tick of advance, which covers the cascades and the
+// callbacks.
+
+#define BENCH_PERIOD 30000
+
+typedef struct {
+    timer_wheel_timer_t timer;
+    uint64_t last;
+} bench_conn;
+
+static timer_wheel_t wheel;
+static uint64_t now;
+static uint64_t fired;
+
+static uint64_t bench_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t bench_rand(uint32_t *seed) {
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    return *seed;
+}
+
+static void bench_fire(timer_wheel_timer_t *timer) {
+    bench_conn *conn = (bench_conn *)((char *)timer - offsetof(bench_conn, timer));
+    if(conn->last + BENCH_PERIOD > now) {
+        timer_wheel_add(&wheel, timer, conn->last + BENCH_PERIOD, bench_fire);
+        return;
+    }
+    fired += 1;
+}
+
+static void bench_report(const char *name, const char *op, uint64_t count, uint64_t elapsed) {
+    printf("%-6s %-8s %10lu ops %8.1f ns/op\n", name, op, (unsigned long)count, count ? (double)elapsed / count : 0.0);
+}
+
+static void bench_run(uint32_t count, uint64_t ticks, int stamp) {
+    bench_conn *conns = calloc(count, sizeof(bench_conn));
+    uint64_t start, reads = 0, tick, read_ns = 0, advance_ns = 0;
+    uint32_t i, j, seed = 2463534242u, per_tick = count / 1000 ? count / 1000 : 1;
+    const char *name = stamp ? "stamp" : "move";
+    now   = 1000;
+    fired = 0;
+    timer_wheel_init(&wheel, now);
+    //
+    start = bench_ns();
+    for(i = 0; i < count; i++) {
+        conns[i].last = now - (i % BENCH_PERIOD);
+        timer_wheel_add(&wheel, &conns[i].timer, conns[i].last + BENCH_PERIOD, bench_fire);
+    }
+    bench_report(name, "arm", count, bench_ns() - start);
+    //
+    for(tick = 0; tick < ticks; tick++) {
+        now += 1;
+        start = bench_ns();
+        for(j = 0; j < per_tick; j++) {
+            i = bench_rand(&seed) % count;
+            // the quiet ones are left to expire.
+            if((i & 63) == 0 || !timer_wheel_pending(&conns[i].timer)) {
+                continue;
+            }
+            conns[i].last = now;
+            if(!stamp) {
+                timer_wheel_add(&wheel, &conns[i].timer, now + BENCH_PERIOD, bench_fire);
+            }
+            reads += 1;
+        }
+        read_ns += bench_ns() - start;
+        start = bench_ns();
+        timer_wheel_advance(&wheel, now);
+        advance_ns += bench_ns() - start;
+    }
+    bench_report(name, "read", reads, read_ns);
+    bench_report(name, "advance", ticks, advance_ns);
+    printf("%-6s fired %lu, %u still armed\n", name, (unsigned long)fired, timer_wheel_size(&wheel));
+    //
+    start = bench_ns();
+    for(i = 0; i < count; i++) {
+        timer_wheel_del(&wheel, &conns[i].timer);
+    }
+    bench_report(name, "cancel", count, bench_ns() - start);
+    //
+    timer_wheel_free(&wheel);
+    free(conns);
+}
+
+int main(int argc, char **argv) {
+    uint32_t count = argc > 1 ? (uint32_t)atoi(argv[1]) : 1000000;
+    uint64_t ticks = (argc > 2 ? (uint64_t)atoi(argv[2]) : 60) * 1000;
+    //
+    bench_run(count, ticks, 0);
+    bench_run(count, ticks, 1);
+    //
+    return 0;
+}
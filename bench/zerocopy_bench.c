@@ -0,0 +1,213 @@
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../tcpserver.h"
+
+// usage: zerocopy-bench [MiB per run] [port]
+//
+// the client asks for a window of messages, the server answers with one
+// write per message, and the client reads them all before asking again.
+// every message size runs four ways: tcp_server_write copying into the
+// queue, tcp_server_write_ref without and with MSG_ZEROCOPY, and
+// tcp_server_sendfile from a memfd holding the same bytes. over loopback
+// the kernel copies zerocopy sends anyway, run it across a real nic to
+// see the gain.
+
+#define BENCH_WINDOW (4u << 20)
+#define BENCH_MAX_SIZE (1u << 20)
+
+typedef enum {
+    BENCH_COPY = 0,
+    BENCH_REF,
+    BENCH_ZEROCOPY,
+    BENCH_SENDFILE,
+} bench_mode;
+
+typedef struct {
+    uint32_t count;
+    uint32_t size;
+} bench_request;
+
+static const char *bench_names[] = { "copy", "ref", "zerocopy", "sendfile" };
+static tcp_server_t server;
+static tcp_server_attr_t attrs;
+static uint16_t port = 18090;
+static bench_mode mode;
+static char *payload;
+static int file;
+static uint64_t written;
+static uint64_t released;
+static uint64_t streamed;
+static uint64_t finished;
+
+static void bench_release(void *data, uint32_t len, void *user) {
+    (void)data;
+    (void)len;
+    (void)user;
+    __atomic_add_fetch(&released, 1, __ATOMIC_RELAXED);
+}
+
+static int bench_on_sendfile(int sfd, int fd, uint64_t sent, void *user) {
+    (void)sfd;
+    (void)fd;
+    (void)sent;
+    (void)user;
+    __atomic_add_fetch(&finished, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static int bench_on_readable(int sfd, void *data, uint32_t len, void *user) {
+    bench_request request;
+    uint32_t i;
+    if(len < sizeof(request)) {
+        return 0;
+    }
+    memcpy(&request, data, sizeof(request));
+    for(i = 0; i < request.count; i++) {
+        if(mode == BENCH_COPY) {
+            tcp_server_write((tcp_server_t *)user, sfd, payload, request.size, 0);
+        } else if(mode == BENCH_SENDFILE) {
+            if(tcp_server_sendfile((tcp_server_t *)user, sfd, file, 0, request.size) == 0) {
+                __atomic_add_fetch(&streamed, 1, __ATOMIC_RELAXED);
+            }
+        } else if(tcp_server_write_ref((tcp_server_t *)user, sfd, payload, request.size, bench_release, NULL) == 0) {
+            __atomic_add_fetch(&written, 1, __ATOMIC_RELAXED);
+        }
+    }
+    return 0;
+}
+
+static void* bench_server(void *arg) {
+    (void)arg;
+    tcp_server_setup(&server, port, &attrs, &server);
+    return NULL;
+}
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench_connect(void) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    //
+    int retry;
+    for(retry = 0; retry < 200; retry++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            return fd;
+        }
+        close(fd);
+        usleep(10000);
+    }
+    return -1;
+}
+
+static int bench_run(int fd, uint32_t size, uint64_t total, char *sink) {
+    bench_request request;
+    request.size  = size;
+    request.count = BENCH_WINDOW / size;
+    //
+    tcp_server_stats_t before, after;
+    tcp_server_stats(&server, &before);
+    uint64_t done = 0, want;
+    double start = bench_now();
+    while(done < total) {
+        if(send(fd, &request, sizeof(request), 0) != sizeof(request)) {
+            return -1;
+        }
+        want = (uint64_t)request.count * size;
+        while(want > 0) {
+            ssize_t n = recv(fd, sink, want < BENCH_WINDOW ? want : BENCH_WINDOW, 0);
+            if(n <= 0) {
+                return -1;
+            }
+            want -= (uint64_t)n;
+            done += (uint64_t)n;
+        }
+    }
+    double elapsed = bench_now() - start;
+    tcp_server_stats(&server, &after);
+    //
+    printf("%-8s size=%-8u MiB/s=%8.0f syscalls/msg=%.2f zerocopy=%lu copied=%lu\n",
+           bench_names[mode], size, done / elapsed / (1 << 20),
+           (double)(after.syscalls - before.syscalls) / (done / size),
+           (unsigned long)(after.zerocopy - before.zerocopy),
+           (unsigned long)(after.zerocopy_copied - before.zerocopy_copied));
+    //
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    uint64_t total = (uint64_t)(argc > 1 ? atoi(argv[1]) : 1024) << 20;
+    if(argc > 2) {
+        port = (uint16_t)atoi(argv[2]);
+    }
+    //
+    payload = malloc(BENCH_MAX_SIZE);
+    memset(payload, 'x', BENCH_MAX_SIZE);
+    char *sink = malloc(BENCH_WINDOW);
+    file = memfd_create("zerocopy-bench", 0);
+    if(file < 0 || write(file, payload, BENCH_MAX_SIZE) != BENCH_MAX_SIZE) {
+        perror("memfd");
+        return 1;
+    }
+    //
+    uint32_t size;
+    int ret = 0;
+    for(mode = BENCH_COPY; mode <= BENCH_SENDFILE; mode++) {
+        memset(&attrs, 0, sizeof(attrs));
+        attrs.on_readable  = bench_on_readable;
+        attrs.on_sendfile  = bench_on_sendfile;
+        attrs.zerocopy_min = mode == BENCH_ZEROCOPY ? 1 : 0;
+        //
+        pthread_t thread;
+        pthread_create(&thread, NULL, bench_server, NULL);
+        int fd = bench_connect();
+        if(fd < 0) {
+            fprintf(stderr, "connect failed\n");
+            return 1;
+        }
+        for(size = 4096; size <= BENCH_MAX_SIZE && ret == 0; size <<= 2) {
+            if(bench_run(fd, size, total, sink) != 0) {
+                fprintf(stderr, "connection lost\n");
+                ret = 1;
+            }
+        }
+        close(fd);
+        // wait for the loop to see the close, then every ref is back.
+        usleep(100000);
+        tcp_server_shutdown(&server);
+        pthread_join(thread, NULL);
+        port += 1;
+    }
+    //
+    // every ref handed over must have come back exactly once.
+    if(released != written) {
+        fprintf(stderr, "released %lu of %lu refs\n", (unsigned long)released, (unsigned long)written);
+        ret = 1;
+    }
+    if(finished != streamed) {
+        fprintf(stderr, "finished %lu of %lu file ranges\n", (unsigned long)finished, (unsigned long)streamed);
+        ret = 1;
+    }
+    close(file);
+    free(payload);
+    free(sink);
+    //
+    return ret;
+}
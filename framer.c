@@ -0,0 +1,98 @@
+#define _GNU_SOURCE
+#include "framer.h"
+#include <assert.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// a candidate at data + pos matched the needle's first and last byte.
+int framer_match(const char *data, size_t pos, const char *needle, size_t needle_len) {
+    return needle_len <= 2 || memcmp(data + pos + 1, needle + 1, needle_len - 2) == 0;
+}
+
+// what the vector loops leave over, fewer than a vector's worth of starts.
+const char* framer_find_tail(const char *data, size_t len, size_t pos, const char *needle, size_t needle_len) {
+    for(; pos + needle_len <= len; pos++) {
+        if(data[pos] == needle[0] && data[pos + needle_len - 1] == needle[needle_len - 1] &&
+           framer_match(data, pos, needle, needle_len)) {
+            return data + pos;
+        }
+    }
+    return NULL;
+}
+
+#if defined(__x86_64__)
+const char* framer_find_sse2(const char *data, size_t len, const char *needle, size_t needle_len) {
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last  = _mm_set1_epi8(needle[needle_len - 1]);
+    size_t pos;
+    uint32_t mask;
+    for(pos = 0; pos + 16 + needle_len - 1 <= len; pos += 16) {
+        __m128i head = _mm_loadu_si128((const __m128i *)(data + pos));
+        __m128i tail = _mm_loadu_si128((const __m128i *)(data + pos + needle_len - 1));
+        mask = (uint32_t)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, last)));
+        while(mask) {
+            if(framer_match(data, pos + __builtin_ctz(mask), needle, needle_len)) {
+                return data + pos + __builtin_ctz(mask);
+            }
+            mask &= mask - 1;
+        }
+    }
+    //
+    return framer_find_tail(data, len, pos, needle, needle_len);
+}
+
+__attribute__((target("avx2")))
+const char* framer_find_avx2(const char *data, size_t len, const char *needle, size_t needle_len) {
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last  = _mm256_set1_epi8(needle[needle_len - 1]);
+    size_t pos;
+    uint32_t mask;
+    for(pos = 0; pos + 32 + needle_len - 1 <= len; pos += 32) {
+        __m256i head = _mm256_loadu_si256((const __m256i *)(data + pos));
+        __m256i tail = _mm256_loadu_si256((const __m256i *)(data + pos + needle_len - 1));
+        mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(head, first), _mm256_cmpeq_epi8(tail, last)));
+        while(mask) {
+            if(framer_match(data, pos + __builtin_ctz(mask), needle, needle_len)) {
+                return data + pos + __builtin_ctz(mask);
+            }
+            mask &= mask - 1;
+        }
+    }
+    // the rest is under 32 bytes of starts, one sse2 step may still fit.
+    return framer_find_sse2(data + pos, len - pos, needle, needle_len);
+}
+#endif
+
+const char* framer_find(const void *data, size_t len, const void *needle, size_t needle_len) {
+    assert(data || len == 0);
+    assert(needle);
+    assert(needle_len > 0);
+    //
+    if(len < needle_len) {
+        return NULL;
+    }
+#if defined(__x86_64__)
+    if(__builtin_cpu_supports("avx2")) {
+        return framer_find_avx2((const char *)data, len, (const char *)needle, needle_len);
+    }
+    return framer_find_sse2((const char *)data, len, (const char *)needle, needle_len);
+#else
+    return (const char *)memmem(data, len, needle, needle_len);
+#endif
+}
+
+uint64_t framer_length(const void *data, uint32_t size, int little) {
+    assert(data);
+    assert(size == 1 || size == 2 || size == 4 || size == 8);
+    //
+    const uint8_t *bytes = (const uint8_t *)data;
+    uint64_t value = 0;
+    uint32_t i;
+    for(i = 0; i < size; i++) {
+        value |= (uint64_t)bytes[little ? i : size - 1 - i] << (8 * i);
+    }
+    //
+    return value;
+}
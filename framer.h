@@ -0,0 +1,36 @@
+#ifndef FRAMER_H
+#define FRAMER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+// the pieces tcp_server's message framing is made of, usable on their own.
+
+// the first needle in data, NULL when there is none. candidates are found
+// 32 or 16 bytes at a time by comparing the needle's first and last byte
+// with AVX2 when the cpu has it, SSE2 otherwise, so a two byte needle
+// such as "\r\n" needs no further check.
+const char* framer_find(
+    const void *data,
+    size_t len,
+    const void *needle,
+    size_t needle_len
+);
+
+// the unsigned size byte integer at data, size is 1, 2, 4 or 8, big endian
+// unless little is set.
+uint64_t framer_length(
+    const void *data,
+    uint32_t size,
+    int little
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FRAMER_H
@@ -3,67 +3,231 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Robin Hood open addressing over a flat slot array. Every slot has a
+// control byte, 0 when empty, otherwise 0x80 plus 7 bits of the hash, so
+// probing checks 16 slots at once without touching the keys. Deletion
+// shifts the following run back by one, so there are never tombstones
+// and a key always sits between its home slot and the next empty one.
+
+#define HASH_MAP_GROUP 16
+#define HASH_MAP_EMPTY 0x00
+// left behind in the draining table, keeps runs intact, matches no tag.
+#define HASH_MAP_MOVED 0x01
+// old slots visited per add/get/del while a resize is in progress.
+#define HASH_MAP_REHASH_STEP 4
 
-typedef struct hash_map_node{
-    uint32_t key;
+typedef struct {
+    uint64_t key;
     void* value;
-    struct hash_map_node *next;
-} hash_map_node_t;
-
-typedef hash_map_node_t* hash_map_node_ptr;
+} hash_map_slot;
 
 typedef struct {
-    hash_map_node_ptr *data;
+    hash_map_slot *slots;
+    // capacity + HASH_MAP_GROUP bytes, the tail mirrors the first group
+    // so a group load never has to wrap.
+    uint8_t *ctrl;
     uint32_t capacity;
+    uint32_t mask;
     uint32_t limit;
     uint32_t size;
+} hash_map_table;
+
+// growing allocates tables[1] and drains tables[0] into it a few slots
+// per operation, so no single call pays for the whole rehash. keys live
+// in exactly one of the two tables until tables[0] is empty.
+typedef struct {
+    hash_map_table tables[2];
+    int64_t rehash;
 } hash_map_private;
 
 
-uint32_t hash_map_index(uint32_t capacity, uint32_t key){
-    return key & (capacity - 1);
+uint64_t hash_map_hash(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ull;
+    key ^= key >> 33;
+    return key;
+}
+
+uint8_t hash_map_tag(uint64_t hash) {
+    return (uint8_t)(0x80 | (hash >> 57));
 }
 
-int hash_map_set(hash_map_node_ptr *container, uint32_t index, hash_map_node_t *new_node){
-    assert(container);
+uint32_t hash_map_index(hash_map_table *table, uint64_t hash){
+    return (uint32_t)hash & table->mask;
+}
 
-    hash_map_node_t *node = container[index];
-    if(node){
-        new_node->next = node;
+uint32_t hash_map_distance(hash_map_table *table, uint32_t index) {
+    uint32_t home = hash_map_index(table, hash_map_hash(table->slots[index].key));
+    return (index - home) & table->mask;
+}
+
+void hash_map_set_ctrl(hash_map_table *table, uint32_t index, uint8_t ctrl) {
+    table->ctrl[index] = ctrl;
+    if(index < HASH_MAP_GROUP) {
+        table->ctrl[table->capacity + index] = ctrl;
     }
+}
 
-    container[index] = new_node;
+// bit i set when ctrl[index + i] == value.
+uint32_t hash_map_match(hash_map_table *table, uint32_t index, uint8_t value) {
+#ifdef __SSE2__
+    __m128i group = _mm_loadu_si128((const __m128i *)(table->ctrl + index));
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)value)));
+#else
+    uint32_t i, bits = 0;
+    for(i = 0; i < HASH_MAP_GROUP; i++) {
+        if(table->ctrl[index + i] == value) {
+            bits |= 1u << i;
+        }
+    }
+    return bits;
+#endif
+}
 
+int64_t hash_map_find(hash_map_table *table, uint64_t key) {
+    if(table->size == 0) {
+        return -1;
+    }
+    //
+    uint64_t hash = hash_map_hash(key);
+    uint8_t tag = hash_map_tag(hash);
+    uint32_t index = hash_map_index(table, hash);
+    //
+    uint32_t match, empty, slot;
+    while(1) {
+        match = hash_map_match(table, index, tag);
+        empty = hash_map_match(table, index, HASH_MAP_EMPTY);
+        // nothing past the first empty slot belongs to this key.
+        if(empty) {
+            match &= (empty & -empty) - 1;
+        }
+        while(match) {
+            slot = (index + __builtin_ctz(match)) & table->mask;
+            if(table->slots[slot].key == key) {
+                return slot;
+            }
+            match &= match - 1;
+        }
+        if(empty) {
+            return -1;
+        }
+        index = (index + HASH_MAP_GROUP) & table->mask;
+    }
+}
+
+void hash_map_place(hash_map_table *table, uint64_t key, void* value) {
+    hash_map_slot slot = { key, value }, swap;
+    uint8_t tag = hash_map_tag(hash_map_hash(key)), ctrl;
+    uint32_t index = hash_map_index(table, hash_map_hash(key));
+    uint32_t distance = 0, other;
+    //
+    while(table->ctrl[index] != HASH_MAP_EMPTY) {
+        // take the slot from a richer entry and carry that one onwards.
+        other = hash_map_distance(table, index);
+        if(other < distance) {
+            swap = table->slots[index];
+            ctrl = table->ctrl[index];
+            table->slots[index] = slot;
+            hash_map_set_ctrl(table, index, tag);
+            slot = swap;
+            tag = ctrl;
+            distance = other;
+        }
+        index = (index + 1) & table->mask;
+        distance += 1;
+    }
+    //
+    table->slots[index] = slot;
+    hash_map_set_ctrl(table, index, tag);
+    table->size += 1;
+}
+
+void hash_map_remove(hash_map_table *table, uint32_t index) {
+    uint32_t next;
+    while(1) {
+        next = (index + 1) & table->mask;
+        if(table->ctrl[next] == HASH_MAP_EMPTY || hash_map_distance(table, next) == 0) {
+            break;
+        }
+        table->slots[index] = table->slots[next];
+        hash_map_set_ctrl(table, index, table->ctrl[next]);
+        index = next;
+    }
+    hash_map_set_ctrl(table, index, HASH_MAP_EMPTY);
+    table->size -= 1;
+}
+
+int hash_map_alloc(hash_map_table *table, uint32_t capacity) {
+    table->slots = (hash_map_slot *)malloc(sizeof(hash_map_slot) * capacity);
+    // HASH_MAP_EMPTY is 0, calloc gets large tables as fresh zero pages
+    // instead of faulting them all in with a memset.
+    table->ctrl  = (uint8_t *)calloc(capacity + HASH_MAP_GROUP, 1);
+    table->capacity = capacity;
+    table->mask     = capacity - 1;
+    table->limit    = capacity - capacity / 8;
+    table->size     = 0;
+    //
     return 0;
 }
 
-int hash_map_resize(hash_map_private *private) {
+void hash_map_release(hash_map_table *table) {
+    free(table->slots);
+    free(table->ctrl);
+    memset(table, 0, sizeof(hash_map_table));
+}
+
+int hash_map_rehash(hash_map_private *private, uint32_t steps) {
     assert(private);
 
-    hash_map_node_ptr *container;
-    uint32_t new_capacity = private->capacity << 1;
-    container = (hash_map_node_ptr*)malloc(sizeof(hash_map_node_ptr) * new_capacity);
-    memset(container, 0, sizeof(hash_map_node_ptr));
-    //
-    uint32_t i, index;
-    hash_map_node_t *node, *swap;
-    for(i = 0; i < private->capacity; i++) {
-        swap = private->data[i];
-        while(swap) {
-            node = swap;
-            swap = node->next;
-            node->next = NULL;
-
-            index = hash_map_index(new_capacity, node->key);
-            (void)hash_map_set(container, index, node);
+    if(private->rehash < 0) {
+        return 0;
+    }
+    //
+    hash_map_table *old = &private->tables[0];
+    hash_map_table *new = &private->tables[1];
+    uint32_t index;
+    uint8_t ctrl;
+    // moved slots keep their place so probing the rest of the old table
+    // still works. a delete may shift them around, never live ones below
+    // the cursor.
+    while(steps-- > 0 && old->size > 0) {
+        index = (uint32_t)private->rehash;
+        private->rehash = (index + 1) & old->mask;
+        ctrl = old->ctrl[index];
+        if(ctrl == HASH_MAP_EMPTY || ctrl == HASH_MAP_MOVED) {
+            continue;
         }
+        hash_map_place(new, old->slots[index].key, old->slots[index].value);
+        hash_map_set_ctrl(old, index, HASH_MAP_MOVED);
+        old->size -= 1;
     }
     //
-    free(private->data);
+    if(old->size == 0) {
+        hash_map_release(old);
+        *old = *new;
+        memset(new, 0, sizeof(hash_map_table));
+        private->rehash = -1;
+    }
     //
-    private->capacity = new_capacity;
-    private->data     = container;
-    private->limit    = private->capacity * 0.75;
+    return 0;
+}
+
+int hash_map_resize(hash_map_private *private) {
+    assert(private);
+
+    // still draining the last resize, finish it before starting another.
+    if(private->rehash >= 0) {
+        (void) hash_map_rehash(private, UINT32_MAX);
+    }
+    //
+    (void) hash_map_alloc(&private->tables[1], private->tables[0].capacity << 1);
+    private->rehash = 0;
     //
     return 0;
 }
@@ -74,94 +238,93 @@ int hash_map_init(hash_map_t *hash, uint32_t capacity) {
     assert((capacity & (capacity -1)) == 0);
     //
     hash_map_private *private = (hash_map_private*)malloc(sizeof(hash_map_private));
-    private->data = (hash_map_node_ptr*)malloc(sizeof(hash_map_node_ptr) * capacity);
-    memset(private->data, 0, sizeof(hash_map_node_ptr) * capacity);
-    private->capacity = capacity;
-    private->size = 0;
-    //
-    private->limit = private->capacity * 0.75;
+    memset(private, 0, sizeof(hash_map_private));
+    // a group never covers a slot twice.
+    if(capacity < HASH_MAP_GROUP) {
+        capacity = HASH_MAP_GROUP;
+    }
+    (void) hash_map_alloc(&private->tables[0], capacity);
+    private->rehash = -1;
     //
     hash->priv = private;
     //
     return 0;
 }
 
-int hash_map_add(hash_map_t *hash, uint32_t key, void* value) {
+int hash_map_add(hash_map_t *hash, uint64_t key, void* value) {
     assert(hash);
     hash_map_private *private = (hash_map_private*)hash->priv;
     assert(private);
 
-    if(private->limit < private->size) {
+    (void) hash_map_rehash(private, HASH_MAP_REHASH_STEP);
+    //
+    int i;
+    int64_t slot;
+    for(i = 0; i < 2; i++) {
+        slot = hash_map_find(&private->tables[i], key);
+        if(slot >= 0) {
+            private->tables[i].slots[slot].value = value;
+            return 0;
+        }
+    }
+    // new keys always go to the table that survives the resize.
+    hash_map_table *table = &private->tables[private->rehash >= 0 ? 1 : 0];
+    if(table->size >= table->limit) {
         (void) hash_map_resize(private);
+        table = &private->tables[1];
     }
-
-    hash_map_node_t *new_node = (hash_map_node_t *)malloc(sizeof(hash_map_node_t));
-    memset(new_node, 0, sizeof(hash_map_node_t));
-    new_node->key   = key;
-    new_node->value = value;
-
-    uint32_t index = hash_map_index(private->capacity, key);
-    (void)hash_map_set(private->data, index, new_node);
-    private->size += 1;
+    hash_map_place(table, key, value);
 
     return 0;
 }
 
-void* hash_map_del(hash_map_t *hash, uint32_t key) {
+void* hash_map_del(hash_map_t *hash, uint64_t key) {
     assert(hash);
     hash_map_private *private = (hash_map_private*)hash->priv;
     assert(private);
 
-    uint32_t index;
-    void* value = NULL;
-    hash_map_node_t *prev = NULL, *node = NULL, *next = NULL;
-    index = hash_map_index(private->capacity, key);
-    next = private->data[index];
-    while(next) {
-        node = next;
-        next = node->next;
-        //
-        if(node->key != key){
-            prev = node;
-            continue;
-        }
-        //
-        if(prev == NULL){
-            private->data[index] = next;
-        } else {
-            prev->next = next;
+    (void) hash_map_rehash(private, HASH_MAP_REHASH_STEP);
+    //
+    int i;
+    int64_t slot;
+    void* value;
+    for(i = 0; i < 2; i++) {
+        slot = hash_map_find(&private->tables[i], key);
+        if(slot >= 0) {
+            value = private->tables[i].slots[slot].value;
+            hash_map_remove(&private->tables[i], (uint32_t)slot);
+            return value;
         }
-        //
-        value = node->value;
-        free(node);
-        //
-        break;
     }
 
-    return value;
+    return NULL;
 }
 
-void* hash_map_get(hash_map_t *hash, uint32_t key) {
+void* hash_map_get(hash_map_t *hash, uint64_t key) {
     assert(hash);
     hash_map_private *private = (hash_map_private*)hash->priv;
     assert(private);
 
-    uint32_t index;
-    void* value = NULL;
-    hash_map_node_t *node = NULL, *next = NULL;
-    index = hash_map_index(private->capacity, key);
-    next = private->data[index];
-    while(next) {
-        node = next;
-        next = node->next;
-        //
-        if(node->key == key){
-            value = node->value;
-            break;
+    (void) hash_map_rehash(private, HASH_MAP_REHASH_STEP);
+    //
+    int i;
+    int64_t slot;
+    for(i = 0; i < 2; i++) {
+        slot = hash_map_find(&private->tables[i], key);
+        if(slot >= 0) {
+            return private->tables[i].slots[slot].value;
         }
     }
 
-    return value;
+    return NULL;
+}
+
+uint32_t hash_map_size(hash_map_t *hash) {
+    assert(hash);
+    hash_map_private *private = (hash_map_private*)hash->priv;
+    assert(private);
+
+    return private->tables[0].size + private->tables[1].size;
 }
 
 int hash_map_foreach(hash_map_t *hash, hash_map_iter iter, void* user) {
@@ -170,16 +333,15 @@ int hash_map_foreach(hash_map_t *hash, hash_map_iter iter, void* user) {
     hash_map_private *private = (hash_map_private*)hash->priv;
     assert(private);
 
+    int t;
     uint32_t i;
-    hash_map_node_t *node, *next;
-    for(i = 0; i < private->capacity; i++) {
-        next = private->data[i];
-        while(next) {
-            node = next;
-            next = node->next;
-            //
-            (void)iter(node->key, node->value, user);
-            //
+    hash_map_table *table;
+    for(t = 0; t < 2; t++) {
+        table = &private->tables[t];
+        for(i = 0; i < table->capacity; i++) {
+            if(table->ctrl[i] & 0x80) {
+                (void)iter(table->slots[i].key, table->slots[i].value, user);
+            }
         }
     }
 
@@ -191,18 +353,14 @@ int hash_map_clear(hash_map_t *hash) {
     hash_map_private *private = (hash_map_private*)hash->priv;
     assert(private);
 
-    uint32_t i;
-    hash_map_node_t *node, *next;
-    for(i = 0; i < private->capacity; i++) {
-        next = private->data[i];
-        while(next) {
-            node = next;
-            next = node->next;
-            //
-            free(node);
-            //
-        }
+    // drop the half-built table and keep the smaller one.
+    if(private->rehash >= 0) {
+        hash_map_release(&private->tables[1]);
+        private->rehash = -1;
     }
+    hash_map_table *table = &private->tables[0];
+    memset(table->ctrl, HASH_MAP_EMPTY, table->capacity + HASH_MAP_GROUP);
+    table->size = 0;
 
     return 0;
 }
@@ -212,20 +370,8 @@ int hash_map_free(hash_map_t *hash) {
     hash_map_private *private = (hash_map_private*)hash->priv;
     assert(private);
 
-    uint32_t i;
-    hash_map_node_t *node, *next;
-    for(i = 0; i < private->capacity; i++) {
-        next = private->data[i];
-        while(next) {
-            node = next;
-            next = node->next;
-            //
-            free(node);
-            //
-        }
-    }
-    //
-    free(private->data);
+    hash_map_release(&private->tables[0]);
+    hash_map_release(&private->tables[1]);
     free(private);
     //
     hash->priv = NULL;
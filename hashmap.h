@@ -11,16 +11,21 @@ typedef struct{
     void *priv;
 } hash_map_t;
 
-typedef int (*hash_map_iter)(uint32_t key, void* value, void* user);
+// keys are 64 bits wide, 32-bit callers convert implicitly.
+typedef int (*hash_map_iter)(uint64_t key, void* value, void* user);
 
 int hash_map_init(hash_map_t *hash, uint32_t capacity);
 
-int hash_map_add(hash_map_t *hash, uint32_t key, void* value);
+// adds key or replaces the value already stored under it.
+int hash_map_add(hash_map_t *hash, uint64_t key, void* value);
 
-void* hash_map_get(hash_map_t *hash, uint32_t key);
+void* hash_map_get(hash_map_t *hash, uint64_t key);
 
-void* hash_map_del(hash_map_t *hash, uint32_t key);
+void* hash_map_del(hash_map_t *hash, uint64_t key);
 
+uint32_t hash_map_size(hash_map_t *hash);
+
+// iter must not add or delete keys.
 int hash_map_foreach(hash_map_t *hash, hash_map_iter iter, void* user);
 
 int hash_map_clear(hash_map_t *hash);
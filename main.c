@@ -18,6 +18,7 @@ int main()
     tcp_server_attr_t attrs;
     memset(&attrs, 0, sizeof(tcp_server_attr_t));
     attrs.on_readable = client_on_readable;
+    attrs.threads     = TCP_SERVER_THREADS_AUTO;
     //
     fprintf(stderr, "server start...\n");
     tcp_server_setup(&server, 8088, &attrs,  &server);
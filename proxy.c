@@ -0,0 +1,26 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tcpserver.h"
+
+// usage: tcp-proxy <port> <upstream host> <upstream port> [threads]
+
+int main(int argc, char **argv)
+{
+    if(argc < 4) {
+        fprintf(stderr, "usage: %s <port> <upstream host> <upstream port> [threads]\n", argv[0]);
+        return 1;
+    }
+    //
+    tcp_server_t server;
+
+    tcp_server_attr_t attrs;
+    memset(&attrs, 0, sizeof(tcp_server_attr_t));
+    attrs.upstream_host = argv[2];
+    attrs.upstream_port = (uint16_t)atoi(argv[3]);
+    attrs.threads       = argc > 4 ? (uint32_t)atoi(argv[4]) : TCP_SERVER_THREADS_AUTO;
+    //
+    fprintf(stderr, "proxy start...\n");
+    return tcp_server_setup(&server, (uint16_t)atoi(argv[1]), &attrs, &server) == 0 ? 0 : 1;
+}
@@ -1,11 +1,57 @@
 #include "pthreadpool.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
+#include <time.h>
 
+// every worker owns a Chase-Lev deque: it pushes and takes at the bottom
+// without locks, idle workers steal from the top of the others. tasks
+// spawned by a worker go on its own deque, everybody else's go on the
+// injection stack, which posters push with a CAS and a worker empties in
+// one exchange, moving the tasks onto its deque where the rest can steal.
+//
+// a worker that finds nothing anywhere parks on its own condvar. a spawn
+// wakes at most one parked worker, and only when one is parked and none
+// is searching already, so a busy pool never takes a lock. a batch wakes
+// one per task, less the workers already searching.
+//
+// task nodes are recycled: nodes spawned by workers go back to a small
+// private cache of the worker that ran them, for its own spawns, the rest
+// go to a bounded MPMC ring any thread takes from. malloc only runs until
+// the pool has as many nodes as it keeps in flight.
+//
+// futures, groups and parallel_for count down a counter the caller owns
+// as their tasks finish. whoever waits on one from a worker keeps running
+// tasks meanwhile, so waiting inside the pool can't starve it.
+//
+// an elastic pool has a slot for each of max_threads workers. a monitor
+// thread adds a worker in a free slot when tasks wait too long to start,
+// workers past min_threads that stay parked for idle_timeout give their
+// slot back and exit. thieves walk all the slots, empty ones included.
+
+#define PTHREAD_POOL_DEQUE_SIZE 256
+#define PTHREAD_POOL_STEAL_ROUNDS 4
+#define PTHREAD_POOL_INJECT_EVERY 61
+#define PTHREAD_POOL_CACHE_SIZE 64
+#define PTHREAD_POOL_FREE_SIZE 1024
+// how long a worker waiting on a future blocks before it looks for tasks again.
+#define PTHREAD_POOL_JOIN_NS 1000000
+#define PTHREAD_POOL_GROW_AFTER_US 1000
+#define PTHREAD_POOL_IDLE_TIMEOUT_MS 5000
+// pause instructions between looks at the queues while spinning.
+#define PTHREAD_POOL_SPIN_PAUSES 32
+
+// worker slot states, guarded by mutex.
+#define PTHREAD_POOL_SLOT_EMPTY 0
+#define PTHREAD_POOL_SLOT_RUNNING 1
+// exited on its own, still to be joined.
+#define PTHREAD_POOL_SLOT_RETIRED 2
 
 typedef void*(*pthread_pool_task)(void*);
 
@@ -13,74 +59,751 @@ typedef struct pthread_pool_task_node {
     void* args;
     pthread_pool_task task;
     struct pthread_pool_task_node *next;
+    // spawned by a worker, goes back to the cache of whoever runs it.
+    int local;
+    // where the return value goes and what to count down once it's there,
+    // for futures, groups and parallel_for.
+    void **result;
+    uint64_t *counter;
+    // when it was spawned, for the wait times.
+    uint64_t queued;
 } pthread_pool_task_node_t;
 
+// the slots of a deque, replaced by one twice the size when full. thieves
+// may still read a replaced one, so they are only freed with the pool.
+typedef struct pthread_pool_ring {
+    int64_t mask;
+    struct pthread_pool_ring *retired;
+    pthread_pool_task_node_t *slots[];
+} pthread_pool_ring;
+
+// Vyukov's bounded queue: a cell is free to fill when its seq equals the
+// tail position and holds a node when seq is one past the head position.
+typedef struct {
+    uint64_t seq;
+    pthread_pool_task_node_t *node;
+} pthread_pool_cell;
+
 typedef struct {
+    uint64_t head __attribute__((aligned(64)));
+    uint64_t tail __attribute__((aligned(64)));
+    pthread_pool_cell cells[PTHREAD_POOL_FREE_SIZE] __attribute__((aligned(64)));
+} pthread_pool_freelist;
+
+typedef struct pthread_pool_private pthread_pool_private;
+
+typedef struct pthread_pool_worker {
+    int64_t top;
+    int64_t bottom;
+    pthread_pool_ring *ring;
+    pthread_pool_private *pool;
+    pthread_t thread;
+    uint32_t index;
+    uint32_t seed;
+    uint32_t ticks;
+    // nodes this worker ran, reused by its own spawns.
+    pthread_pool_task_node_t *cache;
+    uint32_t cached;
+    // parked: waits on cond until a spawn picks it off the sleepers.
+    pthread_cond_t cond;
+    int signalled;
+    struct pthread_pool_worker *next_sleeper;
+    int state;
+    // written by this worker only, summed up by pthread_pool_stats.
+    uint64_t spawned;
+    uint64_t started;
+    uint64_t waits[PTHREAD_POOL_WAIT_BUCKETS];
+} __attribute__((aligned(64))) pthread_pool_worker;
+
+struct pthread_pool_private {
+    // slots in workers, max_threads.
     unsigned int thread_count;
-    pthread_t *threads;
+    pthread_pool_worker *workers;
+    // running workers, changed under mutex, never below min_threads.
+    unsigned int threads;
+    unsigned int min_threads;
+    uint64_t grow_after_ns;
+    uint64_t idle_timeout_ns;
+    uint64_t spin_ns;
+    // tasks spawned from outside the workers, workers added and retired.
+    uint64_t spawned;
+    uint64_t grown;
+    uint64_t retired;
+    // wakes every grow_after_ns to size an elastic pool, sleeps on
+    // monitor_cond under mutex.
+    pthread_t monitor;
+    pthread_cond_t monitor_cond;
+    int monitoring;
+    // spawned from outside the workers, newest first.
+    pthread_pool_task_node_t *injected;
+    // parked workers, guarded by mutex, and how many there are.
     pthread_mutex_t mutex;
-    pthread_cond_t cond;
-    pthread_pool_task_node_t *head;
-    pthread_pool_task_node_t *tail;
-    unsigned int task_count;
+    // threads blocked in pthread_pool_join, woken on done under mutex.
+    pthread_cond_t done;
+    unsigned int waiters;
+    pthread_pool_worker *sleepers;
+    unsigned int idle;
+    // workers out of local work and looking elsewhere, spawns leave the
+    // sleepers alone while there is one.
+    unsigned int searching;
     int finished;
-} pthread_pool_private;
+    pthread_pool_freelist freelist;
+};
 
+// a parallel_for in progress, shared by the caller and its helper tasks.
+typedef struct {
+    pthread_pool_private *pool;
+    pthread_pool_range_fn fn;
+    void *user;
+    uint64_t next;
+    uint64_t end;
+    uint64_t grain;
+    uint32_t parts;
+    // iterations not done yet, and the caller plus helpers still holding on.
+    uint64_t left;
+    uint64_t refs;
+    void *helpers[];
+} pthread_pool_range;
+
+// the worker running on the calling thread, if any.
+static __thread pthread_pool_worker *pthread_pool_current = NULL;
 
-void* pthread_pool_handle(void *ptr) {
-    pthread_pool_private *private = (pthread_pool_private *)ptr;
-    assert(private);
-    while(!private->finished){
-        pthread_pool_task_node_t *node = NULL;
-        {
-            pthread_mutex_lock(&private->mutex);
 
-            if(private->task_count < 1) {
-                pthread_cond_wait(&private->cond, &private->mutex);
+uint64_t pthread_pool_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// the wait time bucket of ns: 0 under 1us, b for [2^(b-1), 2^b) us.
+uint32_t pthread_pool_bucket(uint64_t ns) {
+    uint64_t us = ns / 1000;
+    uint32_t bucket = us == 0 ? 0 : 64 - __builtin_clzll(us);
+    return bucket < PTHREAD_POOL_WAIT_BUCKETS ? bucket : PTHREAD_POOL_WAIT_BUCKETS - 1;
+}
+
+void pthread_pool_deadline(struct timespec *until, uint64_t ns) {
+    clock_gettime(CLOCK_REALTIME, until);
+    until->tv_sec  += ns / 1000000000ull;
+    until->tv_nsec += ns % 1000000000ull;
+    if(until->tv_nsec >= 1000000000) {
+        until->tv_sec  += 1;
+        until->tv_nsec -= 1000000000;
+    }
+}
+
+pthread_pool_ring* pthread_pool_ring_alloc(int64_t size) {
+    pthread_pool_ring *ring = (pthread_pool_ring *)malloc(sizeof(pthread_pool_ring) + sizeof(void *) * size);
+    ring->mask    = size - 1;
+    ring->retired = NULL;
+    //
+    return ring;
+}
+
+// owner only.
+pthread_pool_ring* pthread_pool_ring_grow(pthread_pool_worker *worker, int64_t top, int64_t bottom) {
+    pthread_pool_ring *old = worker->ring;
+    pthread_pool_ring *ring = pthread_pool_ring_alloc((old->mask + 1) << 1);
+    int64_t i;
+    for(i = top; i < bottom; i++) {
+        ring->slots[i & ring->mask] = __atomic_load_n(&old->slots[i & old->mask], __ATOMIC_RELAXED);
+    }
+    ring->retired = old;
+    __atomic_store_n(&worker->ring, ring, __ATOMIC_RELEASE);
+    //
+    return ring;
+}
+
+// owner only.
+void pthread_pool_deque_push(pthread_pool_worker *worker, pthread_pool_task_node_t *node) {
+    int64_t bottom = __atomic_load_n(&worker->bottom, __ATOMIC_RELAXED);
+    int64_t top = __atomic_load_n(&worker->top, __ATOMIC_ACQUIRE);
+    pthread_pool_ring *ring = __atomic_load_n(&worker->ring, __ATOMIC_RELAXED);
+    if(bottom - top > ring->mask) {
+        ring = pthread_pool_ring_grow(worker, top, bottom);
+    }
+    __atomic_store_n(&ring->slots[bottom & ring->mask], node, __ATOMIC_RELAXED);
+    __atomic_store_n(&worker->bottom, bottom + 1, __ATOMIC_RELEASE);
+}
+
+// owner only, a list linked newest first goes in oldest first and is
+// published with a single store of bottom.
+void pthread_pool_deque_push_batch(pthread_pool_worker *worker, pthread_pool_task_node_t *head, unsigned int count) {
+    int64_t bottom = __atomic_load_n(&worker->bottom, __ATOMIC_RELAXED);
+    int64_t top = __atomic_load_n(&worker->top, __ATOMIC_ACQUIRE);
+    pthread_pool_ring *ring = __atomic_load_n(&worker->ring, __ATOMIC_RELAXED);
+    while(bottom - top + count > ring->mask + 1) {
+        ring = pthread_pool_ring_grow(worker, top, bottom);
+    }
+    int64_t i = bottom + count;
+    while(head) {
+        i -= 1;
+        __atomic_store_n(&ring->slots[i & ring->mask], head, __ATOMIC_RELAXED);
+        head = head->next;
+    }
+    __atomic_store_n(&worker->bottom, bottom + count, __ATOMIC_RELEASE);
+}
+
+// owner only, newest first.
+pthread_pool_task_node_t* pthread_pool_deque_take(pthread_pool_worker *worker) {
+    int64_t bottom = __atomic_load_n(&worker->bottom, __ATOMIC_RELAXED) - 1;
+    pthread_pool_ring *ring = __atomic_load_n(&worker->ring, __ATOMIC_RELAXED);
+    __atomic_store_n(&worker->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t top = __atomic_load_n(&worker->top, __ATOMIC_RELAXED);
+    //
+    pthread_pool_task_node_t *node = NULL;
+    if(top <= bottom) {
+        node = __atomic_load_n(&ring->slots[bottom & ring->mask], __ATOMIC_RELAXED);
+        // the last one, a thief may be after it too.
+        if(top == bottom) {
+            if(!__atomic_compare_exchange_n(&worker->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+                node = NULL;
             }
+            __atomic_store_n(&worker->bottom, bottom + 1, __ATOMIC_RELAXED);
+        }
+    } else {
+        __atomic_store_n(&worker->bottom, bottom + 1, __ATOMIC_RELAXED);
+    }
+    //
+    return node;
+}
 
-            if(private->task_count > 0) {
-                node = private->head;
-                if(node != NULL) {
-                    private->head = node->next;
-                }
-                if(private->head == NULL) {
-                    private->tail = NULL;
-                }
+// any thread, oldest first. 1 when it lost a race and may retry.
+int pthread_pool_deque_steal(pthread_pool_worker *worker, pthread_pool_task_node_t **node) {
+    int64_t top = __atomic_load_n(&worker->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t bottom = __atomic_load_n(&worker->bottom, __ATOMIC_ACQUIRE);
+    //
+    *node = NULL;
+    if(top >= bottom) {
+        return 0;
+    }
+    pthread_pool_ring *ring = __atomic_load_n(&worker->ring, __ATOMIC_ACQUIRE);
+    pthread_pool_task_node_t *found = __atomic_load_n(&ring->slots[top & ring->mask], __ATOMIC_RELAXED);
+    if(!__atomic_compare_exchange_n(&worker->top, &top, top + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return 1;
+    }
+    *node = found;
+    //
+    return 0;
+}
 
-                private->task_count -= 1;
+// any thread, 0 when the ring is full.
+int pthread_pool_freelist_put(pthread_pool_freelist *freelist, pthread_pool_task_node_t *node) {
+    uint64_t pos = __atomic_load_n(&freelist->tail, __ATOMIC_RELAXED);
+    pthread_pool_cell *cell;
+    int64_t diff;
+    while(1) {
+        cell = &freelist->cells[pos & (PTHREAD_POOL_FREE_SIZE - 1)];
+        diff = (int64_t)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - pos);
+        if(diff == 0) {
+            if(__atomic_compare_exchange_n(&freelist->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
             }
+        } else if(diff < 0) {
+            return 0;
+        } else {
+            pos = __atomic_load_n(&freelist->tail, __ATOMIC_RELAXED);
+        }
+    }
+    cell->node = node;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    //
+    return 1;
+}
+
+// any thread, NULL when the ring is empty.
+pthread_pool_task_node_t* pthread_pool_freelist_get(pthread_pool_freelist *freelist) {
+    uint64_t pos = __atomic_load_n(&freelist->head, __ATOMIC_RELAXED);
+    pthread_pool_cell *cell;
+    int64_t diff;
+    while(1) {
+        cell = &freelist->cells[pos & (PTHREAD_POOL_FREE_SIZE - 1)];
+        diff = (int64_t)(__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (pos + 1));
+        if(diff == 0) {
+            if(__atomic_compare_exchange_n(&freelist->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if(diff < 0) {
+            return NULL;
+        } else {
+            pos = __atomic_load_n(&freelist->head, __ATOMIC_RELAXED);
+        }
+    }
+    pthread_pool_task_node_t *node = cell->node;
+    __atomic_store_n(&cell->seq, pos + PTHREAD_POOL_FREE_SIZE, __ATOMIC_RELEASE);
+    //
+    return node;
+}
+
+pthread_pool_task_node_t* pthread_pool_node_alloc(pthread_pool_private *private) {
+    pthread_pool_worker *worker = pthread_pool_current;
+    int local = worker && worker->pool == private;
+    pthread_pool_task_node_t *node;
+    if(local && worker->cache) {
+        node = worker->cache;
+        worker->cache = node->next;
+        worker->cached -= 1;
+    } else {
+        node = pthread_pool_freelist_get(&private->freelist);
+        if(node == NULL) {
+            node = (pthread_pool_task_node_t*)malloc(sizeof(pthread_pool_task_node_t));
+        }
+    }
+    if(node) {
+        node->local = local;
+    }
+    //
+    return node;
+}
 
+void pthread_pool_node_free(pthread_pool_private *private, pthread_pool_task_node_t *node) {
+    pthread_pool_worker *worker = pthread_pool_current;
+    if(node->local && worker && worker->pool == private && worker->cached < PTHREAD_POOL_CACHE_SIZE) {
+        node->next = worker->cache;
+        worker->cache = node;
+        worker->cached += 1;
+        return;
+    }
+    if(!pthread_pool_freelist_put(&private->freelist, node)) {
+        free(node);
+    }
+}
+
+int pthread_pool_has_work(pthread_pool_private *private) {
+    if(__atomic_load_n(&private->injected, __ATOMIC_RELAXED)) {
+        return 1;
+    }
+    unsigned int i;
+    pthread_pool_worker *worker;
+    for(i = 0; i < private->thread_count; i++) {
+        worker = &private->workers[i];
+        if(__atomic_load_n(&worker->top, __ATOMIC_RELAXED) < __atomic_load_n(&worker->bottom, __ATOMIC_RELAXED)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// hands work for wanted workers to the parked ones, less those already
+// out looking. the woken workers count as searching from here on, so a
+// burst of single spawns wakes workers one after another, not all at once.
+void pthread_pool_wake(pthread_pool_private *private, unsigned int wanted) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    unsigned int searching = __atomic_load_n(&private->searching, __ATOMIC_RELAXED);
+    if(searching >= wanted || __atomic_load_n(&private->idle, __ATOMIC_RELAXED) == 0) {
+        return;
+    }
+    wanted -= searching;
+    pthread_mutex_lock(&private->mutex);
+    pthread_pool_worker *worker;
+    while(wanted-- > 0 && (worker = private->sleepers) != NULL) {
+        private->sleepers = worker->next_sleeper;
+        __atomic_store_n(&private->idle, private->idle - 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&private->searching, 1, __ATOMIC_SEQ_CST);
+        worker->signalled = 1;
+        pthread_cond_signal(&worker->cond);
+    }
+    pthread_mutex_unlock(&private->mutex);
+}
+
+// empties the injection stack: the oldest task is returned, the rest go
+// on the worker's deque so it takes them oldest first and others steal.
+pthread_pool_task_node_t* pthread_pool_take_injected(pthread_pool_worker *worker) {
+    pthread_pool_private *private = worker->pool;
+    if(__atomic_load_n(&private->injected, __ATOMIC_RELAXED) == NULL) {
+        return NULL;
+    }
+    pthread_pool_task_node_t *node = __atomic_exchange_n(&private->injected, NULL, __ATOMIC_ACQUIRE);
+    if(node == NULL) {
+        return NULL;
+    }
+    // once pushed a node may be stolen and freed, read next first.
+    pthread_pool_task_node_t *next;
+    while((next = node->next) != NULL) {
+        pthread_pool_deque_push(worker, node);
+        node = next;
+    }
+    //
+    return node;
+}
+
+pthread_pool_task_node_t* pthread_pool_steal(pthread_pool_worker *worker) {
+    pthread_pool_private *private = worker->pool;
+    pthread_pool_task_node_t *node = pthread_pool_take_injected(worker);
+    if(node) {
+        return node;
+    }
+    //
+    unsigned int round, i, victim;
+    int raced;
+    for(round = 0; round < PTHREAD_POOL_STEAL_ROUNDS; round++) {
+        // a random first victim spreads thieves over the deques.
+        worker->seed ^= worker->seed << 13;
+        worker->seed ^= worker->seed >> 17;
+        worker->seed ^= worker->seed << 5;
+        raced = 0;
+        for(i = 0; i < private->thread_count; i++) {
+            victim = (worker->seed + i) % private->thread_count;
+            if(victim == worker->index) {
+                continue;
+            }
+            raced |= pthread_pool_deque_steal(&private->workers[victim], &node);
+            if(node) {
+                return node;
+            }
+        }
+        if(!raced) {
+            break;
+        }
+    }
+    //
+    return NULL;
+}
+
+// sleeps until a spawn wakes this worker or the pool goes away, 1 when
+// woken, the worker is then counted as searching. -1 when it idled out
+// of an elastic pool and has to exit.
+int pthread_pool_park(pthread_pool_worker *worker) {
+    pthread_pool_private *private = worker->pool;
+    pthread_mutex_lock(&private->mutex);
+    worker->signalled    = 0;
+    worker->next_sleeper = private->sleepers;
+    private->sleepers    = worker;
+    __atomic_store_n(&private->idle, private->idle + 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&private->mutex);
+    // a spawn racing with the above either sees idle or its task is seen here.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int work = pthread_pool_has_work(private);
+    //
+    pthread_mutex_lock(&private->mutex);
+    if(work && !worker->signalled) {
+        pthread_pool_worker **link;
+        for(link = &private->sleepers; *link; link = &(*link)->next_sleeper) {
+            if(*link == worker) {
+                *link = worker->next_sleeper;
+                __atomic_store_n(&private->idle, private->idle - 1, __ATOMIC_RELAXED);
+                break;
+            }
+        }
+    }
+    else if(private->thread_count > private->min_threads) {
+        struct timespec until;
+        pthread_pool_deadline(&until, private->idle_timeout_ns);
+        while(!worker->signalled && !private->finished) {
+            if(pthread_cond_timedwait(&worker->cond, &private->mutex, &until) != ETIMEDOUT) {
+                continue;
+            }
+            if(worker->signalled || private->finished || private->threads <= private->min_threads) {
+                pthread_pool_deadline(&until, private->idle_timeout_ns);
+                continue;
+            }
+            pthread_pool_worker **link;
+            for(link = &private->sleepers; *link; link = &(*link)->next_sleeper) {
+                if(*link == worker) {
+                    *link = worker->next_sleeper;
+                    break;
+                }
+            }
+            __atomic_store_n(&private->idle, private->idle - 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&private->threads, private->threads - 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&private->retired, private->retired + 1, __ATOMIC_RELAXED);
+            worker->state = PTHREAD_POOL_SLOT_RETIRED;
             pthread_mutex_unlock(&private->mutex);
+            return -1;
         }
+    }
+    else {
+        while(!worker->signalled && !private->finished) {
+            pthread_cond_wait(&worker->cond, &private->mutex);
+        }
+    }
+    int signalled = worker->signalled;
+    pthread_mutex_unlock(&private->mutex);
+    //
+    return signalled;
+}
+
+// counts amount off a future, group or range, the thread that takes it
+// to 0 wakes whoever waits on it. the counter may be gone right after.
+void pthread_pool_finish(pthread_pool_private *private, uint64_t *counter, uint64_t amount) {
+    if(__atomic_sub_fetch(counter, amount, __ATOMIC_SEQ_CST) > 0) {
+        return;
+    }
+    if(__atomic_load_n(&private->waiters, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&private->mutex);
+        pthread_cond_broadcast(&private->done);
+        pthread_mutex_unlock(&private->mutex);
+    }
+}
 
+void pthread_pool_run(pthread_pool_worker *worker, pthread_pool_task_node_t *node) {
+    pthread_pool_private *private = worker->pool;
+    uint32_t bucket = pthread_pool_bucket(pthread_pool_now() - node->queued);
+    __atomic_store_n(&worker->waits[bucket], worker->waits[bucket] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&worker->started, worker->started + 1, __ATOMIC_RELAXED);
+    //
+    void *result = node->task(node->args);
+    void **slot = node->result;
+    uint64_t *counter = node->counter;
+    pthread_pool_node_free(private, node);
+    //
+    if(slot) {
+        *slot = result;
+    }
+    if(counter) {
+        pthread_pool_finish(private, counter, 1);
+    }
+}
+
+// returns once counter drops to 0. a worker runs other tasks meanwhile,
+// the one it waits for may be among them, and only blocks for a moment
+// at a time when there are none; other threads block until woken.
+void pthread_pool_join(pthread_pool_private *private, uint64_t *counter) {
+    pthread_pool_worker *worker = pthread_pool_current;
+    int helping = worker && worker->pool == private;
+    pthread_pool_task_node_t *node;
+    struct timespec until;
+    while(__atomic_load_n(counter, __ATOMIC_ACQUIRE) > 0) {
+        if(helping) {
+            node = pthread_pool_deque_take(worker);
+            if(node == NULL) {
+                node = pthread_pool_steal(worker);
+            }
+            if(node) {
+                pthread_pool_run(worker, node);
+                continue;
+            }
+        }
         //
-        if(node != NULL) {
-            (void) node->task(node->args);
-            free(node);
+        pthread_mutex_lock(&private->mutex);
+        __atomic_add_fetch(&private->waiters, 1, __ATOMIC_SEQ_CST);
+        if(helping) {
+            pthread_pool_deadline(&until, PTHREAD_POOL_JOIN_NS);
+            if(__atomic_load_n(counter, __ATOMIC_SEQ_CST) > 0) {
+                pthread_cond_timedwait(&private->done, &private->mutex, &until);
+            }
+        } else {
+            while(__atomic_load_n(counter, __ATOMIC_SEQ_CST) > 0) {
+                pthread_cond_wait(&private->done, &private->mutex);
+            }
+        }
+        __atomic_sub_fetch(&private->waiters, 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&private->mutex);
+    }
+}
+
+// looks for work for up to spin_ns before the worker parks, 1 when some
+// showed up. the worker still counts as searching, so spawns meanwhile
+// leave the parked ones alone.
+int pthread_pool_spin(pthread_pool_worker *worker) {
+    pthread_pool_private *private = worker->pool;
+    uint64_t until = pthread_pool_now() + private->spin_ns;
+    unsigned int i;
+    do {
+        for(i = 0; i < PTHREAD_POOL_SPIN_PAUSES; i++) {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+        }
+        if(pthread_pool_has_work(private)) {
+            return 1;
+        }
+    } while(pthread_pool_now() < until && !__atomic_load_n(&private->finished, __ATOMIC_RELAXED));
+    //
+    return 0;
+}
+
+void* pthread_pool_handle(void *ptr) {
+    pthread_pool_worker *worker = (pthread_pool_worker *)ptr;
+    assert(worker);
+    pthread_pool_private *private = worker->pool;
+    //
+    pthread_pool_current = worker;
+    pthread_pool_task_node_t *node;
+    int searching = 0;
+    while(!__atomic_load_n(&private->finished, __ATOMIC_ACQUIRE)) {
+        node = NULL;
+        // now and then look outside first, so a worker feeding itself
+        // doesn't starve what was spawned from other threads.
+        if(++worker->ticks % PTHREAD_POOL_INJECT_EVERY == 0) {
+            node = pthread_pool_take_injected(worker);
+        }
+        if(node == NULL) {
+            node = pthread_pool_deque_take(worker);
         }
+        if(node == NULL) {
+            if(!searching) {
+                searching = 1;
+                __atomic_add_fetch(&private->searching, 1, __ATOMIC_SEQ_CST);
+            }
+            node = pthread_pool_steal(worker);
+        }
+        if(node == NULL && private->spin_ns > 0 && pthread_pool_spin(worker)) {
+            continue;
+        }
+        // the last one to stop searching passes the search on while
+        // there is work left, that is how a burst fans out.
+        if(searching) {
+            searching = 0;
+            if(__atomic_sub_fetch(&private->searching, 1, __ATOMIC_SEQ_CST) == 0 && node
+               && pthread_pool_has_work(private)) {
+                pthread_pool_wake(private, 1);
+            }
+        }
+        if(node == NULL) {
+            searching = pthread_pool_park(worker);
+            if(searching < 0) {
+                break;
+            }
+            continue;
+        }
+        //
+        pthread_pool_run(worker, node);
     }
+    pthread_pool_current = NULL;
 
     return NULL;
 }
 
 
 
+// starts a worker in slot i, under mutex. a retired worker left the slot
+// without touching the pool again, so joining it here can't block long.
+int pthread_pool_start(pthread_pool_private *private, unsigned int i) {
+    pthread_pool_worker *worker = &private->workers[i];
+    if(worker->state == PTHREAD_POOL_SLOT_RETIRED) {
+        pthread_join(worker->thread, NULL);
+        worker->state = PTHREAD_POOL_SLOT_EMPTY;
+    }
+    worker->signalled    = 0;
+    worker->next_sleeper = NULL;
+    if(pthread_create(&worker->thread, NULL, pthread_pool_handle, worker) != 0) {
+        return -1;
+    }
+    worker->state = PTHREAD_POOL_SLOT_RUNNING;
+    __atomic_store_n(&private->threads, private->threads + 1, __ATOMIC_RELAXED);
+    //
+    return 0;
+}
+
+// tasks that waited at least grow_after_ns to start, give or take the
+// bucket width.
+uint64_t pthread_pool_slow_starts(pthread_pool_private *private, uint64_t *started, uint64_t *spawned) {
+    uint32_t first = pthread_pool_bucket(private->grow_after_ns);
+    uint64_t slow = 0;
+    unsigned int i, b;
+    pthread_pool_worker *worker;
+    *started = 0;
+    *spawned = __atomic_load_n(&private->spawned, __ATOMIC_RELAXED);
+    for(i = 0; i < private->thread_count; i++) {
+        worker = &private->workers[i];
+        *started += __atomic_load_n(&worker->started, __ATOMIC_RELAXED);
+        *spawned += __atomic_load_n(&worker->spawned, __ATOMIC_RELAXED);
+        for(b = first + 1; b < PTHREAD_POOL_WAIT_BUCKETS; b++) {
+            slow += __atomic_load_n(&worker->waits[b], __ATOMIC_RELAXED);
+        }
+    }
+    //
+    return slow;
+}
+
+// adds a worker when tasks started late since the last look, or none
+// started at all while some were queued and nobody was idle, the way a
+// pool full of blocked tasks looks.
+void* pthread_pool_monitor(void *ptr) {
+    pthread_pool_private *private = (pthread_pool_private *)ptr;
+    uint64_t slow, started, spawned, last_slow, last_started;
+    last_slow = pthread_pool_slow_starts(private, &last_started, &spawned);
+    struct timespec until;
+    unsigned int i;
+    int grow;
+    //
+    pthread_mutex_lock(&private->mutex);
+    while(!private->finished) {
+        pthread_pool_deadline(&until, private->grow_after_ns);
+        pthread_cond_timedwait(&private->monitor_cond, &private->mutex, &until);
+        if(private->finished) {
+            break;
+        }
+        slow = pthread_pool_slow_starts(private, &started, &spawned);
+        grow = (slow > last_slow || (started == last_started && spawned > started))
+               && private->idle == 0 && private->threads < private->thread_count;
+        last_slow    = slow;
+        last_started = started;
+        if(!grow) {
+            continue;
+        }
+        for(i = 0; i < private->thread_count; i++) {
+            if(private->workers[i].state != PTHREAD_POOL_SLOT_RUNNING) {
+                if(pthread_pool_start(private, i) == 0) {
+                    __atomic_store_n(&private->grown, private->grown + 1, __ATOMIC_RELAXED);
+                }
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&private->mutex);
+
+    return NULL;
+}
+
 int pthread_pool_init(pthread_pool_t *pool, unsigned int size) {
+    pthread_pool_attr_t attr;
+    memset(&attr, 0, sizeof(pthread_pool_attr_t));
+    attr.min_threads = size;
+    attr.max_threads = size;
+
+    return pthread_pool_init_attr(pool, &attr);
+}
+
+int pthread_pool_init_attr(pthread_pool_t *pool, const pthread_pool_attr_t *attr) {
     assert(pool);
-    pthread_pool_private *private = (pthread_pool_private *)malloc(sizeof(pthread_pool_private));
+    assert(attr);
+    assert(attr->min_threads > 0);
+    unsigned int size = attr->max_threads > attr->min_threads ? attr->max_threads : attr->min_threads;
+    pthread_pool_private *private;
+    if(posix_memalign((void **)&private, 64, sizeof(pthread_pool_private)) != 0) {
+        return -1;
+    }
     memset(private, 0, sizeof(pthread_pool_private));
-    private->threads = (pthread_t *)malloc(sizeof(pthread_t) * size);
-    memset(private->threads, 0, sizeof(pthread_t) * size);
-    private->thread_count = size;
+    if(posix_memalign((void **)&private->workers, 64, sizeof(pthread_pool_worker) * size) != 0) {
+        free(private);
+        return -1;
+    }
+    memset(private->workers, 0, sizeof(pthread_pool_worker) * size);
+    private->thread_count    = size;
+    private->min_threads     = attr->min_threads;
+    private->grow_after_ns   = (uint64_t)(attr->grow_after_us ? attr->grow_after_us : PTHREAD_POOL_GROW_AFTER_US) * 1000ull;
+    private->idle_timeout_ns = (uint64_t)(attr->idle_timeout_ms ? attr->idle_timeout_ms : PTHREAD_POOL_IDLE_TIMEOUT_MS) * 1000000ull;
+    private->spin_ns         = (uint64_t)attr->spin_us * 1000ull;
 
     pthread_mutex_init(&private->mutex, NULL);
-    pthread_cond_init(&private->cond, NULL);
+    pthread_cond_init(&private->done, NULL);
+    pthread_cond_init(&private->monitor_cond, NULL);
 
     unsigned int i;
+    for(i = 0; i < PTHREAD_POOL_FREE_SIZE; i++) {
+        private->freelist.cells[i].seq = i;
+    }
+    pthread_pool_worker *worker;
     for(i = 0; i < size; i++){
-        pthread_create(&private->threads[i], NULL, pthread_pool_handle, private);
+        worker = &private->workers[i];
+        worker->ring  = pthread_pool_ring_alloc(PTHREAD_POOL_DEQUE_SIZE);
+        worker->pool  = private;
+        worker->index = i;
+        worker->seed  = 0x9e3779b9u * (i + 1);
+        pthread_cond_init(&worker->cond, NULL);
     }
+    pthread_mutex_lock(&private->mutex);
+    for(i = 0; i < private->min_threads; i++){
+        pthread_pool_start(private, i);
+    }
+    if(size > private->min_threads) {
+        private->monitoring = pthread_create(&private->monitor, NULL, pthread_pool_monitor, private) == 0;
+    }
+    pthread_mutex_unlock(&private->mutex);
 
     //
     pool->priv = private;
@@ -88,65 +811,343 @@ int pthread_pool_init(pthread_pool_t *pool, unsigned int size) {
     return 0;
 }
 
+int pthread_pool_queue(pthread_pool_private *private, pthread_pool_task task, void *args, void **result, uint64_t *counter) {
+    pthread_pool_task_node_t *node = pthread_pool_node_alloc(private);
+    if(node == NULL) {
+        return -1;
+    }
+    node->args    = args;
+    node->task    = task;
+    node->result  = result;
+    node->counter = counter;
+    node->queued  = pthread_pool_now();
+    //
+    pthread_pool_worker *worker = pthread_pool_current;
+    if(worker && worker->pool == private) {
+        __atomic_store_n(&worker->spawned, worker->spawned + 1, __ATOMIC_RELAXED);
+        pthread_pool_deque_push(worker, node);
+    } else {
+        __atomic_add_fetch(&private->spawned, 1, __ATOMIC_RELAXED);
+        node->next = __atomic_load_n(&private->injected, __ATOMIC_RELAXED);
+        while(!__atomic_compare_exchange_n(&private->injected, &node->next, node, 1,
+                                           __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+    }
+    pthread_pool_wake(private, 1);
+
+    return 0;
+}
+
 int pthread_pool_spawn(pthread_pool_t *pool, void *(*__start_routine)(void *), void *__restrict __arg) {
     assert(pool);
     pthread_pool_private *private = (pthread_pool_private *)pool->priv;
     assert(private);
-    {
-        pthread_pool_task_node_t *node;
-        pthread_mutex_lock(&private->mutex);
-        //
-        node = (pthread_pool_task_node_t*)malloc(sizeof(pthread_pool_task_node_t));
-        node->args = __arg;
-        node->task = __start_routine;
-        node->next = NULL;
-        //
-        if(private->head == NULL){
-            private->head = node;
-            private->tail = node;
-        } else {
-            private->tail->next = node;
-            private->tail = node;
+
+    return pthread_pool_queue(private, __start_routine, __arg, NULL, NULL);
+}
+
+int pthread_pool_spawn_batch(pthread_pool_t *pool, void *(*__start_routine)(void *), void **args, unsigned int count) {
+    assert(pool);
+    pthread_pool_private *private = (pthread_pool_private *)pool->priv;
+    assert(private);
+    assert(args || count == 0);
+    //
+    if(count == 0) {
+        return 0;
+    }
+    // linked newest first, the same order the injection stack keeps.
+    pthread_pool_task_node_t *head = NULL, *tail = NULL, *node;
+    uint64_t now = pthread_pool_now();
+    unsigned int i;
+    for(i = 0; i < count; i++) {
+        node = pthread_pool_node_alloc(private);
+        if(node == NULL) {
+            while(head) {
+                node = head;
+                head = node->next;
+                pthread_pool_node_free(private, node);
+            }
+            return -1;
+        }
+        node->args    = args[i];
+        node->task    = __start_routine;
+        node->result  = NULL;
+        node->counter = NULL;
+        node->queued  = now;
+        node->next    = head;
+        head = node;
+        if(tail == NULL) {
+            tail = node;
+        }
+    }
+    //
+    pthread_pool_worker *worker = pthread_pool_current;
+    if(worker && worker->pool == private) {
+        __atomic_store_n(&worker->spawned, worker->spawned + count, __ATOMIC_RELAXED);
+        pthread_pool_deque_push_batch(worker, head, count);
+    } else {
+        __atomic_add_fetch(&private->spawned, count, __ATOMIC_RELAXED);
+        tail->next = __atomic_load_n(&private->injected, __ATOMIC_RELAXED);
+        while(!__atomic_compare_exchange_n(&private->injected, &tail->next, head, 1,
+                                           __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
         }
-        //
-        private->task_count += 1;
-        //
-        pthread_cond_signal(&private->cond);
-        pthread_mutex_unlock(&private->mutex);
     }
+    pthread_pool_wake(private, count);
 
     return 0;
 }
 
-int pthread_pool_destroy(pthread_pool_t *pool) {
+int pthread_pool_submit(pthread_pool_t *pool, pthread_pool_future_t *future, void *(*__start_routine)(void *), void *__restrict __arg) {
     assert(pool);
+    assert(future);
     pthread_pool_private *private = (pthread_pool_private *)pool->priv;
     assert(private);
+    //
+    future->pending = 1;
+    future->result  = NULL;
+    if(pthread_pool_queue(private, __start_routine, __arg, &future->result, &future->pending) != 0) {
+        future->pending = 0;
+        return -1;
+    }
 
-    pthread_mutex_lock(&private->mutex);
-    private->finished = 1;
+    return 0;
+}
 
-    pthread_pool_task_node_t *node;
-    while(private->head != NULL){
-        node = private->head;
-        private->head = node->next;
-        free(node);
+int pthread_pool_future_wait(pthread_pool_t *pool, pthread_pool_future_t *future, void **result) {
+    assert(pool);
+    assert(future);
+    pthread_pool_private *private = (pthread_pool_private *)pool->priv;
+    assert(private);
+    //
+    pthread_pool_join(private, &future->pending);
+    if(result) {
+        *result = future->result;
     }
-    private->head = NULL;
-    private->tail = NULL;
 
-    pthread_cond_broadcast(&private->cond);
-    pthread_mutex_unlock(&private->mutex);
+    return 0;
+}
+
+int pthread_pool_future_try_wait(pthread_pool_future_t *future, void **result) {
+    assert(future);
+    //
+    if(__atomic_load_n(&future->pending, __ATOMIC_ACQUIRE) > 0) {
+        return 1;
+    }
+    if(result) {
+        *result = future->result;
+    }
+
+    return 0;
+}
+
+int pthread_pool_group_spawn(pthread_pool_t *pool, pthread_pool_group_t *group, void *(*__start_routine)(void *), void *__restrict __arg) {
+    assert(pool);
+    assert(group);
+    pthread_pool_private *private = (pthread_pool_private *)pool->priv;
+    assert(private);
+    //
+    __atomic_add_fetch(&group->pending, 1, __ATOMIC_RELAXED);
+    if(pthread_pool_queue(private, __start_routine, __arg, NULL, &group->pending) != 0) {
+        __atomic_sub_fetch(&group->pending, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    return 0;
+}
+
+int pthread_pool_group_wait(pthread_pool_t *pool, pthread_pool_group_t *group) {
+    assert(pool);
+    assert(group);
+    pthread_pool_private *private = (pthread_pool_private *)pool->priv;
+    assert(private);
+    //
+    pthread_pool_join(private, &group->pending);
+
+    return 0;
+}
+
+// takes the next chunk of the range, big while much is left and down to
+// grain towards the end, so late helpers still find work and nobody ends
+// up with a long tail. 0 once the range is handed out.
+int pthread_pool_range_next(pthread_pool_range *range, uint64_t *begin, uint64_t *end) {
+    uint64_t next = __atomic_load_n(&range->next, __ATOMIC_RELAXED), size;
+    do {
+        if(next >= range->end) {
+            return 0;
+        }
+        size = (range->end - next) / (2 * range->parts);
+        if(size < range->grain) {
+            size = range->grain;
+        }
+        if(size > range->end - next) {
+            size = range->end - next;
+        }
+    } while(!__atomic_compare_exchange_n(&range->next, &next, next + size, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    *begin = next;
+    *end   = next + size;
+    //
+    return 1;
+}
+
+void pthread_pool_range_work(pthread_pool_private *private, pthread_pool_range *range) {
+    uint64_t begin, end;
+    while(pthread_pool_range_next(range, &begin, &end)) {
+        range->fn(begin, end, range->user);
+        pthread_pool_finish(private, &range->left, end - begin);
+    }
+}
+
+void pthread_pool_range_release(pthread_pool_range *range) {
+    if(__atomic_sub_fetch(&range->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(range);
+    }
+}
+
+void* pthread_pool_range_help(void *ptr) {
+    pthread_pool_range *range = (pthread_pool_range *)ptr;
+    pthread_pool_range_work(range->pool, range);
+    pthread_pool_range_release(range);
+
+    return NULL;
+}
+
+int pthread_pool_parallel_for(pthread_pool_t *pool, uint64_t begin, uint64_t end, uint64_t grain, pthread_pool_range_fn fn, void *user) {
+    assert(pool);
+    assert(fn);
+    pthread_pool_private *private = (pthread_pool_private *)pool->priv;
+    assert(private);
+    //
+    if(begin >= end) {
+        return 0;
+    }
+    if(grain == 0) {
+        grain = 1;
+    }
+    uint64_t chunks = (end - begin + grain - 1) / grain;
+    unsigned int threads = __atomic_load_n(&private->threads, __ATOMIC_RELAXED);
+    unsigned int helpers = chunks - 1 < threads ? (unsigned int)(chunks - 1) : threads;
+    pthread_pool_range *range = NULL;
+    if(helpers > 0) {
+        range = (pthread_pool_range *)malloc(sizeof(pthread_pool_range) + sizeof(void *) * helpers);
+    }
+    // too small to split, or no memory to do it with.
+    if(range == NULL) {
+        fn(begin, end, user);
+        return 0;
+    }
+    range->pool  = private;
+    range->fn    = fn;
+    range->user  = user;
+    range->next  = begin;
+    range->end   = end;
+    range->grain = grain;
+    range->parts = helpers + 1;
+    range->left  = end - begin;
+    range->refs  = helpers + 1;
+    unsigned int i;
+    for(i = 0; i < helpers; i++) {
+        range->helpers[i] = range;
+    }
+    if(pthread_pool_spawn_batch(pool, pthread_pool_range_help, range->helpers, helpers) != 0) {
+        range->refs = 1;
+    }
+    // the caller works through the range too, then waits for the chunks
+    // still running elsewhere. helpers that start late find nothing left
+    // and the last one out frees the range.
+    pthread_pool_range_work(private, range);
+    pthread_pool_join(private, &range->left);
+    pthread_pool_range_release(range);
+
+    return 0;
+}
+
+int pthread_pool_stats(pthread_pool_t *pool, pthread_pool_stats_t *stats) {
+    assert(pool);
+    assert(stats);
+    pthread_pool_private *private = (pthread_pool_private *)pool->priv;
+    assert(private);
     //
+    memset(stats, 0, sizeof(pthread_pool_stats_t));
+    stats->threads = __atomic_load_n(&private->threads, __ATOMIC_RELAXED);
+    stats->idle    = __atomic_load_n(&private->idle, __ATOMIC_RELAXED);
+    stats->spawned = __atomic_load_n(&private->spawned, __ATOMIC_RELAXED);
+    stats->grown   = __atomic_load_n(&private->grown, __ATOMIC_RELAXED);
+    stats->retired = __atomic_load_n(&private->retired, __ATOMIC_RELAXED);
+    unsigned int i, b;
+    pthread_pool_worker *worker;
+    for(i = 0; i < private->thread_count; i++) {
+        worker = &private->workers[i];
+        stats->spawned += __atomic_load_n(&worker->spawned, __ATOMIC_RELAXED);
+        stats->started += __atomic_load_n(&worker->started, __ATOMIC_RELAXED);
+        for(b = 0; b < PTHREAD_POOL_WAIT_BUCKETS; b++) {
+            stats->wait_us[b] += __atomic_load_n(&worker->waits[b], __ATOMIC_RELAXED);
+        }
+    }
+    // the counters are read one after another, a task may show as started
+    // before its spawn does.
+    stats->queued = stats->spawned > stats->started ? stats->spawned - stats->started : 0;
+
+    return 0;
+}
+
+int pthread_pool_destroy(pthread_pool_t *pool) {
+    assert(pool);
+    pthread_pool_private *private = (pthread_pool_private *)pool->priv;
+    assert(private);
+
+    pthread_mutex_lock(&private->mutex);
+    __atomic_store_n(&private->finished, 1, __ATOMIC_RELEASE);
     unsigned int i;
     for(i = 0; i < private->thread_count; i++) {
-        pthread_join(private->threads[i], NULL);
+        pthread_cond_signal(&private->workers[i].cond);
+    }
+    pthread_cond_signal(&private->monitor_cond);
+    pthread_mutex_unlock(&private->mutex);
+    //
+    if(private->monitoring) {
+        pthread_join(private->monitor, NULL);
+    }
+    for(i = 0; i < private->thread_count; i++) {
+        if(private->workers[i].state != PTHREAD_POOL_SLOT_EMPTY) {
+            pthread_join(private->workers[i].thread, NULL);
+        }
+    }
+    // tasks that never started are dropped.
+    pthread_pool_task_node_t *node;
+    while(private->injected != NULL){
+        node = private->injected;
+        private->injected = node->next;
+        free(node);
+    }
+    pthread_pool_worker *worker;
+    pthread_pool_ring *ring;
+    int64_t j;
+    for(i = 0; i < private->thread_count; i++) {
+        worker = &private->workers[i];
+        for(j = worker->top; j < worker->bottom; j++) {
+            free(worker->ring->slots[j & worker->ring->mask]);
+        }
+        while(worker->ring) {
+            ring = worker->ring;
+            worker->ring = ring->retired;
+            free(ring);
+        }
+        while(worker->cache) {
+            node = worker->cache;
+            worker->cache = node->next;
+            free(node);
+        }
+        pthread_cond_destroy(&worker->cond);
+    }
+    while((node = pthread_pool_freelist_get(&private->freelist)) != NULL) {
+        free(node);
     }
     //
-    pthread_cond_destroy(&private->cond);
+    pthread_cond_destroy(&private->done);
+    pthread_cond_destroy(&private->monitor_cond);
     pthread_mutex_destroy(&private->mutex);
 
-    free(private->threads);
+    free(private->workers);
     free(private);
     //
     pool->priv = NULL;
@@ -2,6 +2,8 @@
 #define PTHREADPOOL_H
 
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -10,18 +12,138 @@ typedef struct {
     void *priv;
 } pthread_pool_t;
 
+// a task's return value, owned by the caller and filled in by
+// pthread_pool_submit. it must stay put until the task is done.
+typedef struct {
+    uint64_t pending;
+    void *result;
+} pthread_pool_future_t;
+
+// joins the tasks spawned into it, starts zeroed and can be reused once
+// waited for.
+typedef struct {
+    uint64_t pending;
+} pthread_pool_group_t;
+
+typedef void (*pthread_pool_range_fn)(uint64_t begin, uint64_t end, void *user);
+
+typedef struct {
+    // workers always running, at least 1, and the most there may be. with
+    // max_threads above min_threads the pool adds workers while tasks wait
+    // longer than grow_after_us to start, or while none start at all, and
+    // workers above min_threads exit once parked for idle_timeout_ms.
+    uint32_t min_threads;
+    uint32_t max_threads;
+    // 0 uses the defaults (1000us, 5000ms).
+    uint32_t grow_after_us;
+    uint32_t idle_timeout_ms;
+    // a worker out of work keeps looking this long before it parks,
+    // trading cpu for wake up latency. 0 parks at once.
+    uint32_t spin_us;
+} pthread_pool_attr_t;
+
+#define PTHREAD_POOL_WAIT_BUCKETS 24
+
+typedef struct {
+    uint32_t threads;  // workers running
+    uint32_t idle;     // of those, parked
+    uint64_t queued;   // tasks spawned and not started yet
+    uint64_t spawned;  // tasks spawned
+    uint64_t started;  // tasks started
+    uint64_t grown;    // workers added above min_threads
+    uint64_t retired;  // workers that exited after idle_timeout_ms
+    // time from spawn to start: wait_us[0] counts tasks that waited less
+    // than 1us, wait_us[i] those that waited [2^(i-1), 2^i) us, the last
+    // bucket also everything longer.
+    uint64_t wait_us[PTHREAD_POOL_WAIT_BUCKETS];
+} pthread_pool_stats_t;
+
 
+// a pool of size threads, no spinning.
 int pthread_pool_init(
     pthread_pool_t *pool,
     unsigned int size
 );
 
+int pthread_pool_init_attr(
+    pthread_pool_t *pool,
+    const pthread_pool_attr_t *attr
+);
+
+// queues a task without taking a lock. from one of the pool's own threads
+// it goes on that thread's deque, runs before what it queued earlier, and
+// idle threads may steal it; from anywhere else any idle thread takes it.
 int pthread_pool_spawn(
     pthread_pool_t *pool,
     void *(*__start_routine)(void *),
     void *__restrict __arg
 );
 
+// queues count tasks running __start_routine on args[0] to args[count-1]
+// with one CAS, or from a pool thread with one publish on its deque, and
+// wakes up to count idle threads for them.
+int pthread_pool_spawn_batch(
+    pthread_pool_t *pool,
+    void *(*__start_routine)(void *),
+    void **args,
+    unsigned int count
+);
+
+// queues a task like pthread_pool_spawn and keeps what it returns in future.
+int pthread_pool_submit(
+    pthread_pool_t *pool,
+    pthread_pool_future_t *future,
+    void *(*__start_routine)(void *),
+    void *__restrict __arg
+);
+
+// waits for the task and stores its return value in result, if given.
+// a pool thread runs other tasks while it waits.
+int pthread_pool_future_wait(
+    pthread_pool_t *pool,
+    pthread_pool_future_t *future,
+    void **result
+);
+
+// 0 and the return value in result once the task is done, 1 before.
+int pthread_pool_future_try_wait(
+    pthread_pool_future_t *future,
+    void **result
+);
+
+int pthread_pool_group_spawn(
+    pthread_pool_t *pool,
+    pthread_pool_group_t *group,
+    void *(*__start_routine)(void *),
+    void *__restrict __arg
+);
+
+// waits until every task spawned into group is done, helping like
+// pthread_pool_future_wait.
+int pthread_pool_group_wait(
+    pthread_pool_t *pool,
+    pthread_pool_group_t *group
+);
+
+// calls fn over [begin, end) in chunks of at least grain, shared between
+// the calling thread and the pool's threads. chunks start large and
+// shrink as the range runs out. returns when all of them are done.
+int pthread_pool_parallel_for(
+    pthread_pool_t *pool,
+    uint64_t begin,
+    uint64_t end,
+    uint64_t grain,
+    pthread_pool_range_fn fn,
+    void *user
+);
+
+int pthread_pool_stats(
+    pthread_pool_t *pool,
+    pthread_pool_stats_t *stats
+);
+
+// stops the threads once their current tasks return, tasks that haven't
+// started by then are dropped.
 int pthread_pool_destroy(
     pthread_pool_t *pool
 );
@@ -0,0 +1,458 @@
+#include "sharedmap.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// every shard is a linear probing table whose slots keep their key for
+// the life of the table once taken: a delete only clears the value, and
+// adding the key again fills the same slot. nothing a reader walks over
+// ever moves, so readers probe with plain atomic loads and never retry.
+// writers take their shard's mutex. once taken slots reach the limit the
+// writer builds a fresh table out of the live entries, twice the size
+// when over half of them are live, and swaps it in.
+//
+// memory a reader may still be looking at is reclaimed by epochs, one
+// count shared by every map. while it holds anything from a map a thread
+// is marked inside on a record of its own, which notes the epoch it came
+// in at. the epoch only moves on once every thread inside has caught up
+// with it, so what was taken out of a map at epoch e is out of every
+// reader's reach by e + 2. replaced tables wait for that on their shard,
+// removed values with whoever removed them.
+
+#define SHARED_MAP_CACHELINE 64
+
+typedef struct {
+    uint64_t key;
+    void* value;
+} shared_map_slot;
+
+typedef struct shared_map_table {
+    shared_map_slot *slots;
+    uint8_t *used;
+    uint32_t capacity;
+    uint32_t mask;
+    uint32_t limit;
+    // replaced tables of a shard, and the epoch they were replaced at.
+    struct shared_map_table *retired;
+    uint64_t epoch;
+} shared_map_table;
+
+typedef struct {
+    // live entries, and slots taken by live entries or deleted ones.
+    uint32_t size;
+    uint32_t filled;
+    shared_map_table *table;
+    shared_map_table *retired;
+    pthread_mutex_t mutex;
+} __attribute__((aligned(SHARED_MAP_CACHELINE))) shared_map_shard;
+
+typedef struct {
+    shared_map_shard *shards;
+    uint32_t shard_count;
+    uint32_t shard_shift;
+} shared_map_private;
+
+// one per thread that ever read, only written by it. taken again by a
+// new thread once its owner exited, never freed.
+typedef struct shared_map_reader {
+    // nested enters, and the epoch of the outermost one.
+    uint32_t count;
+    uint64_t epoch;
+    int taken;
+    struct shared_map_reader *next;
+} __attribute__((aligned(SHARED_MAP_CACHELINE))) shared_map_reader;
+
+static shared_map_reader *shared_map_readers = NULL;
+static uint64_t shared_map_now __attribute__((aligned(SHARED_MAP_CACHELINE))) = 0;
+static pthread_once_t shared_map_once = PTHREAD_ONCE_INIT;
+static pthread_key_t shared_map_exit;
+static __thread shared_map_reader *shared_map_self = NULL;
+
+
+uint64_t shared_map_hash(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ull;
+    key ^= key >> 33;
+    return key;
+}
+
+shared_map_table* shared_map_table_alloc(uint32_t capacity) {
+    shared_map_table *table = (shared_map_table *)malloc(sizeof(shared_map_table));
+    if(table == NULL) {
+        return NULL;
+    }
+    table->slots    = (shared_map_slot *)calloc(capacity, sizeof(shared_map_slot));
+    table->used     = (uint8_t *)calloc(capacity, 1);
+    if(table->slots == NULL || table->used == NULL) {
+        free(table->slots);
+        free(table->used);
+        free(table);
+        return NULL;
+    }
+    table->capacity = capacity;
+    table->mask     = capacity - 1;
+    table->limit    = capacity - capacity / 4;
+    table->retired  = NULL;
+    table->epoch    = 0;
+    //
+    return table;
+}
+
+void shared_map_table_free(shared_map_table *table) {
+    shared_map_table *next;
+    while(table) {
+        next = table->retired;
+        free(table->slots);
+        free(table->used);
+        free(table);
+        table = next;
+    }
+}
+
+shared_map_shard* shared_map_shard_of(shared_map_private *private, uint64_t hash) {
+    return &private->shards[private->shard_shift < 64 ? hash >> private->shard_shift : 0];
+}
+
+void shared_map_reader_exit(void *reader) {
+    __atomic_store_n(&((shared_map_reader *)reader)->taken, 0, __ATOMIC_RELEASE);
+}
+
+void shared_map_reader_once(void) {
+    (void) pthread_key_create(&shared_map_exit, shared_map_reader_exit);
+}
+
+// the calling thread's record, a free one or a new one the first time.
+shared_map_reader* shared_map_reader_self(void) {
+    if(shared_map_self) {
+        return shared_map_self;
+    }
+    (void) pthread_once(&shared_map_once, shared_map_reader_once);
+    shared_map_reader *reader;
+    int taken;
+    for(reader = __atomic_load_n(&shared_map_readers, __ATOMIC_ACQUIRE); reader; reader = reader->next) {
+        taken = 0;
+        if(__atomic_compare_exchange_n(&reader->taken, &taken, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    if(reader == NULL) {
+        if(posix_memalign((void **)&reader, SHARED_MAP_CACHELINE, sizeof(shared_map_reader)) != 0) {
+            perror("shared_map reader");
+            abort();
+        }
+        memset(reader, 0, sizeof(shared_map_reader));
+        reader->taken = 1;
+        reader->next  = __atomic_load_n(&shared_map_readers, __ATOMIC_RELAXED);
+        while(!__atomic_compare_exchange_n(&shared_map_readers, &reader->next, reader, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+    }
+    (void) pthread_setspecific(shared_map_exit, reader);
+    shared_map_self = reader;
+    //
+    return reader;
+}
+
+// moves the epoch on if every thread inside came in at the current one,
+// returns the epoch as it then is.
+uint64_t shared_map_advance(void) {
+    uint64_t epoch = __atomic_load_n(&shared_map_now, __ATOMIC_SEQ_CST);
+    shared_map_reader *reader;
+    for(reader = __atomic_load_n(&shared_map_readers, __ATOMIC_ACQUIRE); reader; reader = reader->next) {
+        if(__atomic_load_n(&reader->count, __ATOMIC_SEQ_CST) > 0 &&
+           __atomic_load_n(&reader->epoch, __ATOMIC_SEQ_CST) != epoch) {
+            return epoch;
+        }
+    }
+    // another thread moving it first is as good.
+    if(__atomic_compare_exchange_n(&shared_map_now, &epoch, epoch + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        return epoch + 1;
+    }
+    return epoch;
+}
+
+int shared_map_reached(uint64_t epoch) {
+    uint64_t now = __atomic_load_n(&shared_map_now, __ATOMIC_SEQ_CST), last;
+    while(now < epoch + 2) {
+        last = now;
+        now  = shared_map_advance();
+        if(now == last) {
+            break;
+        }
+    }
+    return now >= epoch + 2;
+}
+
+// frees the shard's replaced tables no reader can be in any more. the
+// newest ones are first, so the rest of the list is older still.
+void shared_map_shard_reclaim(shared_map_shard *shard) {
+    shared_map_table **link = &shard->retired;
+    while(*link && !shared_map_reached((*link)->epoch)) {
+        link = &(*link)->retired;
+    }
+    shared_map_table_free(*link);
+    *link = NULL;
+}
+
+// called by the shard's writer and by readers alike, a slot is marked
+// used only once its key is in, and the key never changes after.
+int64_t shared_map_probe(shared_map_table *table, uint64_t key, uint64_t hash) {
+    uint32_t index = (uint32_t)hash & table->mask;
+    uint32_t n;
+    for(n = 0; n < table->capacity; n++) {
+        if(!__atomic_load_n(&table->used[index], __ATOMIC_ACQUIRE)) {
+            return -1;
+        }
+        if(__atomic_load_n(&table->slots[index].key, __ATOMIC_RELAXED) == key) {
+            return index;
+        }
+        index = (index + 1) & table->mask;
+    }
+    return -1;
+}
+
+void shared_map_place(shared_map_table *table, uint64_t key, void* value) {
+    uint32_t index = (uint32_t)shared_map_hash(key) & table->mask;
+    while(table->used[index]) {
+        index = (index + 1) & table->mask;
+    }
+    __atomic_store_n(&table->slots[index].key, key, __ATOMIC_RELAXED);
+    __atomic_store_n(&table->slots[index].value, value, __ATOMIC_RELAXED);
+    __atomic_store_n(&table->used[index], 1, __ATOMIC_RELEASE);
+}
+
+// swaps in a table holding only the live entries, readers keep using
+// the old one until they leave.
+int shared_map_rebuild(shared_map_shard *shard) {
+    shared_map_table *old = shard->table;
+    // deleted entries filled it up unless over half of it is live.
+    uint32_t capacity = shard->size >= old->capacity / 2 ? old->capacity << 1 : old->capacity;
+    shared_map_table *table = shared_map_table_alloc(capacity);
+    if(table == NULL) {
+        return -1;
+    }
+    uint32_t i;
+    for(i = 0; i < old->capacity; i++) {
+        if(old->used[i] && old->slots[i].value != NULL) {
+            shared_map_place(table, old->slots[i].key, old->slots[i].value);
+        }
+    }
+    shard->filled = shard->size;
+    __atomic_store_n(&shard->table, table, __ATOMIC_RELEASE);
+    //
+    old->epoch    = __atomic_load_n(&shared_map_now, __ATOMIC_SEQ_CST);
+    old->retired  = shard->retired;
+    shard->retired = old;
+    //
+    return 0;
+}
+
+int shared_map_init(shared_map_t *map, uint32_t shards, uint32_t capacity) {
+    assert(map);
+    assert(shards > 0);
+    assert((shards & (shards - 1)) == 0);
+    assert(capacity > 1);
+    assert((capacity & (capacity - 1)) == 0);
+    //
+    shared_map_private *private = (shared_map_private *)malloc(sizeof(shared_map_private));
+    if(private == NULL) {
+        return -1;
+    }
+    memset(private, 0, sizeof(shared_map_private));
+    if(posix_memalign((void **)&private->shards, SHARED_MAP_CACHELINE, sizeof(shared_map_shard) * shards) != 0) {
+        free(private);
+        return -1;
+    }
+    memset(private->shards, 0, sizeof(shared_map_shard) * shards);
+    private->shard_count = shards;
+    // shards come from the top hash bits, slots from the bottom ones.
+    private->shard_shift = 64 - __builtin_ctz(shards);
+    //
+    uint32_t i;
+    for(i = 0; i < shards; i++) {
+        pthread_mutex_init(&private->shards[i].mutex, NULL);
+        private->shards[i].table = shared_map_table_alloc(capacity);
+        if(private->shards[i].table == NULL) {
+            private->shard_count = i + 1;
+            map->priv = private;
+            shared_map_free(map);
+            return -1;
+        }
+    }
+    //
+    map->priv = private;
+    //
+    return 0;
+}
+
+int shared_map_add(shared_map_t *map, uint64_t key, void* value) {
+    assert(map);
+    shared_map_private *private = (shared_map_private *)map->priv;
+    assert(private);
+    //
+    uint64_t hash = shared_map_hash(key);
+    shared_map_shard *shard = shared_map_shard_of(private, hash);
+    pthread_mutex_lock(&shard->mutex);
+    if(shard->retired) {
+        shared_map_shard_reclaim(shard);
+    }
+    //
+    shared_map_table *table = shard->table;
+    int64_t slot = shared_map_probe(table, key, hash);
+    if(slot >= 0) {
+        void* old = table->slots[slot].value;
+        shard->size += (old == NULL) - (value == NULL);
+        __atomic_store_n(&table->slots[slot].value, value, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&shard->mutex);
+        return 0;
+    }
+    if(shard->filled >= table->limit && shared_map_rebuild(shard) != 0) {
+        pthread_mutex_unlock(&shard->mutex);
+        return -1;
+    }
+    shared_map_place(shard->table, key, value);
+    shard->filled += 1;
+    shard->size   += value != NULL;
+    //
+    pthread_mutex_unlock(&shard->mutex);
+    //
+    return 0;
+}
+
+void* shared_map_get(shared_map_t *map, uint64_t key) {
+    assert(map);
+    shared_map_private *private = (shared_map_private *)map->priv;
+    assert(private);
+    //
+    uint64_t hash = shared_map_hash(key);
+    shared_map_shard *shard = shared_map_shard_of(private, hash);
+    shared_map_table *table;
+    int64_t slot;
+    void* value;
+    // the table may be replaced and freed under a reader that isn't in.
+    shared_map_enter(map);
+    table = __atomic_load_n(&shard->table, __ATOMIC_ACQUIRE);
+    slot  = shared_map_probe(table, key, hash);
+    value = slot < 0 ? NULL : __atomic_load_n(&table->slots[slot].value, __ATOMIC_ACQUIRE);
+    shared_map_leave(map);
+    //
+    return value;
+}
+
+void* shared_map_del(shared_map_t *map, uint64_t key) {
+    assert(map);
+    shared_map_private *private = (shared_map_private *)map->priv;
+    assert(private);
+    //
+    uint64_t hash = shared_map_hash(key);
+    shared_map_shard *shard = shared_map_shard_of(private, hash);
+    pthread_mutex_lock(&shard->mutex);
+    //
+    shared_map_table *table = shard->table;
+    int64_t slot = shared_map_probe(table, key, hash);
+    void* value = slot < 0 ? NULL : table->slots[slot].value;
+    if(value != NULL) {
+        __atomic_store_n(&table->slots[slot].value, NULL, __ATOMIC_RELEASE);
+        shard->size -= 1;
+    }
+    //
+    pthread_mutex_unlock(&shard->mutex);
+    //
+    return value;
+}
+
+uint32_t shared_map_size(shared_map_t *map) {
+    assert(map);
+    shared_map_private *private = (shared_map_private *)map->priv;
+    assert(private);
+    //
+    uint32_t i, size = 0;
+    for(i = 0; i < private->shard_count; i++) {
+        size += __atomic_load_n(&private->shards[i].size, __ATOMIC_RELAXED);
+    }
+    //
+    return size;
+}
+
+int shared_map_foreach(shared_map_t *map, hash_map_iter iter, void* user) {
+    assert(map);
+    assert(iter);
+    shared_map_private *private = (shared_map_private *)map->priv;
+    assert(private);
+    //
+    uint32_t i, j;
+    shared_map_shard *shard;
+    shared_map_table *table;
+    for(i = 0; i < private->shard_count; i++) {
+        shard = &private->shards[i];
+        pthread_mutex_lock(&shard->mutex);
+        table = shard->table;
+        for(j = 0; j < table->capacity; j++) {
+            if(table->used[j] && table->slots[j].value != NULL) {
+                (void)iter(table->slots[j].key, table->slots[j].value, user);
+            }
+        }
+        pthread_mutex_unlock(&shard->mutex);
+    }
+    //
+    return 0;
+}
+
+void shared_map_enter(shared_map_t *map) {
+    assert(map);
+    assert(map->priv);
+    //
+    shared_map_reader *reader = shared_map_reader_self();
+    // marked inside before the epoch is read; an epoch noted late is
+    // older than it could be, which only holds reclaiming back.
+    uint32_t count = reader->count;
+    __atomic_store_n(&reader->count, count + 1, __ATOMIC_SEQ_CST);
+    if(count == 0) {
+        __atomic_store_n(&reader->epoch, __atomic_load_n(&shared_map_now, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+    }
+}
+
+void shared_map_leave(shared_map_t *map) {
+    assert(map);
+    assert(map->priv);
+    //
+    shared_map_reader *reader = shared_map_reader_self();
+    assert(reader->count > 0);
+    __atomic_store_n(&reader->count, reader->count - 1, __ATOMIC_RELEASE);
+}
+
+uint64_t shared_map_epoch(shared_map_t *map) {
+    assert(map);
+    assert(map->priv);
+    //
+    return __atomic_load_n(&shared_map_now, __ATOMIC_SEQ_CST);
+}
+
+int shared_map_quiescent(shared_map_t *map, uint64_t epoch) {
+    assert(map);
+    assert(map->priv);
+    //
+    return shared_map_reached(epoch);
+}
+
+int shared_map_free(shared_map_t *map) {
+    assert(map);
+    shared_map_private *private = (shared_map_private *)map->priv;
+    assert(private);
+    //
+    uint32_t i;
+    for(i = 0; i < private->shard_count; i++) {
+        pthread_mutex_destroy(&private->shards[i].mutex);
+        shared_map_table_free(private->shards[i].table);
+        shared_map_table_free(private->shards[i].retired);
+    }
+    free(private->shards);
+    free(private);
+    //
+    map->priv = NULL;
+    //
+    return 0;
+}
@@ -0,0 +1,63 @@
+#ifndef SHAREDMAP_H
+#define SHAREDMAP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "hashmap.h"
+
+// thread-safe counterpart of hash_map_t. keys are spread over shards;
+// writers take their shard's mutex, readers take no lock, never retry and
+// never wait, whatever the writers do.
+//
+// a reader between shared_map_enter and shared_map_leave may go on using
+// the values it got even after another thread took them out of the map.
+// whoever removes a value notes shared_map_epoch right after and frees it
+// only once shared_map_quiescent says no reader can still have it.
+
+typedef struct{
+    void *priv;
+} shared_map_t;
+
+// shards and capacity are powers of two, capacity is per shard.
+int shared_map_init(shared_map_t *map, uint32_t shards, uint32_t capacity);
+
+// adds key or replaces the value already stored under it.
+int shared_map_add(shared_map_t *map, uint64_t key, void* value);
+
+// NULL when key isn't there. get enters and leaves by itself, callers
+// that keep using the value enter first.
+void* shared_map_get(shared_map_t *map, uint64_t key);
+
+void* shared_map_del(shared_map_t *map, uint64_t key);
+
+uint32_t shared_map_size(shared_map_t *map);
+
+// visits one shard at a time with that shard locked, iter must not
+// call back into the map.
+int shared_map_foreach(shared_map_t *map, hash_map_iter iter, void* user);
+
+// brackets a reader's use of values from the map, calls nest. neither
+// waits, a thread only ever touches its own record.
+void shared_map_enter(shared_map_t *map);
+
+void shared_map_leave(shared_map_t *map);
+
+// the epoch now, to note right after taking a value out of the map.
+uint64_t shared_map_epoch(shared_map_t *map);
+
+// 1 once every reader that could have seen a value removed at epoch has
+// left, so it can be freed. moves the epoch on where readers allow.
+int shared_map_quiescent(shared_map_t *map, uint64_t epoch);
+
+// no other thread may use the map any more.
+int shared_map_free(shared_map_t *map);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SHAREDMAP_H
@@ -0,0 +1,240 @@
+#define _GNU_SOURCE
+#include "slab.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// every chunk is aligned to its size and starts with its header, so the
+// chunk of an object is found by masking its address. objects are handed
+// out from the chunk's free list first, then by bumping a pointer through
+// memory never used before, which leaves untouched pages unfaulted.
+
+#define SLAB_ALIGN 16
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << 26)
+#endif
+
+typedef struct slab_chunk {
+    struct slab_chunk *prev;
+    struct slab_chunk *next;
+    void *free;
+    char *bump;
+    char *end;
+    uint32_t used;
+    uint32_t capacity;
+} slab_chunk;
+
+typedef struct {
+    uint32_t size;
+    uint32_t flags;
+    // chunks with room left, allocations come from the head.
+    slab_chunk *partial;
+    slab_chunk *full;
+    // one empty chunk is kept around so alloc/release at a chunk
+    // boundary does not map and unmap every time.
+    uint32_t empty;
+    slab_stats_t stats;
+} slab_private;
+
+// stats are only written by the owner.
+#define SLAB_STAT_ADD(private, field, n) \
+    __atomic_store_n(&(private)->stats.field, (private)->stats.field + (n), __ATOMIC_RELAXED)
+
+
+uint32_t slab_header(void) {
+    return (sizeof(slab_chunk) + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1);
+}
+
+void* slab_map(uint32_t flags) {
+    void *memory;
+    if(flags & SLAB_HUGEPAGE) {
+        memory = mmap(NULL, SLAB_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+        if(memory != MAP_FAILED) {
+            return memory;
+        }
+    }
+    // map twice the size and trim both ends to get an aligned chunk.
+    char *raw = (char *)mmap(NULL, SLAB_CHUNK_SIZE * 2, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(raw == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    char *start = (char *)(((uintptr_t)raw + SLAB_CHUNK_SIZE - 1) & ~(uintptr_t)(SLAB_CHUNK_SIZE - 1));
+    if(start > raw) {
+        munmap(raw, start - raw);
+    }
+    if(start + SLAB_CHUNK_SIZE < raw + SLAB_CHUNK_SIZE * 2) {
+        munmap(start + SLAB_CHUNK_SIZE, raw + SLAB_CHUNK_SIZE * 2 - (start + SLAB_CHUNK_SIZE));
+    }
+    if(flags & SLAB_HUGEPAGE) {
+        (void) madvise(start, SLAB_CHUNK_SIZE, MADV_HUGEPAGE);
+    }
+    //
+    return start;
+}
+
+void slab_unlink(slab_chunk **list, slab_chunk *chunk) {
+    if(chunk->prev) {
+        chunk->prev->next = chunk->next;
+    } else {
+        *list = chunk->next;
+    }
+    if(chunk->next) {
+        chunk->next->prev = chunk->prev;
+    }
+    chunk->prev = NULL;
+    chunk->next = NULL;
+}
+
+void slab_push(slab_chunk **list, slab_chunk *chunk) {
+    chunk->prev = NULL;
+    chunk->next = *list;
+    if(*list) {
+        (*list)->prev = chunk;
+    }
+    *list = chunk;
+}
+
+slab_chunk* slab_grow(slab_private *private) {
+    slab_chunk *chunk = (slab_chunk *)slab_map(private->flags);
+    if(chunk == NULL) {
+        return NULL;
+    }
+    //
+    memset(chunk, 0, sizeof(slab_chunk));
+    chunk->bump     = (char *)chunk + slab_header();
+    chunk->end      = (char *)chunk + SLAB_CHUNK_SIZE;
+    chunk->capacity = (SLAB_CHUNK_SIZE - slab_header()) / private->size;
+    slab_push(&private->partial, chunk);
+    private->empty += 1;
+    //
+    SLAB_STAT_ADD(private, chunks, 1);
+    SLAB_STAT_ADD(private, capacity, chunk->capacity);
+    //
+    return chunk;
+}
+
+int slab_init(slab_t *slab, uint32_t size, uint32_t flags) {
+    assert(slab);
+    assert(size > 0);
+    //
+    size = (size + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1);
+    assert(size <= SLAB_CHUNK_SIZE - slab_header());
+    //
+    slab_private *private = (slab_private *)malloc(sizeof(slab_private));
+    memset(private, 0, sizeof(slab_private));
+    private->size  = size;
+    private->flags = flags;
+    //
+    slab->priv = private;
+    //
+    return 0;
+}
+
+void* slab_alloc(slab_t *slab) {
+    assert(slab);
+    slab_private *private = (slab_private *)slab->priv;
+    assert(private);
+    //
+    slab_chunk *chunk = private->partial;
+    if(chunk == NULL) {
+        chunk = slab_grow(private);
+        if(chunk == NULL) {
+            return NULL;
+        }
+    }
+    //
+    void *object;
+    if(chunk->free) {
+        object = chunk->free;
+        chunk->free = *(void **)object;
+    } else {
+        object = chunk->bump;
+        chunk->bump += private->size;
+    }
+    if(chunk->used++ == 0) {
+        private->empty -= 1;
+    }
+    if(chunk->used == chunk->capacity) {
+        slab_unlink(&private->partial, chunk);
+        slab_push(&private->full, chunk);
+    }
+    SLAB_STAT_ADD(private, used, 1);
+    //
+    return object;
+}
+
+int slab_release(slab_t *slab, void* object) {
+    assert(slab);
+    slab_private *private = (slab_private *)slab->priv;
+    assert(private);
+    //
+    if(object == NULL) {
+        return 0;
+    }
+    //
+    slab_chunk *chunk = (slab_chunk *)((uintptr_t)object & ~(uintptr_t)(SLAB_CHUNK_SIZE - 1));
+    assert(chunk->used > 0);
+    if(chunk->used == chunk->capacity) {
+        slab_unlink(&private->full, chunk);
+        slab_push(&private->partial, chunk);
+    }
+    *(void **)object = chunk->free;
+    chunk->free = object;
+    chunk->used -= 1;
+    SLAB_STAT_ADD(private, used, -1);
+    //
+    if(chunk->used == 0) {
+        if(private->empty > 0) {
+            slab_unlink(&private->partial, chunk);
+            SLAB_STAT_ADD(private, chunks, -1);
+            SLAB_STAT_ADD(private, capacity, -(uint64_t)chunk->capacity);
+            munmap(chunk, SLAB_CHUNK_SIZE);
+        } else {
+            private->empty += 1;
+        }
+    }
+    //
+    return 0;
+}
+
+int slab_stats(slab_t *slab, slab_stats_t *stats) {
+    assert(slab);
+    assert(stats);
+    slab_private *private = (slab_private *)slab->priv;
+    assert(private);
+    //
+    stats->chunks   = __atomic_load_n(&private->stats.chunks, __ATOMIC_RELAXED);
+    stats->capacity = __atomic_load_n(&private->stats.capacity, __ATOMIC_RELAXED);
+    stats->used     = __atomic_load_n(&private->stats.used, __ATOMIC_RELAXED);
+    stats->size     = private->size;
+    //
+    return 0;
+}
+
+int slab_free(slab_t *slab) {
+    assert(slab);
+    slab_private *private = (slab_private *)slab->priv;
+    assert(private);
+    //
+    slab_chunk *chunk;
+    while(private->partial) {
+        chunk = private->partial;
+        private->partial = chunk->next;
+        munmap(chunk, SLAB_CHUNK_SIZE);
+    }
+    while(private->full) {
+        chunk = private->full;
+        private->full = chunk->next;
+        munmap(chunk, SLAB_CHUNK_SIZE);
+    }
+    free(private);
+    //
+    slab->priv = NULL;
+    //
+    return 0;
+}
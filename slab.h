@@ -0,0 +1,47 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+// fixed size object allocator carving 2 MiB chunks mapped straight from
+// the kernel. one slab has one owner, nothing here takes a lock; only
+// slab_stats may be called from other threads.
+
+typedef struct{
+    void *priv;
+} slab_t;
+
+// back chunks with huge pages, falls back to transparent huge pages and
+// then to normal pages when none are reserved.
+#define SLAB_HUGEPAGE 0x1
+
+#define SLAB_CHUNK_SIZE 0x200000 //2M
+
+typedef struct {
+    uint64_t chunks;   // chunks currently mapped
+    uint64_t capacity; // objects those chunks can hold
+    uint64_t used;     // objects handed out
+    uint64_t size;     // bytes per object, rounded up to the alignment
+} slab_stats_t;
+
+// size must leave room for at least one object next to the chunk header.
+int slab_init(slab_t *slab, uint32_t size, uint32_t flags);
+
+void* slab_alloc(slab_t *slab);
+
+int slab_release(slab_t *slab, void* object);
+
+int slab_stats(slab_t *slab, slab_stats_t *stats);
+
+// unmaps every chunk, objects still handed out go with them.
+int slab_free(slab_t *slab);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SLAB_H
@@ -1,20 +1,63 @@
+#define _GNU_SOURCE
 #include "tcpserver.h"
+#include "framer.h"
 #include "hashmap.h"
+#include "pthreadpool.h"
+#include "sharedmap.h"
+#include "slab.h"
+#include "timerwheel.h"
+#ifdef TCP_SERVER_IO_URING
+#include "uring.h"
+#endif
 
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
+#include <arpa/inet.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <pthread.h>
 #include <sys/epoll.h>
 #include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
+#include <linux/errqueue.h>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
 
 #define MAX_WAIT_EVENTS 16
-#define BUFFER_SIZE 0x12000 //72k
+#define DEFAULT_SPIN_US 50
+#define BUFFER_SIZE 0x10000 //64k
+// what one event may do on a connection, see event_bytes.
+#define EVENT_BYTES 0x40000 //256k
+#define EVENT_SYSCALLS 16
+// buffer size classes, 4k << i.
+#define POOL_MIN_SHIFT 12
+#define POOL_CLASSES 5
+#define POOL_MAX (1u << (POOL_MIN_SHIFT + POOL_CLASSES - 1))
+#define URING_ENTRIES 1024
+#define URING_BUFFER_COUNT 512
+#define URING_BUFFER_SIZE 0x4000 //16k
+// file bytes sent per flush before yielding to the other connections.
+#define SENDFILE_MAX 0x100000 //1M
+// proxy mode: bytes spliced per call, a pipe holds 64k by default.
+#define SPLICE_SIZE 0x10000
+#define FRAME_MAX 0x100000 //1M
+#define FRAME_DELIMITER_MAX 16
 
 typedef struct {
     void *data;
@@ -23,479 +66,4051 @@ typedef struct {
     uint32_t pos;
 } tcp_server_buffer;
 
-int tcp_server_buffer_init(tcp_server_buffer **pointer, uint32_t capacity) {
-    assert(pointer);
-    tcp_server_buffer *buffer;
-    buffer = (tcp_server_buffer *)malloc(sizeof(tcp_server_buffer));
+enum {
+    // data follows the header in the same pool block.
+    TCP_SERVER_CHUNK_COPY = 0,
+    // data is caller memory, handed back through release.
+    TCP_SERVER_CHUNK_REF,
+    // a file range sent with sendfile, data is unused.
+    TCP_SERVER_CHUNK_FILE,
+    // sends nothing, done hears once everything ahead of it went out.
+    TCP_SERVER_CHUNK_MARK,
+};
+
+// one piece of a connection's output queue.
+typedef struct tcp_server_chunk {
+    struct tcp_server_chunk *next;
+    char *data;
+    uint32_t cap;
+    uint32_t len;
+    uint32_t pos;
+    int kind;
+    // set once part of it went out with MSG_ZEROCOPY, zc_last names the
+    // last such send, the kernel reads the memory until it completes.
+    int zerocopy;
+    uint32_t zc_last;
+    tcp_server_release_fn release;
+    tcp_server_connect_fn done;
+    void *user;
+    // file chunks: next byte to send and how many are still to go.
+    int file;
+    int64_t offset;
+    uint64_t left;
+    uint64_t total;
+} tcp_server_chunk;
+
+#define CHUNK_MAX ((1u << (POOL_MIN_SHIFT + POOL_CLASSES - 1)) - sizeof(tcp_server_chunk))
+
+// a list of chunks waiting to go out, and the bytes they still hold.
+// files counts the part of those left in file ranges, which take no
+// memory and so stay out of the watermarks.
+typedef struct {
+    tcp_server_chunk *head;
+    tcp_server_chunk *tail;
+    uint64_t queued;
+    uint64_t files;
+} tcp_server_queue;
+
+// bytes read for a connection whose on_readable runs on the workers,
+// data follows the header in the same pool block.
+typedef struct tcp_server_job {
+    struct tcp_server_job *next;
+    uint32_t cap;
+    uint32_t len;
+} tcp_server_job;
+
+#define JOB_MAX ((1u << (POOL_MIN_SHIFT + POOL_CLASSES - 1)) - sizeof(tcp_server_job))
+
+// a closure handed to a loop by tcp_server_post.
+typedef struct tcp_server_task {
+    struct tcp_server_task *next;
+    tcp_server_task_fn fn;
+    void *arg;
+    // freed once it ran, tasks kept inside their owner are not.
+    int owned;
+} tcp_server_task;
+
+typedef struct tcp_server_private tcp_server_private;
+typedef struct tcp_server_reactor tcp_server_reactor;
+typedef struct tcp_server_upstream tcp_server_upstream;
+
+typedef struct tcp_server_connect {
+    int handle;
+    // tells connections apart after their fd has been reused.
+    uint32_t generation;
+    tcp_server_reactor *reactor;
+    // unsent output, only holds memory while there is some. guarded by
+    // mutex on the epoll backend, where any thread may write.
+    tcp_server_queue out;
+    // EPOLLOUT is armed, only while the socket is backed up.
+    int armed;
+    // full from when the queue passed high_watermark until it drained to
+    // low_watermark. reads are off while full or held by tcp_server_pause,
+    // paused is what the socket is set to. workers read full unlocked.
+    int full;
+    int held;
+    int paused;
+    // inside on_readable, writes from the loop queue up and go out
+    // together once it returns.
+    int corked;
+    // MSG_ZEROCOPY: sent chunks wait here for their completions. sends
+    // are numbered from zc_next, all below zc_done have completed, and
+    // one range that completed out of order waits in zc_ahead.
+    tcp_server_chunk *zc_head;
+    tcp_server_chunk *zc_tail;
+    uint32_t zc_next;
+    uint32_t zc_done;
+    uint32_t zc_ahead[2];
+    // 1 once SO_ZEROCOPY is on, -1 once it turned out not to pay off.
+    int zc_state;
+    pthread_mutex_t mutex;
+    // signalled whenever the queue drains.
+    pthread_cond_t cond;
+    // io_uring: operations still owned by the kernel, the fd stays open
+    // until they all complete.
+    uint32_t inflight;
+    int sending;
+    int receiving;
+    int closing;
+    // proxy mode: the other half of the pair, and the pipe carrying what
+    // this side reads over to it.
+    struct tcp_server_connect *peer;
+    int pipe[2];
+    uint32_t piped;
+    // epoll events asked for, they follow the pipes.
+    uint32_t interest;
+    // opened towards upstream, callbacks never see it.
+    int upstream;
+    int connecting;
+    // reads hit EOF, then the peer's write side was shut behind the data.
+    int eof;
+    int shut;
+    // outbound: done hears how connecting went.
+    tcp_server_connect_fn done;
+    void *done_user;
+    // one timer covers every deadline: deadline_ms while connecting or
+    // parked, otherwise the idle, read and write ones counted from the
+    // last read and the last write progress. those only note the time,
+    // the timer catches up when it goes off. write_ms is also noted by
+    // writers on other threads.
+    timer_wheel_timer_t timer;
+    uint64_t deadline_ms;
+    uint64_t read_ms;
+    uint64_t write_ms;
+    // pooled: the address it belongs to and, while parked, the next idle one.
+    tcp_server_upstream *host;
+    struct tcp_server_connect *idle_next;
+    int idle;
+    // workers: reads wait in the inbox while the previous batch runs, so
+    // a connection has one batch out at a time and stays in order. what
+    // the batch writes to it collects in replies, the loop sends it.
+    tcp_server_job *inbox_head;
+    tcp_server_job *inbox_tail;
+    tcp_server_job *running;
+    tcp_server_queue replies;
+    int dispatched;
+    // brings the batch back, kept here so returning it can't fail.
+    tcp_server_task returned;
+    // framing: the start of a frame that reads so far cut off, only holds
+    // memory while there is some. whoever runs the reads owns it, the loop
+    // or the batch on the workers, which sets malformed for the loop.
+    tcp_server_buffer partial;
+    int malformed;
+    // on_readable_batch: reads wait in the loop's batch until the round
+    // is over, an EOF or error behind them closes it once the batch ran.
+    int batched;
+    int gone;
+    // released connections wait here until the current batch is done and
+    // no thread that found it in the index can still be using it, which
+    // it was taken out of at epoch retired.
+    struct tcp_server_connect *next;
+    uint64_t retired;
+    // blocking writers hold it past their lookup, outside the epoch.
+    uint32_t pinned;
+} tcp_server_connect;
+
+// a read waiting for the round's on_readable_batch. on epoll it sits at
+// offset in scratch, which may still move as the round grows it, on
+// io_uring in provided buffer bid until the batch is done with it.
+typedef struct {
+    tcp_server_connect *connect;
+    const char *data;
+    uint32_t offset;
+    uint32_t len;
+    int bid;
+} tcp_server_pending;
+
+// outbound connections of one loop to one address.
+struct tcp_server_upstream {
+    uint32_t total;
+    uint32_t idle;
+    // most recently parked first, the warmest socket goes out next.
+    tcp_server_connect *idle_head;
+};
+
+// counters are only written by the owning loop.
+#define TCP_SERVER_STAT_ADD(reactor, field, n) \
+    __atomic_store_n(&(reactor)->stats.field, (reactor)->stats.field + (n), __ATOMIC_RELAXED)
+
+struct tcp_server_reactor {
+    struct sockaddr_in addr;
+    struct epoll_event *events;
+    uint32_t max_events;
+    uint64_t spin_ns;
+    uint32_t event_bytes;
+    uint32_t event_syscalls;
+    uint64_t active_ns;
+    tcp_server_stats_t stats;
+    // indexed by fd, only touched by the owning loop.
+    tcp_server_connect **connects;
+    uint32_t capacity;
+    tcp_server_connect *garbage;
+    // some of it waits on lookups from other threads.
+    int lingering;
+    // connections and their buffers come from these, recycled per loop.
+    slab_t connect_slab;
+    slab_t pools[POOL_CLASSES];
+    // headers of ref and file chunks.
+    slab_t chunk_slab;
+    // writes from other threads take buffers too.
+    pthread_mutex_t pool_lock;
+    // every read lands here first, connections keep nothing between reads.
+    // with on_readable_batch it keeps the whole round's and grows to fit.
+    tcp_server_buffer scratch;
+    // on_readable_batch: the round's reads, and what the call is handed.
+    tcp_server_pending *pending;
+    tcp_server_read_t *reads;
+    uint32_t pending_count;
+    uint32_t pending_cap;
+    // connection deadlines and tcp_server_timer_add timers, in ms of the
+    // loop clock, which is read once per round into now_ms.
+    timer_wheel_t timers;
+    uint64_t now_ms;
+    // address << 16 | port -> tcp_server_upstream.
+    hash_map_t upstreams;
+    // tasks posted from any thread, newest first. posters push with a CAS
+    // and the loop takes the whole stack at once, so only a poster that
+    // finds it empty has to wake the loop.
+    tcp_server_task *posted;
+    // posted and not run yet, written by every poster.
+    uint64_t post_pending;
+    int epollfd;
+    int eventfd;
+    int listenfd;
+    int finished;
+    pthread_t thread;
+    tcp_server_private *server;
+#ifdef TCP_SERVER_IO_URING
+    int uring;
+    uring_t ring;
+    eventfd_t eventval;
+    // the tick the IORING_OP_TIMEOUT in flight wakes the ring at, 0 for none.
+    uint64_t uring_timer_ms;
+    struct __kernel_timespec uring_timeout;
+#endif
+};
+
+struct tcp_server_private {
+    struct sockaddr_in addr;
+    // proxy mode when upstream_port is set.
+    struct sockaddr_in upstream;
+    int proxy;
+    tcp_server_attr_t attrs;
+    tcp_server_reactor *reactors;
+    uint32_t reactor_count;
+    uint32_t generation;
+    // fd -> connect across all loops, for lookups from other threads.
+    shared_map_t index;
+    // held while signalling loops, teardown waits on it.
+    pthread_mutex_t lock;
+    // set before the loops are woken to stop.
+    int stopping;
+    // where the next post from outside the loops goes.
+    uint32_t post_next;
+    // runs on_readable when attrs.workers is set, offloaded counts the
+    // batches out there, teardown waits for them to come back.
+    pthread_pool_t pool;
+    uint32_t offloaded;
+    // on_readable, or on_message when framing, takes the reads.
+    int readable;
+    void *user;
+};
+
+uint32_t tcp_server_pool_class(uint32_t capacity) {
+    uint32_t index = 0;
+    while(index < POOL_CLASSES - 1 && (1u << (POOL_MIN_SHIFT + index)) < capacity) {
+        index += 1;
+    }
+    return index;
+}
+
+void* tcp_server_pool_alloc(tcp_server_reactor *reactor, uint32_t size) {
+    assert(reactor);
+    assert(size <= (1u << (POOL_MIN_SHIFT + POOL_CLASSES - 1)));
+    //
+    void *block;
+    pthread_mutex_lock(&reactor->pool_lock);
+    block = slab_alloc(&reactor->pools[tcp_server_pool_class(size)]);
+    pthread_mutex_unlock(&reactor->pool_lock);
+    //
+    return block;
+}
+
+void tcp_server_pool_release(tcp_server_reactor *reactor, void *block, uint32_t size) {
+    assert(reactor);
     //
+    pthread_mutex_lock(&reactor->pool_lock);
+    slab_release(&reactor->pools[tcp_server_pool_class(size)], block);
+    pthread_mutex_unlock(&reactor->pool_lock);
+}
+
+int tcp_server_buffer_init(tcp_server_reactor *reactor, tcp_server_buffer *buffer, uint32_t capacity) {
+    assert(reactor);
     assert(buffer);
-    buffer->data = malloc(capacity);
-    buffer->cap  = capacity;
+    //
+    buffer->data = tcp_server_pool_alloc(reactor, capacity);
+    if(buffer->data == NULL) {
+        return -1;
+    }
+    buffer->cap  = 1u << (POOL_MIN_SHIFT + tcp_server_pool_class(capacity));
     buffer->pos  = 0;
     buffer->len  = 0;
     //
-    *pointer = buffer;
-    //
     return 0;
 }
 
-int tcp_server_buffer_free(tcp_server_buffer **pointer) {
-    assert(pointer);
-    tcp_server_buffer *buffer = *pointer;
+int tcp_server_buffer_free(tcp_server_reactor *reactor, tcp_server_buffer *buffer) {
+    assert(reactor);
+    assert(buffer);
     //
-    free(buffer->data);
+    if(buffer->cap > POOL_MAX) {
+        free(buffer->data);
+    }
+    else if(buffer->data) {
+        tcp_server_pool_release(reactor, buffer->data, buffer->cap);
+    }
     buffer->data = NULL;
     buffer->cap  = 0;
     buffer->len  = 0;
     buffer->pos  = 0;
-    free(buffer);
-    //
-    *pointer = NULL;
     //
     return 0;
 }
 
-typedef struct {
-    int handle;
-    tcp_server_buffer *rbuffer;
-    tcp_server_buffer *wbuffer;
-    pthread_mutex_t mutex;
-    pthread_cond_t cond;
-} tcp_server_connect;
+void tcp_server_queue_push(tcp_server_queue *queue, tcp_server_chunk *chunk) {
+    chunk->next = NULL;
+    if(queue->tail) {
+        queue->tail->next = chunk;
+    } else {
+        queue->head = chunk;
+    }
+    queue->tail = chunk;
+}
 
-int tcp_server_connect_init(tcp_server_connect **pointer, int sfd) {
-    assert(pointer);
-    tcp_server_connect *connect = NULL;
+// gives a chunk back, ref chunks hand their memory back to the caller,
+// file chunks report how far they got and marks whether they were reached.
+void tcp_server_chunk_free(tcp_server_connect *connect, tcp_server_chunk *chunk) {
+    assert(connect);
+    assert(chunk);
+    tcp_server_reactor *reactor = connect->reactor;
+    tcp_server_private *private = reactor->server;
     //
-    connect = (tcp_server_connect *)malloc(sizeof(tcp_server_connect));
-    memset(connect, 0, sizeof(tcp_server_connect));
-    connect->handle = sfd;
+    if(chunk->kind == TCP_SERVER_CHUNK_COPY) {
+        tcp_server_pool_release(reactor, chunk, chunk->cap + sizeof(tcp_server_chunk));
+        return;
+    }
+    if(chunk->kind == TCP_SERVER_CHUNK_FILE) {
+        if(private->attrs.on_sendfile) {
+            private->attrs.on_sendfile(connect->handle, chunk->file, chunk->total - chunk->left, private->user);
+        }
+    }
+    else if(chunk->kind == TCP_SERVER_CHUNK_MARK) {
+        // dropped along with the connection, not reached.
+        chunk->done(connect->handle, connect->closing ? EPIPE : 0, chunk->user);
+    }
+    else if(chunk->release) {
+        chunk->release(chunk->data, chunk->len, chunk->user);
+    }
+    pthread_mutex_lock(&reactor->pool_lock);
+    slab_release(&reactor->chunk_slab, chunk);
+    pthread_mutex_unlock(&reactor->pool_lock);
+}
+
+tcp_server_chunk* tcp_server_chunk_alloc(tcp_server_reactor *reactor, int kind) {
+    assert(reactor);
     //
-    tcp_server_buffer_init(&connect->rbuffer, BUFFER_SIZE);
-    tcp_server_buffer_init(&connect->wbuffer, BUFFER_SIZE);
+    tcp_server_chunk *chunk;
+    pthread_mutex_lock(&reactor->pool_lock);
+    chunk = (tcp_server_chunk *)slab_alloc(&reactor->chunk_slab);
+    pthread_mutex_unlock(&reactor->pool_lock);
+    if(chunk == NULL) {
+        return NULL;
+    }
+    memset(chunk, 0, sizeof(tcp_server_chunk));
+    chunk->kind = kind;
+    chunk->file = -1;
     //
-    pthread_mutex_init(&connect->mutex, NULL);
-    pthread_cond_init(&connect->cond, NULL);
+    return chunk;
+}
+
+// queues caller memory as it is.
+int tcp_server_queue_ref(tcp_server_reactor *reactor, tcp_server_queue *queue, void *data, uint32_t len,
+                         tcp_server_release_fn release, void *user) {
+    assert(queue);
     //
-    *pointer = connect;
+    tcp_server_chunk *chunk = tcp_server_chunk_alloc(reactor, TCP_SERVER_CHUNK_REF);
+    if(chunk == NULL) {
+        return -1;
+    }
+    chunk->data    = (char *)data;
+    // full, nothing gets appended to it.
+    chunk->cap     = len;
+    chunk->len     = len;
+    chunk->release = release;
+    chunk->user    = user;
+    tcp_server_queue_push(queue, chunk);
+    queue->queued += len;
     //
     return 0;
 }
 
-int tcp_server_connect_free(tcp_server_connect **pointer) {
-    assert(pointer);
-    tcp_server_connect *connect = *pointer;
+int tcp_server_queue_file(tcp_server_reactor *reactor, tcp_server_queue *queue, int fd, int64_t offset, uint64_t len) {
+    assert(queue);
     //
-    assert(connect);
-    pthread_cond_broadcast(&connect->cond);
-    shutdown(connect->handle, SHUT_RDWR);
+    tcp_server_chunk *chunk = tcp_server_chunk_alloc(reactor, TCP_SERVER_CHUNK_FILE);
+    if(chunk == NULL) {
+        return -1;
+    }
+    chunk->file   = fd;
+    chunk->offset = offset;
+    chunk->left   = len;
+    chunk->total  = len;
+    tcp_server_queue_push(queue, chunk);
+    queue->queued += len;
+    queue->files  += len;
     //
-    pthread_cond_destroy(&connect->cond);
-    pthread_mutex_destroy(&connect->mutex);
+    return 0;
+}
+
+int tcp_server_queue_mark(tcp_server_reactor *reactor, tcp_server_queue *queue, tcp_server_connect_fn done, void *user) {
+    assert(queue);
+    assert(done);
     //
-    tcp_server_buffer_free(&connect->rbuffer);
-    tcp_server_buffer_free(&connect->wbuffer);
+    tcp_server_chunk *chunk = tcp_server_chunk_alloc(reactor, TCP_SERVER_CHUNK_MARK);
+    if(chunk == NULL) {
+        return -1;
+    }
+    chunk->done = done;
+    chunk->user = user;
+    tcp_server_queue_push(queue, chunk);
     //
-    free(connect);
-    *pointer = NULL;
+    return 0;
+}
+
+// copies data behind whatever is queued, growing the queue by pool blocks.
+int tcp_server_queue_append(tcp_server_reactor *reactor, tcp_server_queue *queue, const char *data, uint32_t len) {
+    assert(queue);
+    //
+    tcp_server_chunk *chunk = queue->tail;
+    uint32_t size;
+    while(len > 0) {
+        if(chunk == NULL || chunk->kind == TCP_SERVER_CHUNK_FILE || chunk->len == chunk->cap) {
+            size = len < CHUNK_MAX ? len : CHUNK_MAX;
+            size = 1u << (POOL_MIN_SHIFT + tcp_server_pool_class(size + sizeof(tcp_server_chunk)));
+            chunk = (tcp_server_chunk *)tcp_server_pool_alloc(reactor, size);
+            if(chunk == NULL) {
+                return -1;
+            }
+            memset(chunk, 0, sizeof(tcp_server_chunk));
+            chunk->data = (char *)chunk + sizeof(tcp_server_chunk);
+            chunk->cap  = size - sizeof(tcp_server_chunk);
+            tcp_server_queue_push(queue, chunk);
+        }
+        size = chunk->cap - chunk->len < len ? chunk->cap - chunk->len : len;
+        memcpy(chunk->data + chunk->len, data, size);
+        chunk->len += size;
+        queue->queued += size;
+        data += size;
+        len  -= size;
+    }
     //
     return 0;
 }
 
-int tcp_server_connect_read(tcp_server_connect *connect) {
+// removes the finished head chunk.
+void tcp_server_queue_pop(tcp_server_connect *connect) {
     assert(connect);
-    tcp_server_buffer *buffer = connect->rbuffer;
     //
-    int count;
-    assert(buffer);
-    while(1) {
-        count = recv(connect->handle, buffer->data + buffer->len, buffer->cap - buffer->len, 0);
-        fprintf(stderr, "count => %d (errno: %d)\n", count, errno);
-        if(count > 0) {
-            buffer->len += count;
-            continue;
-        }
-        else if(count == 0) {
-            return -1;
-        }
-        else if(errno == EWOULDBLOCK) {
-            return 0;
-        }
-        else if(errno == EAGAIN) {
-            continue;
+    tcp_server_chunk *chunk = connect->out.head;
+    connect->out.head = chunk->next;
+    if(connect->out.head == NULL) {
+        connect->out.tail = NULL;
+    }
+    // the kernel may still read it until the zerocopy send completes.
+    if(chunk->zerocopy && (int32_t)(chunk->zc_last - connect->zc_done) >= 0) {
+        chunk->next = NULL;
+        if(connect->zc_tail) {
+            connect->zc_tail->next = chunk;
+        } else {
+            connect->zc_head = chunk;
         }
-        else {
-            return -2;
+        connect->zc_tail = chunk;
+        return;
+    }
+    tcp_server_chunk_free(connect, chunk);
+}
+
+// drops count sent bytes from the front, drained chunks go back to the
+// pool unless a zerocopy send still refers to them.
+void tcp_server_queue_consume(tcp_server_connect *connect, uint64_t count) {
+    assert(connect);
+    //
+    tcp_server_chunk *chunk;
+    uint32_t size;
+    connect->out.queued -= count;
+    // file chunks account for themselves.
+    while((chunk = connect->out.head) != NULL && chunk->kind != TCP_SERVER_CHUNK_FILE) {
+        size = chunk->len - chunk->pos < count ? chunk->len - chunk->pos : (uint32_t)count;
+        chunk->pos += size;
+        count -= size;
+        if(chunk->pos < chunk->len) {
+            break;
         }
+        tcp_server_queue_pop(connect);
     }
 }
 
-int tcp_server_connect_write(tcp_server_connect *connect) {
+// moves everything in from over to the back of the output queue.
+void tcp_server_queue_splice(tcp_server_connect *connect, tcp_server_queue *from) {
     assert(connect);
-    tcp_server_buffer *buffer = connect->wbuffer;
+    assert(from);
     //
-    assert(buffer);
-    assert(buffer->len > buffer->pos);
-    size_t size = buffer->len - buffer->pos;
+    if(from->head == NULL) {
+        return;
+    }
+    if(connect->out.tail) {
+        connect->out.tail->next = from->head;
+    } else {
+        connect->out.head = from->head;
+    }
+    connect->out.tail    = from->tail;
+    connect->out.queued += from->queued;
+    connect->out.files  += from->files;
+    memset(from, 0, sizeof(tcp_server_queue));
+}
+
+void tcp_server_queue_clear(tcp_server_connect *connect) {
+    assert(connect);
     //
-    int count;
-    while(1) {
-        count = send(connect->handle, buffer->data + buffer->pos, size, 0);
-        if(count > 0) {
-            buffer->pos += count;
-            if(buffer->pos < buffer->len) {
-                continue;
+    // the socket is closed, pending zerocopy sends were dropped with it.
+    tcp_server_chunk *chunk;
+    while((chunk = connect->zc_head) != NULL) {
+        connect->zc_head = chunk->next;
+        tcp_server_chunk_free(connect, chunk);
+    }
+    connect->zc_tail = NULL;
+    while((chunk = connect->out.head) != NULL) {
+        connect->out.head = chunk->next;
+        tcp_server_chunk_free(connect, chunk);
+    }
+    connect->out.tail   = NULL;
+    connect->out.queued = 0;
+    connect->out.files  = 0;
+}
+
+// copies a read behind what waits in the inbox, topping up the last job.
+int tcp_server_inbox_append(tcp_server_connect *connect, const char *data, uint32_t len) {
+    assert(connect);
+    tcp_server_reactor *reactor = connect->reactor;
+    //
+    tcp_server_job *job = connect->inbox_tail;
+    uint32_t size;
+    while(len > 0) {
+        if(job == NULL || job->len == job->cap) {
+            size = len < JOB_MAX ? len : JOB_MAX;
+            size = 1u << (POOL_MIN_SHIFT + tcp_server_pool_class(size + sizeof(tcp_server_job)));
+            job = (tcp_server_job *)tcp_server_pool_alloc(reactor, size);
+            if(job == NULL) {
+                return -1;
+            }
+            job->next = NULL;
+            job->cap  = size - sizeof(tcp_server_job);
+            job->len  = 0;
+            if(connect->inbox_tail) {
+                connect->inbox_tail->next = job;
             } else {
-                return buffer->pos;
+                connect->inbox_head = job;
             }
+            connect->inbox_tail = job;
         }
-        else if(count == 0) {
+        size = job->cap - job->len < len ? job->cap - job->len : len;
+        memcpy((char *)(job + 1) + job->len, data, size);
+        job->len += size;
+        data += size;
+        len  -= size;
+    }
+    //
+    return 0;
+}
+
+void tcp_server_jobs_free(tcp_server_reactor *reactor, tcp_server_job *job) {
+    assert(reactor);
+    //
+    tcp_server_job *next;
+    for(; job; job = next) {
+        next = job->next;
+        tcp_server_pool_release(reactor, job, job->cap + sizeof(tcp_server_job));
+    }
+}
+
+// room for size bytes in buffer, keeping what it holds. past the largest
+// pool block it comes from malloc.
+int tcp_server_buffer_reserve(tcp_server_reactor *reactor, tcp_server_buffer *buffer, uint32_t size) {
+    assert(reactor);
+    assert(buffer);
+    //
+    tcp_server_buffer grown;
+    if(size <= buffer->cap) {
+        return 0;
+    }
+    if(size < buffer->cap * 2) {
+        size = buffer->cap * 2;
+    }
+    if(size <= POOL_MAX) {
+        if(tcp_server_buffer_init(reactor, &grown, size) != 0) {
             return -1;
         }
-        else if(errno == EWOULDBLOCK) {
+    } else {
+        grown.data = malloc(size);
+        if(grown.data == NULL) {
+            return -1;
+        }
+        grown.cap = size;
+    }
+    if(buffer->len > 0) {
+        memcpy(grown.data, buffer->data, buffer->len);
+    }
+    grown.pos = buffer->pos;
+    grown.len = buffer->len;
+    (void) tcp_server_buffer_free(reactor, buffer);
+    *buffer = grown;
+    //
+    return 0;
+}
+
+// the frame at the start of data: its size, with the message *message
+// bytes long at data + *skip. 0 when data holds no whole frame, -1 when
+// it is over frame_max.
+int64_t tcp_server_frame_next(tcp_server_attr_t *attrs, const char *data, uint32_t len, uint32_t *skip, uint32_t *message) {
+    uint64_t size;
+    const char *end;
+    switch(attrs->framing) {
+    case TCP_SERVER_FRAME_FIXED:
+        if(len < attrs->frame_size) {
             return 0;
         }
-        else if(errno == EAGAIN) {
-            continue;
+        *skip    = 0;
+        *message = attrs->frame_size;
+        return attrs->frame_size;
+    case TCP_SERVER_FRAME_LENGTH:
+        if(len < attrs->frame_prefix) {
+            return 0;
         }
+        size = framer_length(data, attrs->frame_prefix, attrs->frame_little);
+        if(size > attrs->frame_max) {
+            return -1;
+        }
+        if(len < attrs->frame_prefix + size) {
+            return 0;
+        }
+        *skip    = attrs->frame_prefix;
+        *message = (uint32_t)size;
+        return attrs->frame_prefix + size;
+    case TCP_SERVER_FRAME_DELIMITER:
+    default:
+        end = framer_find(data, len, attrs->frame_delimiter, attrs->frame_delimiter_len);
+        if(end == NULL) {
+            return len >= (uint64_t)attrs->frame_max + attrs->frame_delimiter_len ? -1 : 0;
+        }
+        if((uint64_t)(end - data) > attrs->frame_max) {
+            return -1;
+        }
+        *skip    = 0;
+        *message = (uint32_t)(end - data);
+        return end - data + attrs->frame_delimiter_len;
+    }
+}
 
+// how much of data belongs to the frame begun in partial, up to its end,
+// with *complete set once that end is in. -1 when it is over frame_max.
+int64_t tcp_server_frame_take(tcp_server_attr_t *attrs, tcp_server_buffer *partial, const char *data, uint32_t len,
+                              int *complete) {
+    uint64_t need, size;
+    uint32_t back, front, delimiter = attrs->frame_delimiter_len;
+    const char *end;
+    char seam[2 * FRAME_DELIMITER_MAX];
+    *complete = 0;
+    switch(attrs->framing) {
+    case TCP_SERVER_FRAME_FIXED:
+        need = attrs->frame_size - partial->len;
+        break;
+    case TCP_SERVER_FRAME_LENGTH:
+        // the prefix first, then the size it gives.
+        if(partial->len < attrs->frame_prefix) {
+            need = attrs->frame_prefix - partial->len;
+            return need < len ? need : len;
+        }
+        size = framer_length(partial->data, attrs->frame_prefix, attrs->frame_little);
+        if(size > attrs->frame_max) {
+            return -1;
+        }
+        need = attrs->frame_prefix + size - partial->len;
+        break;
+    case TCP_SERVER_FRAME_DELIMITER:
+    default:
+        // partial holds no whole delimiter, but may end with a piece of one.
+        back  = partial->len < delimiter - 1 ? partial->len : delimiter - 1;
+        front = len < delimiter - 1 ? len : delimiter - 1;
+        memcpy(seam, partial->data + partial->len - back, back);
+        memcpy(seam + back, data, front);
+        end = framer_find(seam, back + front, attrs->frame_delimiter, delimiter);
+        if(end != NULL) {
+            need = end - seam + delimiter - back;
+        }
+        else if((end = framer_find(data, len, attrs->frame_delimiter, delimiter)) != NULL) {
+            need = end - data + delimiter;
+        }
         else {
-            return -2;
+            return (uint64_t)partial->len + len >= (uint64_t)attrs->frame_max + delimiter ? (int64_t)-1 : (int64_t)len;
+        }
+        if(partial->len + need - delimiter > attrs->frame_max) {
+            return -1;
         }
+        *complete = 1;
+        return need;
     }
-    return 0;
+    if(need <= len) {
+        *complete = 1;
+        return need;
+    }
+    return len;
 }
 
-typedef struct {
-    struct sockaddr_in addr[2];
-    struct epoll_event events[MAX_WAIT_EVENTS];
-    tcp_server_attr_t attrs;
-    hash_map_t connects;
-    int epollfd;
-    int eventfd;
-    int listenfd;
-    void *user;
-} tcp_server_private;
-
-int tcp_server_make_non_blocking(int sockfd) {
-    int flags, ret;
+// hands what was read to on_readable as it is, or cut into messages for
+// on_message. a frame split across reads is finished in partial, copying
+// only its own bytes, every other one goes out in place. -1 when a frame
+// was over frame_max and the connection has to go.
+int tcp_server_deliver(tcp_server_connect *connect, const char *data, uint32_t len) {
+    assert(connect);
+    tcp_server_private *private = connect->reactor->server;
+    tcp_server_attr_t *attrs = &private->attrs;
     //
-    flags = fcntl(sockfd, F_GETFL, 0);
-    if(flags == -1) {
-        perror("fcntl(F_GETFL)");
-        return -1;
+    if(attrs->framing == TCP_SERVER_FRAME_NONE) {
+        attrs->on_readable(connect->handle, (void *)data, len, private->user);
+        return 0;
+    }
+    tcp_server_buffer *partial = &connect->partial;
+    int64_t size;
+    uint32_t skip, message;
+    int complete;
+    while(partial->len > 0) {
+        size = tcp_server_frame_take(attrs, partial, data, len, &complete);
+        if(size < 0) {
+            return -1;
+        }
+        if(size > 0) {
+            if(tcp_server_buffer_reserve(connect->reactor, partial, partial->len + (uint32_t)size) != 0) {
+                return -1;
+            }
+            memcpy((char *)partial->data + partial->len, data, size);
+            partial->len += size;
+            data += size;
+            len  -= size;
+        }
+        if(!complete) {
+            // a length prefix just came in, or the read ran out.
+            if(size > 0) {
+                continue;
+            }
+            return 0;
+        }
+        skip    = attrs->framing == TCP_SERVER_FRAME_LENGTH ? attrs->frame_prefix : 0;
+        message = partial->len - skip - (attrs->framing == TCP_SERVER_FRAME_DELIMITER ? attrs->frame_delimiter_len : 0);
+        attrs->on_message(connect->handle, (char *)partial->data + skip, message, private->user);
+        (void) tcp_server_buffer_free(connect->reactor, partial);
     }
     //
-    ret = fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
-    if(ret == -1) {
-        perror("fcntl(F_SETFL)");
-        return -1;
+    while(len > 0) {
+        size = tcp_server_frame_next(attrs, data, len, &skip, &message);
+        if(size < 0) {
+            return -1;
+        }
+        if(size == 0) {
+            break;
+        }
+        attrs->on_message(connect->handle, (char *)data + skip, message, private->user);
+        data += size;
+        len  -= size;
+    }
+    // the cut off start waits for the rest.
+    if(len > 0) {
+        if(tcp_server_buffer_reserve(connect->reactor, partial, len) != 0) {
+            return -1;
+        }
+        memcpy(partial->data, data, len);
+        partial->len = len;
     }
     //
     return 0;
 }
 
-int tcp_server_disconnect(tcp_server_private *private, tcp_server_connect *connect) {
-    assert(private);
+// marks zerocopy sends lo..hi done and hands back what they covered.
+void tcp_server_zerocopy_done(tcp_server_connect *connect, uint32_t lo, uint32_t hi) {
     assert(connect);
     //
-    if(private->attrs.on_disconnect) {
-        private->attrs.on_disconnect(connect->handle, private->user);
+    if((int32_t)(lo - connect->zc_done) > 0) {
+        // tcp reports in order in practice, keep one early range around.
+        if(connect->zc_ahead[1] == connect->zc_ahead[0] || (int32_t)(lo - connect->zc_ahead[0]) < 0) {
+            connect->zc_ahead[0] = lo;
+            connect->zc_ahead[1] = hi + 1;
+        }
+        return;
     }
-
-    if(epoll_ctl(private->epollfd, EPOLL_CTL_DEL, connect->handle, NULL) < 0) {
-        perror("epoll_ctl(DEL");
+    if((int32_t)(hi + 1 - connect->zc_done) > 0) {
+        connect->zc_done = hi + 1;
+    }
+    if(connect->zc_ahead[1] != connect->zc_ahead[0] &&
+       (int32_t)(connect->zc_ahead[0] - connect->zc_done) <= 0) {
+        if((int32_t)(connect->zc_ahead[1] - connect->zc_done) > 0) {
+            connect->zc_done = connect->zc_ahead[1];
+        }
+        connect->zc_ahead[0] = connect->zc_ahead[1] = 0;
     }
-
-    tcp_server_connect_free(&connect);
     //
-    return 0;
+    tcp_server_chunk *chunk;
+    while((chunk = connect->zc_head) != NULL && (int32_t)(chunk->zc_last - connect->zc_done) < 0) {
+        connect->zc_head = chunk->next;
+        if(connect->zc_head == NULL) {
+            connect->zc_tail = NULL;
+        }
+        tcp_server_chunk_free(connect, chunk);
+    }
 }
 
-int tcp_server_foreach_disconnect(uint32_t key, void* value, void* user) {
-    (void)key;
-    //
-    assert(user);
-    tcp_server_private *private = (tcp_server_private *)user;
-    //
-    assert(private);
-    tcp_server_connect *connect = (tcp_server_connect *)value;
-    //
+// drains MSG_ZEROCOPY completions from the socket error queue.
+int tcp_server_zerocopy_reap(tcp_server_connect *connect) {
     assert(connect);
-    tcp_server_disconnect(private, connect);
+    tcp_server_reactor *reactor = connect->reactor;
     //
-    return 0;
+    char control[128];
+    struct msghdr message;
+    struct cmsghdr *cmsg;
+    struct sock_extended_err *error;
+    while(1) {
+        memset(&message, 0, sizeof(message));
+        message.msg_control    = control;
+        message.msg_controllen = sizeof(control);
+        TCP_SERVER_STAT_ADD(reactor, syscalls, 1);
+        if(recvmsg(connect->handle, &message, MSG_ERRQUEUE) < 0) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            else if(errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        for(cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+            if(!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)) {
+                continue;
+            }
+            error = (struct sock_extended_err *)CMSG_DATA(cmsg);
+            if(error->ee_errno != 0 || error->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            // the kernel copied anyway (loopback does), pinning pages
+            // only costs extra, so this connection stops asking.
+            if(error->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                TCP_SERVER_STAT_ADD(reactor, zerocopy_copied, error->ee_data - error->ee_info + 1);
+                connect->zc_state = -1;
+            }
+            tcp_server_zerocopy_done(connect, error->ee_info, error->ee_data);
+        }
+    }
 }
 
-int tcp_server_loop(tcp_server_private *private) {
-    assert(private);
+int tcp_server_connect_init(tcp_server_connect **pointer, tcp_server_reactor *reactor, int sfd) {
+    assert(pointer);
+    tcp_server_connect *connect = NULL;
     //
-    int count;
-    int finished = 0;
-    while(!finished) {
-        count = epoll_wait(private->epollfd, private->events, MAX_WAIT_EVENTS, 0);
-        if(count == -1 && errno != EINTR) {
-            perror("epoll_wait");
+    connect = (tcp_server_connect *)slab_alloc(&reactor->connect_slab);
+    if(connect == NULL) {
+        return -1;
+    }
+    memset(connect, 0, sizeof(tcp_server_connect));
+    connect->handle  = sfd;
+    connect->reactor = reactor;
+    connect->pipe[0] = -1;
+    connect->pipe[1] = -1;
+    // coming up counts as activity.
+    connect->read_ms  = reactor->now_ms;
+    connect->write_ms = reactor->now_ms;
+    // recursive, release callbacks run with it held and may write again.
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&connect->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+    pthread_cond_init(&connect->cond, NULL);
+    //
+    *pointer = connect;
+    //
+    return 0;
+}
+
+int tcp_server_connect_free(tcp_server_connect **pointer) {
+    assert(pointer);
+    tcp_server_connect *connect = *pointer;
+    //
+    assert(connect);
+    pthread_cond_broadcast(&connect->cond);
+    // zerocopy sends still out: the kernel could transmit their buffers
+    // after release gave them back, so the close resets the connection and
+    // drops the send queue instead of flushing it.
+    if(connect->zc_next != connect->zc_done) {
+        (void) tcp_server_zerocopy_reap(connect);
+    }
+    if(connect->zc_next != connect->zc_done) {
+        struct linger linger = {1, 0};
+        (void) setsockopt(connect->handle, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+    } else {
+        shutdown(connect->handle, SHUT_RDWR);
+    }
+    close(connect->handle);
+    if(connect->pipe[0] >= 0) {
+        close(connect->pipe[0]);
+        close(connect->pipe[1]);
+    }
+    //
+    pthread_cond_destroy(&connect->cond);
+    pthread_mutex_destroy(&connect->mutex);
+    //
+    tcp_server_queue_clear(connect);
+    tcp_server_jobs_free(connect->reactor, connect->inbox_head);
+    (void) tcp_server_buffer_free(connect->reactor, &connect->partial);
+    //
+    slab_release(&connect->reactor->connect_slab, connect);
+    *pointer = NULL;
+    //
+    return 0;
+}
+
+// reactor driven by the calling thread, used to route writes made from callbacks.
+static __thread tcp_server_reactor *tcp_server_current = NULL;
+// connection whose batch the calling worker runs, writes to it become replies.
+static __thread tcp_server_connect *tcp_server_worker_current = NULL;
+
+// with the workers below.
+int tcp_server_offload(tcp_server_reactor *reactor, tcp_server_connect *connect, const char *data, uint32_t len);
+
+// keeps len bytes read for connect until the round's batch, -1 when out
+// of memory. an epoll read going on from the last one only extends it.
+int tcp_server_batch_add(tcp_server_reactor *reactor, tcp_server_connect *connect, const char *data,
+                         uint32_t offset, uint32_t len, int bid) {
+    assert(reactor);
+    assert(connect);
+    //
+    tcp_server_pending *pending = reactor->pending_count ? reactor->pending + reactor->pending_count - 1 : NULL;
+    if(pending && pending->connect == connect && bid < 0 && pending->bid < 0 && pending->offset + pending->len == offset) {
+        pending->len += len;
+        return 0;
+    }
+    if(reactor->pending_count == reactor->pending_cap) {
+        uint32_t cap = reactor->pending_cap ? reactor->pending_cap * 2 : reactor->max_events;
+        pending = (tcp_server_pending *)realloc(reactor->pending, sizeof(tcp_server_pending) * cap);
+        if(pending == NULL) {
+            return -1;
+        }
+        reactor->pending = pending;
+        tcp_server_read_t *reads = (tcp_server_read_t *)realloc(reactor->reads, sizeof(tcp_server_read_t) * cap);
+        if(reads == NULL) {
+            return -1;
+        }
+        reactor->reads = reads;
+        reactor->pending_cap = cap;
+    }
+    pending = reactor->pending + reactor->pending_count;
+    pending->connect = connect;
+    pending->data    = data;
+    pending->offset  = offset;
+    pending->len     = len;
+    pending->bid     = bid;
+    reactor->pending_count += 1;
+    connect->batched = 1;
+    //
+    return 0;
+}
+
+// hands what the scratch buffer holds to the application and empties it,
+// -1 when the connection has to go. for on_readable_batch it is kept for
+// the end of the round instead, and the buffer grows when full.
+int tcp_server_connect_received(tcp_server_connect *connect) {
+    assert(connect);
+    tcp_server_reactor *reactor = connect->reactor;
+    tcp_server_private *private = reactor->server;
+    tcp_server_buffer *buffer = &reactor->scratch;
+    //
+    int ret = 0;
+    if(private->attrs.on_readable_batch) {
+        if(buffer->len > buffer->pos && !connect->closing) {
+            ret = tcp_server_batch_add(reactor, connect, NULL, buffer->pos, buffer->len - buffer->pos, -1);
+        }
+        if(ret != 0 || connect->closing) {
+            buffer->len = buffer->pos;
+        }
+        buffer->pos = buffer->len;
+        if(ret == 0 && buffer->len == buffer->cap) {
+            ret = tcp_server_buffer_reserve(reactor, buffer, buffer->cap * 2);
+        }
+        return ret;
+    }
+    if(buffer->len > 0 && private->readable && !connect->closing) {
+        // read on, the workers catch up in order.
+        if(private->attrs.workers) {
+            ret = tcp_server_offload(reactor, connect, buffer->data, buffer->len);
+        } else {
+            connect->corked = 1;
+            ret = tcp_server_deliver(connect, buffer->data, buffer->len);
+            connect->corked = 0;
+        }
+    }
+    // reset.
+    buffer->pos = 0;
+    buffer->len = 0;
+    //
+    return ret;
+}
+
+// reads until the socket would block or the event's share of bytes and
+// calls is spent, handing the scratch buffer over each time it fills and
+// once more at the end. 1 when the share ran out first, 0 once drained
+// or paused, -1 on EOF or when the connection has to go, -2 on errors.
+int tcp_server_connect_read(tcp_server_connect *connect) {
+    assert(connect);
+    tcp_server_reactor *reactor = connect->reactor;
+    tcp_server_buffer *buffer = &reactor->scratch;
+    //
+    int count, state;
+    uint32_t bytes = 0, calls = 0;
+    assert(buffer);
+    while(1) {
+        if(buffer->len == buffer->cap && tcp_server_connect_received(connect) != 0) {
+            return -1;
+        }
+        // a callback closed it or filled its output. a paused connection
+        // only gets here for a hang up, one call a round finds it out.
+        if(connect->closing || ((connect->full || connect->held) && calls > 0)) {
+            state = 0;
             break;
         }
-        //
-        int i;
-        struct epoll_event *event;
-        for(i = 0; i < count; i++) {
-            event = private->events + i;
-            //
-            if(event->data.fd == private->eventfd) {
-                eventfd_t val;
-                (void) eventfd_read(private->eventfd, &val);
-                // TODO handle eventfd event.
-                finished = 1;
+        if(bytes >= reactor->event_bytes || calls >= reactor->event_syscalls) {
+            TCP_SERVER_STAT_ADD(reactor, yields, 1);
+            state = 1;
+            break;
+        }
+        count = recv(connect->handle, buffer->data + buffer->len, buffer->cap - buffer->len, 0);
+        TCP_SERVER_STAT_ADD(reactor, syscalls, 1);
+        calls += 1;
+        if(count > 0) {
+            buffer->len += count;
+            bytes += count;
+            connect->read_ms = reactor->now_ms;
+            continue;
+        }
+        else if(count == 0) {
+            state = -1;
+            break;
+        }
+        else if(errno == EWOULDBLOCK) {
+            state = 0;
+            break;
+        }
+        else if(errno == EAGAIN || errno == EINTR) {
+            continue;
+        }
+        else {
+            state = -2;
+            break;
+        }
+    }
+    // what came before an EOF or an error is delivered too.
+    if(tcp_server_connect_received(connect) != 0 && state >= 0) {
+        state = -1;
+    }
+    //
+    return state;
+}
+
+// output went out, for the write and idle deadlines.
+void tcp_server_connect_wrote(tcp_server_connect *connect) {
+    assert(connect);
+    //
+    __atomic_store_n(&connect->write_ms, __atomic_load_n(&connect->reactor->now_ms, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+}
+
+// with the timers below.
+void tcp_server_connect_waiting(tcp_server_connect *connect);
+// with tcp_server_close below.
+void tcp_server_connect_drained(tcp_server_connect *connect);
+
+// output was queued: past high_watermark the connection is full, writers
+// hear so and its reads pause once the socket is armed to match.
+int tcp_server_connect_fill(tcp_server_connect *connect) {
+    assert(connect);
+    uint32_t high = connect->reactor->server->attrs.high_watermark;
+    //
+    if(high == 0) {
+        return 0;
+    }
+    if(!connect->full && connect->out.queued - connect->out.files > high) {
+        __atomic_store_n(&connect->full, 1, __ATOMIC_RELAXED);
+    }
+    //
+    return connect->full ? TCP_SERVER_WRITE_FULL : 0;
+}
+
+// a batch's writes wait in replies, on top of what the loop still sends.
+int tcp_server_reply_fill(tcp_server_connect *connect) {
+    assert(connect);
+    uint32_t high = connect->reactor->server->attrs.high_watermark;
+    //
+    if(high == 0) {
+        return 0;
+    }
+    if(connect->replies.queued - connect->replies.files > high || __atomic_load_n(&connect->full, __ATOMIC_RELAXED)) {
+        return TCP_SERVER_WRITE_FULL;
+    }
+    //
+    return 0;
+}
+
+// output went out: a full connection whose queue fell to low_watermark
+// takes writes and reads again, 1 when the caller owes it on_drain.
+int tcp_server_connect_drain(tcp_server_connect *connect) {
+    assert(connect);
+    //
+    if(!connect->full || connect->out.queued - connect->out.files > connect->reactor->server->attrs.low_watermark) {
+        return 0;
+    }
+    __atomic_store_n(&connect->full, 0, __ATOMIC_RELAXED);
+    //
+    return 1;
+}
+
+// whether chunk should go out with MSG_ZEROCOPY, turns it on when first needed.
+int tcp_server_chunk_zerocopy(tcp_server_connect *connect, tcp_server_chunk *chunk) {
+    uint32_t min = connect->reactor->server->attrs.zerocopy_min;
+    if(chunk->kind != TCP_SERVER_CHUNK_REF || min == 0 || chunk->len < min || connect->zc_state < 0) {
+        return 0;
+    }
+    if(connect->zc_state == 0) {
+        int opt = 1;
+        if(setsockopt(connect->handle, SOL_SOCKET, SO_ZEROCOPY, &opt, sizeof(opt)) < 0) {
+            connect->zc_state = -1;
+            return 0;
+        }
+        connect->zc_state = 1;
+    }
+    //
+    return 1;
+}
+
+// sends from the file chunk at the head, 1 when it is done, 0 when the
+// socket is full or this turn's share went out; EPOLLOUT brings it back.
+int tcp_server_connect_sendfile(tcp_server_connect *connect, tcp_server_chunk *chunk) {
+    assert(connect);
+    assert(chunk);
+    tcp_server_reactor *reactor = connect->reactor;
+    //
+    ssize_t count;
+    uint64_t sent = 0;
+    while(chunk->left > 0) {
+        if(sent >= SENDFILE_MAX) {
+            return 0;
+        }
+        count = sendfile(connect->handle, chunk->file, &chunk->offset,
+                         chunk->left < SENDFILE_MAX ? chunk->left : SENDFILE_MAX);
+        if(tcp_server_current == reactor) {
+            TCP_SERVER_STAT_ADD(reactor, syscalls, 1);
+        }
+        if(count > 0) {
+            chunk->left -= count;
+            connect->out.queued -= count;
+            connect->out.files  -= count;
+            sent += count;
+            tcp_server_connect_wrote(connect);
+            continue;
+        }
+        if(count == 0) {
+            // the file is shorter than asked for, report what went out.
+            connect->out.queued -= chunk->left;
+            connect->out.files  -= chunk->left;
+            break;
+        }
+        if(errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        if(errno != EINTR) {
+            return -2;
+        }
+    }
+    tcp_server_queue_pop(connect);
+    //
+    return 1;
+}
+
+// writes the queue out with as few sendmsg calls as possible.
+// returns 1 once drained, 0 when the socket is full or, on the loop, the
+// event's share went out, below 0 on errors. writers on other threads
+// flush their own data with no share.
+int tcp_server_connect_flush(tcp_server_connect *connect) {
+    assert(connect);
+    tcp_server_reactor *reactor = connect->reactor;
+    //
+    // nothing goes out before the handshake is done.
+    if(connect->connecting) {
+        return 0;
+    }
+    struct iovec iov[IOV_MAX];
+    struct msghdr message = {};
+    tcp_server_chunk *chunk;
+    ssize_t count;
+    int n, zerocopy;
+    int local = tcp_server_current == reactor;
+    uint64_t sent = 0, queued;
+    uint32_t calls = 0;
+    while(connect->out.head) {
+        // everything ahead of it went out.
+        if(connect->out.head->kind == TCP_SERVER_CHUNK_MARK) {
+            tcp_server_queue_pop(connect);
+            continue;
+        }
+        // EPOLLOUT brings the rest back after the other connections.
+        if(local && (sent >= reactor->event_bytes || calls >= reactor->event_syscalls)) {
+            TCP_SERVER_STAT_ADD(reactor, yields, 1);
+            return 0;
+        }
+        calls += 1;
+        if(connect->out.head->kind == TCP_SERVER_CHUNK_FILE) {
+            queued = connect->out.queued;
+            count  = tcp_server_connect_sendfile(connect, connect->out.head);
+            // on_sendfile may have queued more meanwhile.
+            sent  += queued > connect->out.queued ? queued - connect->out.queued : 0;
+            if(count > 0) {
+                continue;
+            }
+            return count;
+        }
+        // a zerocopy send carries its chunk alone, so only that chunk
+        // has to wait for the completion.
+        zerocopy = tcp_server_chunk_zerocopy(connect, connect->out.head);
+        for(n = 0, chunk = connect->out.head; chunk && n < IOV_MAX; chunk = chunk->next, n++) {
+            if(chunk->kind == TCP_SERVER_CHUNK_FILE) {
                 break;
             }
-            else if(event->data.fd == private->listenfd) {
-                socklen_t len = sizeof(private->addr[1]);
-                int sockfd = accept(private->listenfd, (struct sockaddr*)&private->addr[1], &len);
-                if(sockfd < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
-                    perror("accpet");
-                    finished = 1;
-                    break;
-                }
-                //
-                tcp_server_connect *connect;
-                tcp_server_connect_init(&connect, sockfd);
-                hash_map_add(&private->connects, sockfd, connect);
-                //
-                if(tcp_server_make_non_blocking(sockfd) != 0) {
-                    perror("accept non blocking");
-                    finished = 1;
-                    break;
-                }
-                //
-                struct epoll_event event = {};
-                event.data.fd = sockfd;
-                event.events  = EPOLLIN;
-                if(epoll_ctl(private->epollfd, EPOLL_CTL_ADD, sockfd, &event) < 0) {
-                    perror("accept epoll_ctl(ADD)");
-                    finished = 1;
-                    break;
-                }
-                //
-                if(private->attrs.on_connect) {
-                    private->attrs.on_connect(sockfd, private->user);
-                }
-                //
-                continue;
+            if(n > 0 && (zerocopy || tcp_server_chunk_zerocopy(connect, chunk))) {
+                break;
             }
-            else if(event->events & EPOLLIN) {
-                tcp_server_connect *connect;
-                connect = hash_map_get(&private->connects, event->data.fd);
-                //
-                int state = tcp_server_connect_read(connect);
-                if(state == -1) {
-                    if(private->attrs.on_disconnect) {
-                        private->attrs.on_disconnect(
-                            connect->handle,
-                            private->user
-                        );
-                    }
+            iov[n].iov_base = chunk->data + chunk->pos;
+            iov[n].iov_len  = chunk->len - chunk->pos;
+        }
+        message.msg_iov    = iov;
+        message.msg_iovlen = n;
+        // writev has no MSG_NOSIGNAL.
+        count = sendmsg(connect->handle, &message, MSG_NOSIGNAL | (zerocopy ? MSG_ZEROCOPY : 0));
+        if(tcp_server_current == reactor) {
+            TCP_SERVER_STAT_ADD(reactor, syscalls, 1);
+        }
+        if(count > 0 && zerocopy) {
+            if(tcp_server_current == reactor) {
+                TCP_SERVER_STAT_ADD(reactor, zerocopy, 1);
+            }
+            connect->out.head->zerocopy = 1;
+            connect->out.head->zc_last  = connect->zc_next++;
+        }
+        if(count > 0) {
+            tcp_server_queue_consume(connect, (uint64_t)count);
+            tcp_server_connect_wrote(connect);
+            sent += count;
+        }
+        else if(count < 0 && zerocopy && errno == ENOBUFS) {
+            // out of optmem for pinned pages, copy instead.
+            connect->zc_state = -1;
+        }
+        else if(count == 0) {
+            return -1;
+        }
+        else if(errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        else if(errno != EINTR) {
+            return -2;
+        }
+    }
+    //
+    return 1;
+}
 
-                    tcp_server_disconnect(private, connect);
-                    continue;
-                }
-                else if(state == -2) {
-                    perror("read failed");
-                    finished = 1;
-                    break;
-                }
-                else {
-                    if(private->attrs.on_readable) {
-                        private->attrs.on_readable(
-                            connect->handle,
-                            connect->rbuffer->data,
-                            connect->rbuffer->len,
-                            private->user
-                        );
-                    }
-                    // reset.
-                    connect->rbuffer->pos = 0;
-                    connect->rbuffer->len = 0;
-                }
+// keeps EPOLLOUT armed exactly while output is pending, and EPOLLIN
+// exactly while reads aren't paused.
+int tcp_server_connect_arm(tcp_server_connect *connect, int out) {
+    assert(connect);
+    tcp_server_reactor *reactor = connect->reactor;
+    //
+    int paused = connect->full || connect->held;
+    if(connect->armed == out && connect->paused == paused) {
+        return 0;
+    }
+    int waiting = out && !connect->armed;
+    struct epoll_event event = {};
+    event.data.ptr = connect;
+    event.events   = (paused ? 0 : EPOLLIN) | (out ? EPOLLOUT : 0);
+    if(tcp_server_current == reactor) {
+        TCP_SERVER_STAT_ADD(reactor, syscalls, 1);
+    }
+    if(epoll_ctl(reactor->epollfd, EPOLL_CTL_MOD, connect->handle, &event) < 0) {
+        perror("epoll_ctl(MOD)");
+        return -1;
+    }
+    connect->armed  = out;
+    connect->paused = paused;
+    // a connect in progress waits on EPOLLOUT for other reasons.
+    if(waiting && !connect->connecting) {
+        tcp_server_connect_waiting(connect);
+    }
+    //
+    return 0;
+}
+
+// flushes the queue and rearms to match, call with connect->mutex held.
+int tcp_server_connect_send(tcp_server_connect *connect) {
+    assert(connect);
+    //
+    int state = tcp_server_connect_flush(connect);
+    if(state < 0) {
+        return state;
+    }
+    if(state == 1) {
+        pthread_cond_broadcast(&connect->cond);
+    }
+    // armed first, on_drain may write and arm again.
+    int drained = tcp_server_connect_drain(connect);
+    state = tcp_server_connect_arm(connect, state == 0);
+    if(drained) {
+        tcp_server_connect_drained(connect);
+    }
+    //
+    return state;
+}
+
+int tcp_server_make_non_blocking(int sockfd) {
+    int flags, ret;
+    //
+    flags = fcntl(sockfd, F_GETFL, 0);
+    if(flags == -1) {
+        perror("fcntl(F_GETFL)");
+        return -1;
+    }
+    //
+    ret = fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
+    if(ret == -1) {
+        perror("fcntl(F_SETFL)");
+        return -1;
+    }
+    //
+    return 0;
+}
+
+int tcp_server_attach(tcp_server_reactor *reactor, tcp_server_connect *connect) {
+    assert(reactor);
+    assert(connect);
+    //
+    uint32_t fd = (uint32_t)connect->handle;
+    if(fd >= reactor->capacity) {
+        uint32_t capacity = reactor->capacity << 1;
+        while(capacity <= fd) {
+            capacity <<= 1;
+        }
+        tcp_server_connect **connects = (tcp_server_connect **)realloc(reactor->connects, sizeof(tcp_server_connect *) * capacity);
+        if(connects == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        reactor->connects = connects;
+        memset(reactor->connects + reactor->capacity, 0, sizeof(tcp_server_connect *) * (capacity - reactor->capacity));
+        reactor->capacity = capacity;
+    }
+    // zero is never handed out, so an id of 0 means no connection.
+    do {
+        connect->generation = __atomic_add_fetch(&reactor->server->generation, 1, __ATOMIC_RELAXED);
+    } while(connect->generation == 0);
+    // other threads find it through the index only.
+    if(shared_map_add(&reactor->server->index, fd, connect) != 0) {
+        return -1;
+    }
+    reactor->connects[fd] = connect;
+    TCP_SERVER_STAT_ADD(reactor, connections, 1);
+    //
+    return 0;
+}
+
+tcp_server_connect* tcp_server_find(tcp_server_reactor *reactor, int sfd) {
+    assert(reactor);
+    //
+    if(sfd < 0 || (uint32_t)sfd >= reactor->capacity) {
+        return NULL;
+    }
+    //
+    return reactor->connects[sfd];
+}
+
+uint64_t tcp_server_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// output is waiting on the socket, for the write deadline. a send in
+// flight on io_uring, what the other half piped over for a proxied pair.
+int tcp_server_connect_backed(tcp_server_connect *connect) {
+    assert(connect);
+    //
+#ifdef TCP_SERVER_IO_URING
+    if(connect->reactor->uring) {
+        return connect->sending;
+    }
+#endif
+    if(connect->peer) {
+        return connect->peer->piped > 0;
+    }
+    pthread_mutex_lock(&connect->mutex);
+    int armed = connect->armed;
+    pthread_mutex_unlock(&connect->mutex);
+    //
+    return armed;
+}
+
+// when the connection's timer has to go off next, 0 for never.
+uint64_t tcp_server_connect_deadline(tcp_server_connect *connect) {
+    assert(connect);
+    tcp_server_attr_t *attrs = &connect->reactor->server->attrs;
+    //
+    if(connect->connecting || connect->idle) {
+        return connect->deadline_ms;
+    }
+    // the client half keeps time for a proxied pair.
+    if(connect->upstream) {
+        return 0;
+    }
+    uint64_t read  = connect->read_ms;
+    uint64_t write = __atomic_load_n(&connect->write_ms, __ATOMIC_RELAXED);
+    uint64_t deadline = 0, at;
+    if(attrs->idle_timeout_ms) {
+        deadline = (read > write ? read : write) + attrs->idle_timeout_ms;
+    }
+    if(attrs->read_timeout_ms) {
+        at = read + attrs->read_timeout_ms;
+        deadline = deadline && deadline < at ? deadline : at;
+    }
+    if(attrs->write_timeout_ms && tcp_server_connect_backed(connect)) {
+        at = write + attrs->write_timeout_ms;
+        deadline = deadline && deadline < at ? deadline : at;
+    }
+    //
+    return deadline;
+}
+
+// which of the idle, read and write deadlines passed by now.
+int tcp_server_connect_overdue(tcp_server_connect *connect, uint64_t now) {
+    assert(connect);
+    tcp_server_attr_t *attrs = &connect->reactor->server->attrs;
+    //
+    uint64_t read  = connect->read_ms;
+    uint64_t write = __atomic_load_n(&connect->write_ms, __ATOMIC_RELAXED);
+    if(attrs->idle_timeout_ms && (read > write ? read : write) + attrs->idle_timeout_ms <= now) {
+        return TCP_SERVER_TIMEOUT_IDLE;
+    }
+    if(attrs->read_timeout_ms && read + attrs->read_timeout_ms <= now) {
+        return TCP_SERVER_TIMEOUT_READ;
+    }
+    //
+    return TCP_SERVER_TIMEOUT_WRITE;
+}
+
+void tcp_server_connect_expire(timer_wheel_timer_t *timer);
+
+// sets the timer to the current deadline, unless it goes off before that
+// anyway: a deadline pushed back by a read is picked up from there, so
+// reads never touch the wheel.
+void tcp_server_connect_schedule(tcp_server_reactor *reactor, tcp_server_connect *connect) {
+    assert(reactor);
+    assert(connect);
+    //
+    uint64_t deadline = tcp_server_connect_deadline(connect);
+    if(deadline == 0) {
+        (void) timer_wheel_del(&reactor->timers, &connect->timer);
+        return;
+    }
+    if(timer_wheel_pending(&connect->timer) && connect->timer.expires <= deadline) {
+        return;
+    }
+    (void) timer_wheel_add(&reactor->timers, &connect->timer, deadline, tcp_server_connect_expire);
+}
+
+// takes a pooled connection off its address, parked or not.
+void tcp_server_upstream_leave(tcp_server_connect *connect) {
+    assert(connect);
+    //
+    tcp_server_upstream *upstream = connect->host;
+    if(upstream == NULL) {
+        return;
+    }
+    tcp_server_connect **link;
+    if(connect->idle) {
+        for(link = &upstream->idle_head; *link; link = &(*link)->idle_next) {
+            if(*link == connect) {
+                *link = connect->idle_next;
+                break;
+            }
+        }
+        upstream->idle -= 1;
+        connect->idle = 0;
+    }
+    upstream->total -= 1;
+    connect->host = NULL;
+}
+
+int tcp_server_release(tcp_server_reactor *reactor, tcp_server_connect *connect) {
+    assert(reactor);
+    assert(connect);
+    //
+    (void) timer_wheel_del(&reactor->timers, &connect->timer);
+    tcp_server_upstream_leave(connect);
+    reactor->connects[connect->handle] = NULL;
+    TCP_SERVER_STAT_ADD(reactor, connections, -1);
+    // the fd stays open until collect, so no other loop can reuse it yet.
+    (void) shared_map_del(&reactor->server->index, (uint32_t)connect->handle);
+    connect->retired = shared_map_epoch(&reactor->server->index);
+    // events later in this batch may still point at it.
+    connect->closing = 1;
+    connect->next = reactor->garbage;
+    reactor->garbage = connect;
+    //
+    return 0;
+}
+
+int tcp_server_collect(tcp_server_reactor *reactor) {
+    assert(reactor);
+    //
+    tcp_server_connect *connect, *kept = NULL;
+    reactor->lingering = 0;
+    while(reactor->garbage) {
+        connect = reactor->garbage;
+        reactor->garbage = connect->next;
+        // a worker still runs its batch, it goes once the batch is back.
+        if(connect->dispatched) {
+            connect->next = kept;
+            kept = connect;
+            continue;
+        }
+        // a writer on another thread may still hold it from a lookup.
+        if(!shared_map_quiescent(&reactor->server->index, connect->retired)) {
+            reactor->lingering = 1;
+            connect->next = kept;
+            kept = connect;
+            continue;
+        }
+        // a blocking writer woken by the close lets go right after.
+        if(__atomic_load_n(&connect->pinned, __ATOMIC_ACQUIRE) > 0) {
+            reactor->lingering = 1;
+            connect->next = kept;
+            kept = connect;
+            continue;
+        }
+        tcp_server_connect_free(&connect);
+    }
+    reactor->garbage = kept;
+    //
+    return 0;
+}
+
+int tcp_server_disconnect(tcp_server_reactor *reactor, tcp_server_connect *connect) {
+    assert(reactor);
+    assert(connect);
+    tcp_server_private *private = reactor->server;
+    //
+    if(connect->closing) {
+        return 0;
+    }
+    connect->closing = 1;
+    //
+    // outbound connections that never came up were reported to done instead.
+    if(private->attrs.on_disconnect && !connect->upstream && !connect->connecting) {
+        private->attrs.on_disconnect(connect->handle, private->user);
+    }
+
+#ifdef TCP_SERVER_IO_URING
+    if(reactor->uring) {
+        // pending completions still name this fd, keep it open until they land.
+        if(connect->inflight > 0) {
+            shutdown(connect->handle, SHUT_RDWR);
+            return 0;
+        }
+        return tcp_server_release(reactor, connect);
+    }
+#endif
+
+    TCP_SERVER_STAT_ADD(reactor, syscalls, 1);
+    if(epoll_ctl(reactor->epollfd, EPOLL_CTL_DEL, connect->handle, NULL) < 0) {
+        perror("epoll_ctl(DEL)");
+    }
+    // writers blocked on the queue give up.
+    pthread_mutex_lock(&connect->mutex);
+    pthread_cond_broadcast(&connect->cond);
+    pthread_mutex_unlock(&connect->mutex);
+
+    (void) tcp_server_release(reactor, connect);
+    // the other half of a proxied pair goes with it.
+    if(connect->peer) {
+        (void) tcp_server_disconnect(reactor, connect->peer);
+    }
+
+    return 0;
+}
+
+int tcp_server_foreach_disconnect(tcp_server_reactor *reactor, tcp_server_connect *connect) {
+    assert(reactor);
+    assert(connect);
+    tcp_server_private *private = reactor->server;
+    // the loop is gone, nothing is waiting on completions any more.
+    if(!connect->closing && private->attrs.on_disconnect && !connect->upstream && !connect->connecting) {
+        private->attrs.on_disconnect(connect->handle, private->user);
+    }
+    // writers blocked on the queue give up.
+    pthread_mutex_lock(&connect->mutex);
+    connect->closing = 1;
+    pthread_cond_broadcast(&connect->cond);
+    pthread_mutex_unlock(&connect->mutex);
+    tcp_server_release(reactor, connect);
+    //
+    return 0;
+}
+
+// reads while the pipe is empty, writes while the peer's one holds data.
+uint32_t tcp_server_proxy_interest(tcp_server_connect *connect) {
+    assert(connect);
+    assert(connect->peer);
+    //
+    if(connect->connecting) {
+        return EPOLLOUT;
+    }
+    // the client waits until there is somewhere to send to.
+    if(connect->peer->connecting) {
+        return 0;
+    }
+    uint32_t interest = 0;
+    if(!connect->eof && connect->piped == 0) {
+        interest |= EPOLLIN;
+    }
+    if(connect->peer->piped > 0) {
+        interest |= EPOLLOUT;
+    }
+    //
+    return interest;
+}
+
+int tcp_server_proxy_arm(tcp_server_reactor *reactor, tcp_server_connect *connect) {
+    assert(reactor);
+    assert(connect);
+    //
+    uint32_t interest = tcp_server_proxy_interest(connect);
+    if(interest == connect->interest) {
+        return 0;
+    }
+    struct epoll_event event = {};
+    event.data.ptr = connect;
+    event.events   = interest;
+    TCP_SERVER_STAT_ADD(reactor, syscalls, 1);
+    if(epoll_ctl(reactor->epollfd, EPOLL_CTL_MOD, connect->handle, &event) < 0) {
+        perror("epoll_ctl(MOD)");
+        return -1;
+    }
+    // the write deadline runs while the peer's bytes wait on this side.
+    if((interest & EPOLLOUT) && !(connect->interest & EPOLLOUT) && !connect->connecting) {
+        tcp_server_connect_waiting(connect);
+    }
+    connect->interest = interest;
+    //
+    return 0;
+}
+
+// moves what src has to say over to dst through src's pipe until src runs
+// dry or dst backs up. -1 when either side is gone.
+int tcp_server_proxy_pump(tcp_server_reactor *reactor, tcp_server_connect *src, tcp_server_connect *dst) {
+    assert(reactor);
+    assert(src);
+    assert(dst);
+    //
+    ssize_t count;
+    int empty;
+    while(1) {
+        empty = src->eof;
+        if(!src->eof) {
+            count = splice(src->handle, NULL, src->pipe[1], NULL, SPLICE_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            TCP_SERVER_STAT_ADD(reactor, syscalls, 1);
+            if(count > 0) {
+                src->piped += count;
+                src->read_ms = reactor->now_ms;
+                // short reads drained the socket, epoll says if more came.
+                empty = count < SPLICE_SIZE;
+            }
+            else if(count == 0) {
+                src->eof = 1;
+                empty = 1;
+            }
+            // a full pipe looks the same, the next round tells them apart.
+            else if(errno == EAGAIN) {
+                empty = 1;
+            }
+            else if(errno != EINTR) {
+                return errno == ECONNRESET ? -1 : -2;
+            }
+        }
+        if(src->piped > 0) {
+            count = splice(src->pipe[0], NULL, dst->handle, NULL, src->piped, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            TCP_SERVER_STAT_ADD(reactor, syscalls, 1);
+            if(count > 0) {
+                src->piped -= count;
+                tcp_server_connect_wrote(dst);
+                TCP_SERVER_STAT_ADD(reactor, spliced, count);
+            }
+            else if(count == 0 || errno == EAGAIN) {
+                return 0;
+            }
+            else if(errno == EPIPE || errno == ECONNRESET) {
+                return -1;
+            }
+            else if(errno != EINTR) {
+                return -2;
+            }
+        }
+        if(empty && src->piped == 0) {
+            break;
+        }
+    }
+    // the half close follows the last byte.
+    if(src->eof && !src->shut) {
+        TCP_SERVER_STAT_ADD(reactor, syscalls, 1);
+        (void) shutdown(dst->handle, SHUT_WR);
+        src->shut = 1;
+    }
+    //
+    return 0;
+}
+
+// -1 once the pair is done with, either way.
+int tcp_server_proxy_event(tcp_server_reactor *reactor, tcp_server_connect *connect, uint32_t events) {
+    assert(reactor);
+    assert(connect);
+    //
+    tcp_server_connect *peer = connect->peer;
+    int state = 0;
+    if(connect->connecting) {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        TCP_SERVER_STAT_ADD(reactor, syscalls, 1);
+        if(getsockopt(connect->handle, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0) {
+            errno = error ? error : errno;
+            perror("upstream connect");
+            return -1;
+        }
+        connect->connecting = 0;
+    }
+    // only a hangup gets here, the client left before upstream answered.
+    else if(peer->connecting) {
+        return -1;
+    }
+    //
+    if(events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        state = tcp_server_proxy_pump(reactor, connect, peer);
+    }
+    if(state == 0 && (events & EPOLLOUT)) {
+        state = tcp_server_proxy_pump(reactor, peer, connect);
+    }
+    if(state == -2) {
+        perror("splice failed");
+    }
+    if(state < 0) {
+        return -1;
+    }
+    // both ways closed and drained.
+    if(connect->shut && peer->shut) {
+        return -1;
+    }
+    //
+    if(tcp_server_proxy_arm(reactor, connect) != 0 || tcp_server_proxy_arm(reactor, peer) != 0) {
+        return -1;
+    }
+    //
+    return 0;
+}
+
+// pairs a fresh client with its own connection to upstream.
+int tcp_server_proxy_open(tcp_server_reactor *reactor, tcp_server_connect *client) {
+    assert(reactor);
+    assert(client);
+    tcp_server_private *private = reactor->server;
+    //
+    TCP_SERVER_STAT_ADD(reactor, syscalls, 4);
+    int sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if(sockfd < 0) {
+        perror("upstream socket");
+        return -1;
+    }
+    // whatever arrives goes straight on, nagle would only add delay.
+    int opt = 1;
+    (void) setsockopt(client->handle, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    (void) setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    int connecting = 0;
+    if(connect(sockfd, (struct sockaddr *)&private->upstream, sizeof(private->upstream)) < 0) {
+        if(errno != EINPROGRESS) {
+            perror("upstream connect");
+            close(sockfd);
+            return -1;
+        }
+        connecting = 1;
+    }
+    //
+    tcp_server_connect *upstream;
+    if(tcp_server_connect_init(&upstream, reactor, sockfd) != 0) {
+        close(sockfd);
+        return -1;
+    }
+    upstream->upstream   = 1;
+    upstream->connecting = connecting;
+    TCP_SERVER_STAT_ADD(reactor, syscalls, 2);
+    if(pipe2(client->pipe, O_NONBLOCK) < 0 || pipe2(upstream->pipe, O_NONBLOCK) < 0) {
+        perror("pipe2");
+        tcp_server_connect_free(&upstream);
+        return -1;
+    }
+    if(tcp_server_attach(reactor, upstream) != 0) {
+        tcp_server_connect_free(&upstream);
+        return -1;
+    }
+    upstream->peer = client;
+    client->peer   = upstream;
+    //
+    struct epoll_event event = {};
+    event.data.ptr = upstream;
+    event.events   = tcp_server_proxy_interest(upstream);
+    TCP_SERVER_STAT_ADD(reactor, syscalls, 1);
+    if(epoll_ctl(reactor->epollfd, EPOLL_CTL_ADD, sockfd, &event) < 0) {
+        perror("upstream epoll_ctl(ADD)");
+        client->peer = NULL;
+        tcp_server_release(reactor, upstream);
+        return -1;
+    }
+    upstream->interest = event.events;
+    //
+    return 0;
+}
+
+int tcp_server_parse(const char *host, uint16_t port, struct sockaddr_in *addr) {
+    assert(addr);
+    //
+    memset(addr, 0, sizeof(struct sockaddr_in));
+    addr->sin_family = AF_INET;
+    addr->sin_port   = htons(port);
+    // names would need a resolver that blocks the loop.
+    if(host == NULL || inet_pton(AF_INET, host, &addr->sin_addr) != 1) {
+        return -1;
+    }
+    //
+    return 0;
+}
+
+// starts a non-blocking connect owned by reactor, EPOLLOUT tells when it
+// is done. NULL when it failed straight away.
+tcp_server_connect* tcp_server_connect_open(tcp_server_reactor *reactor, struct sockaddr_in *addr,
+                                            uint32_t timeout_ms, tcp_server_connect_fn done, void *user) {
+    assert(reactor);
+    assert(addr);
+    //
+    TCP_SERVER_STAT_ADD(reactor, syscalls, 2);
+    int sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if(sockfd < 0) {
+        perror("connect socket");
+        return NULL;
+    }
+    // even a connect that completes at once is reported from the loop.
+    if(connect(sockfd, (struct sockaddr *)addr, sizeof(struct sockaddr_in)) < 0 && errno != EINPROGRESS) {
+        close(sockfd);
+        return NULL;
+    }
+    //
+    tcp_server_connect *connect;
+    if(tcp_server_connect_init(&connect, reactor, sockfd) != 0) {
+        close(sockfd);
+        return NULL;
+    }
+    if(tcp_server_attach(reactor, connect) != 0) {
+        tcp_server_connect_free(&connect);
+        return NULL;
+    }
+    connect->connecting = 1;
+    connect->done       = done;
+    connect->done_user  = user;
+    // writes made meanwhile queue up behind EPOLLOUT.
+    connect->armed      = 1;
+    //
+    struct epoll_event event = {};
+    event.data.ptr = connect;
+    event.events   = EPOLLIN | EPOLLOUT;
+    TCP_SERVER_STAT_ADD(reactor, syscalls, 1);
+    if(epoll_ctl(reactor->epollfd, EPOLL_CTL_ADD, sockfd, &event) < 0) {
+        perror("connect epoll_ctl(ADD)");
+        tcp_server_release(reactor, connect);
+        return NULL;
+    }
+    if(timeout_ms) {
+        connect->deadline_ms = reactor->now_ms + timeout_ms;
+        tcp_server_connect_schedule(reactor, connect);
+    }
+    //
+    return connect;
+}
+
+void tcp_server_connect_fail(tcp_server_reactor *reactor, tcp_server_connect *connect, int error) {
+    assert(reactor);
+    assert(connect);
+    //
+    tcp_server_disconnect(reactor, connect);
+    if(connect->done) {
+        connect->done(connect->handle, error, connect->done_user);
+    }
+}
+
+// the socket turned writable or failed, 0 once it is up.
+int tcp_server_connect_finish(tcp_server_reactor *reactor, tcp_server_connect *connect) {
+    assert(reactor);
+    assert(connect);
+    //
+    int error = 0;
+    socklen_t len = sizeof(error);
+    TCP_SERVER_STAT_ADD(reactor, syscalls, 1);
+    if(getsockopt(connect->handle, SOL_SOCKET, SO_ERROR, &error, &len) < 0) {
+        error = errno;
+    }
+    if(error != 0) {
+        tcp_server_connect_fail(reactor, connect, error);
+        return -1;
+    }
+    connect->connecting  = 0;
+    connect->deadline_ms = 0;
+    connect->read_ms     = reactor->now_ms;
+    __atomic_store_n(&connect->write_ms, reactor->now_ms, __ATOMIC_RELAXED);
+    tcp_server_connect_schedule(reactor, connect);
+    if(connect->done) {
+        connect->done(connect->handle, 0, connect->done_user);
+    }
+    //
+    return connect->closing ? -1 : 0;
+}
+
+// the connection's timer went off: fails connects and closes parked
+// connections whose time is up, and the rest once on_timeout lets them go.
+void tcp_server_connect_expire(timer_wheel_timer_t *timer) {
+    tcp_server_connect *connect = (tcp_server_connect *)((char *)timer - offsetof(tcp_server_connect, timer));
+    tcp_server_reactor *reactor = connect->reactor;
+    tcp_server_private *private = reactor->server;
+    //
+    if(connect->closing) {
+        return;
+    }
+    uint64_t now = reactor->now_ms;
+    uint64_t deadline = tcp_server_connect_deadline(connect);
+    // there was traffic since it was set.
+    if(deadline == 0 || deadline > now) {
+        tcp_server_connect_schedule(reactor, connect);
+        return;
+    }
+    TCP_SERVER_STAT_ADD(reactor, timeouts, 1);
+    if(connect->connecting) {
+        tcp_server_connect_fail(reactor, connect, ETIMEDOUT);
+        return;
+    }
+    if(connect->idle) {
+        tcp_server_disconnect(reactor, connect);
+        return;
+    }
+    //
+    int kind = tcp_server_connect_overdue(connect, now);
+    if(private->attrs.on_timeout && private->attrs.on_timeout(connect->handle, kind, private->user) != 0
+       && !connect->closing) {
+        if(kind != TCP_SERVER_TIMEOUT_WRITE) {
+            connect->read_ms = now;
+        }
+        if(kind != TCP_SERVER_TIMEOUT_READ) {
+            __atomic_store_n(&connect->write_ms, now, __ATOMIC_RELAXED);
+        }
+        tcp_server_connect_schedule(reactor, connect);
+        return;
+    }
+    tcp_server_disconnect(reactor, connect);
+}
+
+int tcp_server_accept(tcp_server_reactor *reactor) {
+    assert(reactor);
+    tcp_server_private *private = reactor->server;
+    //
+    int sockfd;
+    socklen_t len;
+    while(1) {
+        len = sizeof(reactor->addr);
+        TCP_SERVER_STAT_ADD(reactor, syscalls, 1);
+        sockfd = accept4(reactor->listenfd, (struct sockaddr*)&reactor->addr, &len, SOCK_NONBLOCK);
+        if(sockfd < 0) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            else if(errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            else if(errno == EMFILE || errno == ENFILE) {
+                perror("accept");
+                return 0;
+            }
+            perror("accept");
+            return -1;
+        }
+        //
+        tcp_server_connect *connect;
+        if(tcp_server_connect_init(&connect, reactor, sockfd) != 0) {
+            close(sockfd);
+            continue;
+        }
+        if(tcp_server_attach(reactor, connect) != 0) {
+            tcp_server_connect_free(&connect);
+            continue;
+        }
+        if(private->proxy && tcp_server_proxy_open(reactor, connect) != 0) {
+            tcp_server_release(reactor, connect);
+            continue;
+        }
+        //
+        struct epoll_event event = {};
+        event.data.ptr = connect;
+        event.events  = private->proxy ? tcp_server_proxy_interest(connect) : EPOLLIN;
+        TCP_SERVER_STAT_ADD(reactor, syscalls, 1);
+        if(epoll_ctl(reactor->epollfd, EPOLL_CTL_ADD, sockfd, &event) < 0) {
+            perror("accept epoll_ctl(ADD)");
+            tcp_server_release(reactor, connect);
+            if(connect->peer) {
+                tcp_server_disconnect(reactor, connect->peer);
+            }
+            continue;
+        }
+        connect->interest = event.events;
+        tcp_server_connect_schedule(reactor, connect);
+        //
+        if(private->attrs.on_connect) {
+            private->attrs.on_connect(sockfd, private->user);
+        }
+    }
+}
+
+// runs everything posted so far, in posting order.
+int tcp_server_run_posted(tcp_server_reactor *reactor) {
+    assert(reactor);
+    //
+    tcp_server_task *task = __atomic_exchange_n(&reactor->posted, NULL, __ATOMIC_ACQUIRE);
+    if(task == NULL) {
+        return 0;
+    }
+    tcp_server_task *order = NULL, *next;
+    uint64_t count = 0;
+    for(; task; task = next, count++) {
+        next = task->next;
+        task->next = order;
+        order = task;
+    }
+    __atomic_sub_fetch(&reactor->post_pending, count, __ATOMIC_RELAXED);
+    TCP_SERVER_STAT_ADD(reactor, posted, count);
+    TCP_SERVER_STAT_ADD(reactor, post_batches, 1);
+    if(count > reactor->stats.post_batch_max) {
+        __atomic_store_n(&reactor->stats.post_batch_max, count, __ATOMIC_RELAXED);
+    }
+    //
+    int owned;
+    for(; order; order = next) {
+        next  = order->next;
+        owned = order->owned;
+        order->fn(order->arg);
+        if(owned) {
+            free(order);
+        }
+    }
+    //
+    return (int)count;
+}
+
+// queues a task the caller allocated, it must stay put until it ran.
+void tcp_server_push_task(tcp_server_reactor *reactor, tcp_server_task *task) {
+    assert(reactor);
+    assert(task);
+    //
+    __atomic_add_fetch(&reactor->post_pending, 1, __ATOMIC_RELAXED);
+    tcp_server_task *head = __atomic_load_n(&reactor->posted, __ATOMIC_RELAXED);
+    do {
+        task->next = head;
+    } while(!__atomic_compare_exchange_n(&reactor->posted, &head, task, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    // a non empty stack means the loop has been woken and not drained yet.
+    if(head == NULL) {
+        __atomic_add_fetch(&reactor->stats.post_signals, 1, __ATOMIC_RELAXED);
+        (void) eventfd_write(reactor->eventfd, 1);
+    }
+}
+
+int tcp_server_post_reactor(tcp_server_reactor *reactor, tcp_server_task_fn fn, void *arg) {
+    assert(reactor);
+    assert(fn);
+    //
+    tcp_server_task *task = (tcp_server_task *)malloc(sizeof(tcp_server_task));
+    if(task == NULL) {
+        return -1;
+    }
+    task->fn    = fn;
+    task->arg   = arg;
+    task->owned = 1;
+    tcp_server_push_task(reactor, task);
+    //
+    return 0;
+}
+
+#ifdef TCP_SERVER_IO_URING
+// with the rest of the io_uring backend below.
+int tcp_server_uring_arm_send(tcp_server_reactor *reactor, tcp_server_connect *connect);
+int tcp_server_uring_reading(tcp_server_reactor *reactor, tcp_server_connect *connect);
+#endif
+
+int tcp_server_dispatch(tcp_server_reactor *reactor, tcp_server_connect *connect);
+
+// a batch came back to the loop: its replies join the output queue and
+// whatever was read meanwhile goes out as the next batch.
+void tcp_server_worker_done(void *arg) {
+    tcp_server_connect *connect = (tcp_server_connect *)arg;
+    tcp_server_reactor *reactor = connect->reactor;
+    //
+    tcp_server_jobs_free(reactor, connect->running);
+    connect->running    = NULL;
+    connect->dispatched = 0;
+    //
+    pthread_mutex_lock(&connect->mutex);
+    tcp_server_queue_splice(connect, &connect->replies);
+    (void) tcp_server_connect_fill(connect);
+    pthread_mutex_unlock(&connect->mutex);
+    // closed meanwhile or the loop is tearing down, the queue goes with it.
+    if(connect->closing || tcp_server_current != reactor) {
+        return;
+    }
+    // a frame over frame_max, nothing after it makes sense.
+    if(connect->malformed) {
+        tcp_server_disconnect(reactor, connect);
+        return;
+    }
+#ifdef TCP_SERVER_IO_URING
+    if(reactor->uring) {
+        (void) tcp_server_uring_reading(reactor, connect);
+        if(!connect->sending && connect->out.head) {
+            (void) tcp_server_uring_arm_send(reactor, connect);
+        }
+    } else
+#endif
+    if(connect->out.head) {
+        pthread_mutex_lock(&connect->mutex);
+        int state = tcp_server_connect_send(connect);
+        pthread_mutex_unlock(&connect->mutex);
+        if(state == -2) {
+            perror("write failed");
+        }
+        if(state < 0) {
+            tcp_server_disconnect(reactor, connect);
+            return;
+        }
+    }
+    //
+    if(connect->inbox_head) {
+        (void) tcp_server_dispatch(reactor, connect);
+    }
+}
+
+void* tcp_server_worker_run(void *arg) {
+    tcp_server_connect *connect = (tcp_server_connect *)arg;
+    tcp_server_private *private = connect->reactor->server;
+    //
+    tcp_server_job *job;
+    tcp_server_worker_current = connect;
+    for(job = connect->running; job; job = job->next) {
+        if(tcp_server_deliver(connect, (const char *)(job + 1), job->len) != 0) {
+            connect->malformed = 1;
+            break;
+        }
+    }
+    tcp_server_worker_current = NULL;
+    //
+    connect->returned.fn    = tcp_server_worker_done;
+    connect->returned.arg   = connect;
+    connect->returned.owned = 0;
+    tcp_server_push_task(connect->reactor, &connect->returned);
+    __atomic_sub_fetch(&private->offloaded, 1, __ATOMIC_RELEASE);
+    //
+    return NULL;
+}
+
+// hands the inbox to the workers, the loop keeps reading into a new one.
+int tcp_server_dispatch(tcp_server_reactor *reactor, tcp_server_connect *connect) {
+    assert(reactor);
+    assert(connect);
+    tcp_server_private *private = reactor->server;
+    //
+    connect->running    = connect->inbox_head;
+    connect->inbox_head = NULL;
+    connect->inbox_tail = NULL;
+    connect->dispatched = 1;
+    __atomic_add_fetch(&private->offloaded, 1, __ATOMIC_RELAXED);
+    TCP_SERVER_STAT_ADD(reactor, offloaded, 1);
+    //
+    return pthread_pool_spawn(&private->pool, tcp_server_worker_run, connect);
+}
+
+// on_readable for a connection, run on the workers after what came before.
+int tcp_server_offload(tcp_server_reactor *reactor, tcp_server_connect *connect, const char *data, uint32_t len) {
+    assert(reactor);
+    assert(connect);
+    //
+    if(tcp_server_inbox_append(connect, data, len) != 0) {
+        return -1;
+    }
+    if(!connect->dispatched) {
+        return tcp_server_dispatch(reactor, connect);
+    }
+    //
+    return 0;
+}
+
+// runs the timers due by the clock read after the last wait.
+int tcp_server_timers_expire(tcp_server_reactor *reactor) {
+    assert(reactor);
+    //
+    if(timer_wheel_advance(&reactor->timers, reactor->now_ms) == 0) {
+        return 0;
+    }
+    // connections that timed out go now, the loop may sleep a while.
+    tcp_server_collect(reactor);
+    //
+    return 0;
+}
+
+int tcp_server_poll_timeout(tcp_server_reactor *reactor) {
+    assert(reactor);
+    //
+    switch(reactor->server->attrs.poll) {
+    case TCP_SERVER_POLL_BUSY:
+        return 0;
+    case TCP_SERVER_POLL_ADAPTIVE:
+        if(tcp_server_now_ns() - reactor->active_ns < reactor->spin_ns) {
+            return 0;
+        }
+        break;
+    case TCP_SERVER_POLL_BLOCK:
+    default:
+        break;
+    }
+    // lookups let go of released connections soon, come back for them.
+    if(reactor->lingering) {
+        return 1;
+    }
+    // sleep no longer than the next timer.
+    uint64_t next = timer_wheel_next(&reactor->timers);
+    if(next != UINT64_MAX) {
+        uint64_t now = tcp_server_now_ns() / 1000000;
+        if(next <= now) {
+            return 0;
+        }
+        return next - now < INT_MAX ? (int)(next - now) : INT_MAX;
+    }
+    return -1;
+}
+
+// hands the round's reads to on_readable_batch in one call, then sends
+// what it wrote and closes the connections whose reads ended.
+int tcp_server_batch_run(tcp_server_reactor *reactor) {
+    assert(reactor);
+    tcp_server_private *private = reactor->server;
+    tcp_server_buffer *buffer = &reactor->scratch;
+    //
+    tcp_server_pending *pending;
+    tcp_server_connect *connect;
+    uint32_t i, count = 0;
+    int state;
+    if(reactor->pending_count == 0) {
+        return 0;
+    }
+    for(i = 0; i < reactor->pending_count; i++) {
+        pending = reactor->pending + i;
+        // closed by a callback earlier in the round.
+        if(pending->connect->closing) {
+            continue;
+        }
+        reactor->reads[count].sfd  = pending->connect->handle;
+        reactor->reads[count].data = (void *)(pending->bid < 0 ? (const char *)buffer->data + pending->offset : pending->data);
+        reactor->reads[count].len  = pending->len;
+        pending->connect->corked = 1;
+        count += 1;
+    }
+    if(count > 0) {
+        TCP_SERVER_STAT_ADD(reactor, batches, 1);
+        TCP_SERVER_STAT_ADD(reactor, batched, count);
+        private->attrs.on_readable_batch(reactor->reads, count, private->user);
+    }
+    //
+    for(i = 0; i < reactor->pending_count; i++) {
+        pending = reactor->pending + i;
+        connect = pending->connect;
+        connect->corked  = 0;
+        connect->batched = 0;
+#ifdef TCP_SERVER_IO_URING
+        if(pending->bid >= 0) {
+            (void) uring_buffer_recycle(&reactor->ring, (uint16_t)pending->bid);
+        }
+#endif
+        if(connect->closing) {
+            continue;
+        }
+        if(connect->gone) {
+            tcp_server_disconnect(reactor, connect);
+            continue;
+        }
+#ifdef TCP_SERVER_IO_URING
+        // sends went on the ring as they were written, one submit takes them all.
+        if(reactor->uring) {
+            continue;
+        }
+#endif
+        if(connect->out.head) {
+            pthread_mutex_lock(&connect->mutex);
+            state = tcp_server_connect_send(connect);
+            pthread_mutex_unlock(&connect->mutex);
+            if(state == -2) {
+                perror("write failed");
+            }
+            if(state < 0) {
+                tcp_server_disconnect(reactor, connect);
+            }
+        }
+    }
+    reactor->pending_count = 0;
+    buffer->pos = 0;
+    buffer->len = 0;
+    //
+    return 0;
+}
+
+int tcp_server_loop(tcp_server_reactor *reactor) {
+    assert(reactor);
+    tcp_server_private *private = reactor->server;
+    //
+    int count;
+    int timeout;
+    int finished = 0;
+    uint64_t now;
+    while(!finished) {
+        (void) tcp_server_timers_expire(reactor);
+        timeout = tcp_server_poll_timeout(reactor);
+        TCP_SERVER_STAT_ADD(reactor, syscalls, 1);
+        count = epoll_wait(reactor->epollfd, reactor->events, reactor->max_events, timeout);
+        if(count == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            break;
+        }
+        //
+        now = tcp_server_now_ns();
+        __atomic_store_n(&reactor->now_ms, now / 1000000, __ATOMIC_RELAXED);
+        TCP_SERVER_STAT_ADD(reactor, polls, 1);
+        if(count == 0) {
+            TCP_SERVER_STAT_ADD(reactor, empty_polls, 1);
+            if(reactor->lingering) {
+                tcp_server_collect(reactor);
+            }
+            continue;
+        }
+        if(timeout != 0) {
+            TCP_SERVER_STAT_ADD(reactor, wakeups, 1);
+        }
+        TCP_SERVER_STAT_ADD(reactor, events, count);
+        reactor->active_ns = now;
+        //
+        int i;
+        struct epoll_event *event;
+        for(i = 0; i < count; i++) {
+            event = reactor->events + i;
+            //
+            if(event->data.ptr == &reactor->eventfd) {
+                eventfd_t val;
+                (void) eventfd_read(reactor->eventfd, &val);
+                (void) tcp_server_run_posted(reactor);
+                if(__atomic_load_n(&private->stopping, __ATOMIC_ACQUIRE)) {
+                    finished = 1;
+                    break;
+                }
+                continue;
+            }
+            else if(event->data.ptr == &reactor->listenfd) {
+                if(tcp_server_accept(reactor) != 0) {
+                    finished = 1;
+                    break;
+                }
+                //
+                continue;
+            }
+            //
+            tcp_server_connect *connect = (tcp_server_connect *)event->data.ptr;
+            if(connect->closing) {
+                continue;
+            }
+            // proxied bytes never come up to userspace.
+            if(connect->peer) {
+                if(tcp_server_proxy_event(reactor, connect, event->events) != 0) {
+                    tcp_server_disconnect(reactor, connect);
+                }
+                continue;
+            }
+            // an outbound connect finished, from here on it is like any other.
+            if(connect->connecting && tcp_server_connect_finish(reactor, connect) != 0) {
+                continue;
+            }
+            // parked connections have nothing to say, anything they read is
+            // a close or garbage.
+            if(connect->idle && (event->events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                tcp_server_disconnect(reactor, connect);
+                continue;
+            }
+            //
+            // zerocopy completions raise EPOLLERR until they are read.
+            if((event->events & EPOLLERR) && connect->zc_next != connect->zc_done) {
+                pthread_mutex_lock(&connect->mutex);
+                (void) tcp_server_zerocopy_reap(connect);
+                pthread_mutex_unlock(&connect->mutex);
+            }
+            //
+            // a connection cut short by its share is level triggered, the
+            // next epoll_wait reports it again behind the others.
+            if(event->events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                int state = tcp_server_connect_read(connect);
+                if(state == -2) {
+                    perror("read failed");
+                }
+                //
+                if(state < 0) {
+                    // what it read first still waits in the batch.
+                    if(connect->batched) {
+                        connect->gone = 1;
+                        continue;
+                    }
+                    tcp_server_disconnect(reactor, connect);
+                    continue;
+                }
+                if(connect->closing) {
+                    continue;
+                }
+            }
+            // replies queued by the callback go out here in one go.
+            if((event->events & EPOLLOUT) || connect->out.head) {
+                pthread_mutex_lock(&connect->mutex);
+                int state = tcp_server_connect_send(connect);
+                pthread_mutex_unlock(&connect->mutex);
+                if(state == -2) {
+                    perror("write failed");
+                }
+                //
+                if(state < 0) {
+                    tcp_server_disconnect(reactor, connect);
+                }
+            }
+        }
+        //
+        (void) tcp_server_batch_run(reactor);
+        tcp_server_collect(reactor);
+    }
+    //
+    return 0;
+}
+
+#ifdef TCP_SERVER_IO_URING
+// user_data layout: connection pointer | operation, pointers leave the low bits free.
+enum {
+    TCP_SERVER_OP_ACCEPT = 1,
+    TCP_SERVER_OP_RECV,
+    TCP_SERVER_OP_SEND,
+    TCP_SERVER_OP_EVENT,
+    // the tick it was set for sits above the op bits.
+    TCP_SERVER_OP_TIMEOUT,
+    // stops the multishot recv while reads are paused.
+    TCP_SERVER_OP_CANCEL,
+};
+
+#define TCP_SERVER_OP_MASK 0x7
+#define TCP_SERVER_USER_DATA(ptr, op) ((uint64_t)(uintptr_t)(ptr) | (op))
+
+int tcp_server_uring_arm_accept(tcp_server_reactor *reactor) {
+    assert(reactor);
+    struct io_uring_sqe *sqe = uring_get_sqe(&reactor->ring);
+    if(sqe == NULL) {
+        return -1;
+    }
+    //
+    sqe->opcode       = IORING_OP_ACCEPT;
+    sqe->fd           = reactor->listenfd;
+    sqe->ioprio       = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK;
+    sqe->user_data    = TCP_SERVER_USER_DATA(NULL, TCP_SERVER_OP_ACCEPT);
+    //
+    return 0;
+}
+
+int tcp_server_uring_arm_event(tcp_server_reactor *reactor) {
+    assert(reactor);
+    struct io_uring_sqe *sqe = uring_get_sqe(&reactor->ring);
+    if(sqe == NULL) {
+        return -1;
+    }
+    //
+    sqe->opcode    = IORING_OP_READ;
+    sqe->fd        = reactor->eventfd;
+    sqe->addr      = (uint64_t)(uintptr_t)&reactor->eventval;
+    sqe->len       = sizeof(reactor->eventval);
+    sqe->user_data = TCP_SERVER_USER_DATA(NULL, TCP_SERVER_OP_EVENT);
+    //
+    return 0;
+}
+
+// wakes the ring after timeout ms, unless a timeout in flight does so first.
+int tcp_server_uring_arm_timeout(tcp_server_reactor *reactor, int timeout) {
+    assert(reactor);
+    assert(timeout > 0);
+    //
+    uint64_t at = reactor->now_ms + (uint64_t)timeout;
+    if(reactor->uring_timer_ms && reactor->uring_timer_ms <= at) {
+        return 0;
+    }
+    struct io_uring_sqe *sqe = uring_get_sqe(&reactor->ring);
+    if(sqe == NULL) {
+        return -1;
+    }
+    // the kernel copies the timespec when the sqe is submitted.
+    reactor->uring_timeout.tv_sec  = timeout / 1000;
+    reactor->uring_timeout.tv_nsec = (long long)(timeout % 1000) * 1000000;
+    sqe->opcode    = IORING_OP_TIMEOUT;
+    sqe->fd        = -1;
+    sqe->addr      = (uint64_t)(uintptr_t)&reactor->uring_timeout;
+    sqe->len       = 1;
+    sqe->user_data = (at << 3) | TCP_SERVER_OP_TIMEOUT;
+    reactor->uring_timer_ms = at;
+    //
+    return 0;
+}
+
+int tcp_server_uring_arm_recv(tcp_server_reactor *reactor, tcp_server_connect *connect) {
+    assert(reactor);
+    assert(connect);
+    struct io_uring_sqe *sqe = uring_get_sqe(&reactor->ring);
+    if(sqe == NULL) {
+        return -1;
+    }
+    // one multishot recv per connection, buffers come from the ring's pool.
+    sqe->opcode    = IORING_OP_RECV;
+    sqe->fd        = connect->handle;
+    sqe->flags     = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->ioprio    = IORING_RECV_MULTISHOT;
+    sqe->user_data = TCP_SERVER_USER_DATA(connect, TCP_SERVER_OP_RECV);
+    connect->inflight += 1;
+    connect->receiving = 1;
+    //
+    return 0;
+}
+
+// ends the multishot recv, what it already read still arrives.
+int tcp_server_uring_cancel_recv(tcp_server_reactor *reactor, tcp_server_connect *connect) {
+    assert(reactor);
+    assert(connect);
+    struct io_uring_sqe *sqe = uring_get_sqe(&reactor->ring);
+    if(sqe == NULL) {
+        return -1;
+    }
+    sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+    sqe->fd        = -1;
+    sqe->addr      = TCP_SERVER_USER_DATA(connect, TCP_SERVER_OP_RECV);
+    sqe->user_data = TCP_SERVER_USER_DATA(connect, TCP_SERVER_OP_CANCEL);
+    connect->inflight += 1;
+    //
+    return 0;
+}
+
+// the recv follows whether reads are paused: a paused connection's is
+// cancelled, and a new one starts once the old one has ended and reads
+// resumed.
+int tcp_server_uring_reading(tcp_server_reactor *reactor, tcp_server_connect *connect) {
+    assert(reactor);
+    assert(connect);
+    //
+    int paused = connect->full || connect->held;
+    if(connect->paused == paused || connect->closing) {
+        return 0;
+    }
+    connect->paused = paused;
+    if(!connect->receiving) {
+        return paused ? 0 : tcp_server_uring_arm_recv(reactor, connect);
+    }
+    //
+    return paused ? tcp_server_uring_cancel_recv(reactor, connect) : 0;
+}
+
+int tcp_server_uring_arm_send(tcp_server_reactor *reactor, tcp_server_connect *connect) {
+    assert(reactor);
+    assert(connect);
+    // marks at the head are reached, their done may queue and send anew.
+    while(connect->out.head && connect->out.head->kind == TCP_SERVER_CHUNK_MARK) {
+        tcp_server_queue_pop(connect);
+    }
+    if(connect->out.head == NULL || connect->sending) {
+        return 0;
+    }
+    tcp_server_chunk *chunk = connect->out.head;
+    struct io_uring_sqe *sqe = uring_get_sqe(&reactor->ring);
+    if(sqe == NULL) {
+        return -1;
+    }
+    // left in the sq, every send queued this round goes out with one io_uring_enter.
+    // one chunk at a time, data appended meanwhile goes with the next send.
+    sqe->opcode    = IORING_OP_SEND;
+    sqe->fd        = connect->handle;
+    sqe->addr      = (uint64_t)(uintptr_t)(chunk->data + chunk->pos);
+    sqe->len       = chunk->len - chunk->pos;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = TCP_SERVER_USER_DATA(connect, TCP_SERVER_OP_SEND);
+    connect->sending   = 1;
+    connect->inflight += 1;
+    // the write deadline runs while a send is out.
+    tcp_server_connect_waiting(connect);
+    //
+    return 0;
+}
+
+int tcp_server_uring_write(tcp_server_reactor *reactor, tcp_server_connect *connect, void *data, uint32_t len) {
+    assert(reactor);
+    assert(connect);
+    //
+    if(connect->closing) {
+        return -1;
+    }
+    // bytes in flight stay where they are, new data queues behind them.
+    if(tcp_server_queue_append(connect->reactor, &connect->out, (const char *)data, len) != 0) {
+        return -1;
+    }
+    if(tcp_server_connect_fill(connect)) {
+        (void) tcp_server_uring_reading(reactor, connect);
+    }
+    //
+    if(!connect->sending && connect->out.head && tcp_server_uring_arm_send(reactor, connect) != 0) {
+        return -1;
+    }
+    //
+    return connect->full ? TCP_SERVER_WRITE_FULL : 0;
+}
+
+int tcp_server_uring_write_ref(tcp_server_reactor *reactor, tcp_server_connect *connect, void *data, uint32_t len,
+                               tcp_server_release_fn release, void *user) {
+    assert(reactor);
+    assert(connect);
+    //
+    if(connect->closing) {
+        return -1;
+    }
+    if(tcp_server_queue_ref(connect->reactor, &connect->out, data, len, release, user) != 0) {
+        return -1;
+    }
+    if(tcp_server_connect_fill(connect)) {
+        (void) tcp_server_uring_reading(reactor, connect);
+    }
+    //
+    if(!connect->sending && tcp_server_uring_arm_send(reactor, connect) != 0) {
+        return -1;
+    }
+    //
+    return connect->full ? TCP_SERVER_WRITE_FULL : 0;
+}
+
+int tcp_server_uring_accepted(tcp_server_reactor *reactor, struct io_uring_cqe *cqe) {
+    assert(reactor);
+    tcp_server_private *private = reactor->server;
+    //
+    if(cqe->res >= 0) {
+        int sockfd = cqe->res;
+        tcp_server_connect *connect;
+        if(tcp_server_connect_init(&connect, reactor, sockfd) != 0) {
+            close(sockfd);
+        } else if(tcp_server_attach(reactor, connect) != 0) {
+            tcp_server_connect_free(&connect);
+        } else {
+            tcp_server_connect_schedule(reactor, connect);
+            //
+            if(private->attrs.on_connect) {
+                private->attrs.on_connect(sockfd, private->user);
+            }
+            // on_connect may have paused or closed it already. one that
+            // can't read would otherwise sit there unnoticed.
+            if(!connect->paused && !connect->closing && tcp_server_uring_arm_recv(reactor, connect) != 0) {
+                tcp_server_disconnect(reactor, connect);
+            }
+        }
+    }
+    else if(cqe->res != -EAGAIN && cqe->res != -ECONNABORTED && cqe->res != -EINTR) {
+        errno = -cqe->res;
+        perror("accept");
+        if(cqe->res != -EMFILE && cqe->res != -ENFILE) {
+            return -1;
+        }
+    }
+    //
+    if(!(cqe->flags & IORING_CQE_F_MORE)) {
+        return tcp_server_uring_arm_accept(reactor);
+    }
+    //
+    return 0;
+}
+
+int tcp_server_uring_received(tcp_server_reactor *reactor, tcp_server_connect *connect, struct io_uring_cqe *cqe) {
+    assert(reactor);
+    assert(connect);
+    tcp_server_private *private = reactor->server;
+    //
+    int more = cqe->flags & IORING_CQE_F_MORE;
+    if(!more) {
+        connect->inflight -= 1;
+        connect->receiving = 0;
+    }
+    //
+    if(cqe->res > 0) {
+        uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        int kept = 0;
+        connect->read_ms = reactor->now_ms;
+        // the workers get a copy, the buffer goes straight back to the ring.
+        if(!connect->closing && private->readable && private->attrs.workers) {
+            if(tcp_server_offload(reactor, connect, uring_buffer(&reactor->ring, bid), cqe->res) != 0) {
+                tcp_server_disconnect(reactor, connect);
+            }
+        }
+        // the buffer stays out until the round's batch is done with it.
+        else if(!connect->closing && private->attrs.on_readable_batch) {
+            kept = tcp_server_batch_add(reactor, connect, uring_buffer(&reactor->ring, bid), 0, cqe->res, bid) == 0;
+            if(!kept) {
+                tcp_server_disconnect(reactor, connect);
+            }
+        }
+        else if(!connect->closing && private->readable) {
+            if(tcp_server_deliver(connect, uring_buffer(&reactor->ring, bid), cqe->res) != 0) {
+                tcp_server_disconnect(reactor, connect);
+            }
+        }
+        if(!kept) {
+            (void) uring_buffer_recycle(&reactor->ring, bid);
+        }
+        // don't let a long round sit on most of the buffers.
+        else if(reactor->pending_count >= URING_BUFFER_COUNT / 2) {
+            (void) tcp_server_batch_run(reactor);
+        }
+    }
+    else if(cqe->res != -ENOBUFS && cqe->res != -ECANCELED) {
+        if(cqe->res < 0 && cqe->res != -ECONNRESET) {
+            errno = -cqe->res;
+            perror("recv");
+        }
+        // what it read first still waits in the batch.
+        if(connect->batched) {
+            connect->gone = 1;
+        } else {
+            tcp_server_disconnect(reactor, connect);
+        }
+    }
+    // out of provided buffers, cancelled or a terminated multishot, start
+    // over unless reads are paused or over.
+    if(!more && !connect->closing && !connect->paused && !connect->gone) {
+        return tcp_server_uring_arm_recv(reactor, connect);
+    }
+    //
+    return 0;
+}
+
+int tcp_server_uring_sent(tcp_server_reactor *reactor, tcp_server_connect *connect, struct io_uring_cqe *cqe) {
+    assert(reactor);
+    assert(connect);
+    //
+    connect->inflight -= 1;
+    connect->sending   = 0;
+    if(cqe->res <= 0) {
+        if(cqe->res < 0 && cqe->res != -EPIPE && cqe->res != -ECONNRESET) {
+            errno = -cqe->res;
+            perror("send");
+        }
+        tcp_server_disconnect(reactor, connect);
+        return 0;
+    }
+    //
+    tcp_server_queue_consume(connect, (uint64_t)cqe->res);
+    tcp_server_connect_wrote(connect);
+    if(tcp_server_connect_drain(connect)) {
+        (void) tcp_server_uring_reading(reactor, connect);
+        tcp_server_connect_drained(connect);
+    }
+    if(connect->out.head && !connect->closing && !connect->sending) {
+        return tcp_server_uring_arm_send(reactor, connect);
+    }
+    //
+    return 0;
+}
+
+int tcp_server_uring_complete(struct io_uring_cqe *cqe, void *user) {
+    tcp_server_reactor *reactor = (tcp_server_reactor *)user;
+    assert(reactor);
+    //
+    int op = (int)(cqe->user_data & TCP_SERVER_OP_MASK);
+    // the loop runs the timers, a later timeout may still be in flight.
+    if(op == TCP_SERVER_OP_TIMEOUT) {
+        if(cqe->user_data >> 3 == reactor->uring_timer_ms) {
+            reactor->uring_timer_ms = 0;
+        }
+        return 0;
+    }
+    else if(op == TCP_SERVER_OP_EVENT) {
+        (void) tcp_server_run_posted(reactor);
+        if(__atomic_load_n(&reactor->server->stopping, __ATOMIC_ACQUIRE)
+           || tcp_server_uring_arm_event(reactor) != 0) {
+            reactor->finished = 1;
+        }
+        return 0;
+    }
+    else if(op == TCP_SERVER_OP_ACCEPT) {
+        if(tcp_server_uring_accepted(reactor, cqe) != 0) {
+            reactor->finished = 1;
+        }
+        return 0;
+    }
+    //
+    // the kernel still holds a reference, so the connection is still alive.
+    tcp_server_connect *connect = (tcp_server_connect *)(uintptr_t)(cqe->user_data & ~(uint64_t)TCP_SERVER_OP_MASK);
+    // pinned, so a disconnect from a callback can't free it under us.
+    connect->inflight += 1;
+    if(op == TCP_SERVER_OP_RECV) {
+        (void) tcp_server_uring_received(reactor, connect, cqe);
+    }
+    else if(op == TCP_SERVER_OP_SEND) {
+        (void) tcp_server_uring_sent(reactor, connect, cqe);
+    }
+    else if(op == TCP_SERVER_OP_CANCEL) {
+        connect->inflight -= 1;
+    }
+    connect->inflight -= 1;
+    // last completion for a closed connection, now the fd may go.
+    if(connect->closing && connect->inflight == 0) {
+        tcp_server_release(reactor, connect);
+    }
+    //
+    return 0;
+}
+
+int tcp_server_uring_loop(tcp_server_reactor *reactor) {
+    assert(reactor);
+    //
+    int ret;
+    int count;
+    int timeout;
+    uint64_t enters;
+    uint64_t now;
+    while(!reactor->finished) {
+        (void) tcp_server_timers_expire(reactor);
+        timeout = tcp_server_poll_timeout(reactor);
+        if(timeout > 0 && tcp_server_uring_arm_timeout(reactor, timeout) != 0) {
+            timeout = 0;
+        }
+        enters  = uring_enters(&reactor->ring);
+        ret = uring_submit(&reactor->ring, timeout == 0 ? 0 : 1);
+        if(ret < 0 && ret != -EINTR && ret != -EAGAIN && ret != -EBUSY) {
+            errno = -ret;
+            perror("io_uring_enter");
+            break;
+        }
+        TCP_SERVER_STAT_ADD(reactor, syscalls, uring_enters(&reactor->ring) - enters);
+        now = tcp_server_now_ns();
+        __atomic_store_n(&reactor->now_ms, now / 1000000, __ATOMIC_RELAXED);
+        //
+        count = uring_foreach(&reactor->ring, tcp_server_uring_complete, reactor);
+        (void) tcp_server_batch_run(reactor);
+        tcp_server_collect(reactor);
+        TCP_SERVER_STAT_ADD(reactor, polls, 1);
+        if(count == 0) {
+            TCP_SERVER_STAT_ADD(reactor, empty_polls, 1);
+            continue;
+        }
+        if(timeout != 0) {
+            TCP_SERVER_STAT_ADD(reactor, wakeups, 1);
+        }
+        TCP_SERVER_STAT_ADD(reactor, events, count);
+        reactor->active_ns = now;
+    }
+    //
+    return 0;
+}
+
+int tcp_server_uring_init(tcp_server_reactor *reactor) {
+    assert(reactor);
+    //
+    if(uring_init(&reactor->ring, URING_ENTRIES) != 0) {
+        return -1;
+    }
+    if(uring_buffers_init(&reactor->ring, URING_BUFFER_COUNT, URING_BUFFER_SIZE) != 0
+            || tcp_server_uring_arm_event(reactor) != 0
+            || tcp_server_uring_arm_accept(reactor) != 0) {
+        uring_free(&reactor->ring);
+        return -1;
+    }
+    reactor->uring = 1;
+    //
+    return 0;
+}
+#endif
+
+int tcp_server_reactor_init(tcp_server_reactor *reactor, tcp_server_private *private) {
+    assert(reactor);
+    assert(private);
+    //
+    memset(reactor, 0, sizeof(tcp_server_reactor));
+    reactor->server   = private;
+    reactor->epollfd  = -1;
+    reactor->eventfd  = -1;
+    reactor->listenfd = -1;
+    reactor->now_ms   = tcp_server_now_ns() / 1000000;
+    (void) timer_wheel_init(&reactor->timers, reactor->now_ms);
+    reactor->capacity = 64;
+    reactor->connects = (tcp_server_connect **)malloc(sizeof(tcp_server_connect *) * reactor->capacity);
+    memset(reactor->connects, 0, sizeof(tcp_server_connect *) * reactor->capacity);
+    (void) hash_map_init(&reactor->upstreams, 16);
+    //
+    reactor->max_events = private->attrs.max_events ? private->attrs.max_events : MAX_WAIT_EVENTS;
+    reactor->events = (struct epoll_event *)malloc(sizeof(struct epoll_event) * reactor->max_events);
+    reactor->spin_ns = (uint64_t)(private->attrs.spin_us ? private->attrs.spin_us : DEFAULT_SPIN_US) * 1000;
+    reactor->event_bytes    = private->attrs.event_bytes ? private->attrs.event_bytes : EVENT_BYTES;
+    reactor->event_syscalls = private->attrs.event_syscalls ? private->attrs.event_syscalls : EVENT_SYSCALLS;
+    //
+    uint32_t flags = private->attrs.hugepages ? SLAB_HUGEPAGE : 0, i;
+    (void) slab_init(&reactor->connect_slab, sizeof(tcp_server_connect), flags);
+    for(i = 0; i < POOL_CLASSES; i++) {
+        (void) slab_init(&reactor->pools[i], 1u << (POOL_MIN_SHIFT + i), flags);
+    }
+    (void) slab_init(&reactor->chunk_slab, sizeof(tcp_server_chunk), flags);
+    pthread_mutex_init(&reactor->pool_lock, NULL);
+    if(tcp_server_buffer_init(reactor, &reactor->scratch, BUFFER_SIZE) != 0) {
+        return -1;
+    }
+    //
+    reactor->eventfd = eventfd(0, EFD_NONBLOCK);
+    if(reactor->eventfd < 0) {
+        perror("eventfd");
+        return -1;
+    }
+    //
+    reactor->listenfd = socket(AF_INET, SOCK_STREAM, 0);
+    if(reactor->listenfd < 0) {
+        perror("socket");
+        return -1;
+    }
+    //
+    if(tcp_server_make_non_blocking(reactor->listenfd) != 0) {
+        perror("listen non blocking");
+        return -1;
+    }
+    //
+    int opt = 1;
+    if(setsockopt(reactor->listenfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+        perror("setsockopt(SO_REUSEADDR)");
+        return -1;
+    }
+    // every loop binds its own listener, the kernel spreads accepts between them.
+    if(private->reactor_count > 1) {
+        if(setsockopt(reactor->listenfd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+            perror("setsockopt(SO_REUSEPORT)");
+            return -1;
+        }
+    }
+    //
+    socklen_t len = sizeof(private->addr);
+    if(bind(reactor->listenfd, (struct sockaddr *)&private->addr, len) < 0) {
+        perror("bind");
+        return -1;
+    }
+    //
+    if(listen(reactor->listenfd, SOMAXCONN) < 0) {
+        perror("listen");
+        return -1;
+    }
+    //
+    if(private->attrs.backend == TCP_SERVER_BACKEND_IO_URING) {
+#ifdef TCP_SERVER_IO_URING
+        if(!private->proxy && tcp_server_uring_init(reactor) == 0) {
+            return 0;
+        }
+#endif
+        fprintf(stderr, "io_uring backend unavailable, using epoll\n");
+    }
+    //
+    reactor->epollfd = epoll_create(1024);
+    if(reactor->epollfd < 0) {
+        perror("epoll_create");
+        return -1;
+    }
+    //
+    struct epoll_event event = {};
+    //
+    event.data.ptr = &reactor->eventfd;
+    event.events  = EPOLLIN | EPOLLET;
+    if(epoll_ctl(reactor->epollfd, EPOLL_CTL_ADD, reactor->eventfd, &event) < 0){
+        perror("epoll_ctl(ADD)");
+        return -1;
+    }
+    //
+    event.data.ptr = &reactor->listenfd;
+    event.events  = EPOLLIN | EPOLLET;
+    if(epoll_ctl(reactor->epollfd, EPOLL_CTL_ADD, reactor->listenfd, &event) < 0) {
+        perror("epoll_ctl(ADD)");
+        return -1;
+    }
+    //
+    return 0;
+}
+
+int tcp_server_upstream_free(uint64_t key, void *value, void *user) {
+    (void)key;
+    (void)user;
+    free(value);
+    return 0;
+}
+
+// closes whatever the stopped loop still holds.
+int tcp_server_reactor_close(tcp_server_reactor *reactor) {
+    assert(reactor);
+    //
+    // whatever was posted too late still runs, so its arg isn't lost.
+    (void) tcp_server_run_posted(reactor);
+    //
+    uint32_t i;
+    for(i = 0; reactor->connects && i < reactor->capacity; i++) {
+        if(reactor->connects[i]) {
+            tcp_server_foreach_disconnect(reactor, reactor->connects[i]);
+        }
+    }
+    //
+    return 0;
+}
+
+int tcp_server_reactor_free(tcp_server_reactor *reactor) {
+    assert(reactor);
+    //
+    uint32_t i;
+    (void) tcp_server_reactor_close(reactor);
+    // writers on other threads may still hold some, their slab goes below.
+    tcp_server_collect(reactor);
+    while(reactor->garbage) {
+        usleep(1000);
+        tcp_server_collect(reactor);
+    }
+    free(reactor->connects);
+    reactor->connects = NULL;
+    if(reactor->upstreams.priv) {
+        (void) hash_map_foreach(&reactor->upstreams, tcp_server_upstream_free, NULL);
+        (void) hash_map_free(&reactor->upstreams);
+    }
+    // timers callers left armed are forgotten with it.
+    if(reactor->timers.priv) {
+        (void) timer_wheel_free(&reactor->timers);
+    }
+    //
+#ifdef TCP_SERVER_IO_URING
+    if(reactor->uring) {
+        uring_free(&reactor->ring);
+        reactor->uring = 0;
+    }
+#endif
+    //
+    if(reactor->listenfd >= 0) {
+        if(reactor->epollfd >= 0 && epoll_ctl(reactor->epollfd, EPOLL_CTL_DEL, reactor->listenfd, NULL) < 0) {
+            perror("epoll_ctl(DEL, listenfd)");
+        }
+        close(reactor->listenfd);
+        reactor->listenfd = -1;
+    }
+    //
+    if(reactor->eventfd >= 0) {
+        if(reactor->epollfd >= 0 && epoll_ctl(reactor->epollfd, EPOLL_CTL_DEL, reactor->eventfd, NULL) < 0) {
+            perror("epoll_ctl(DEL, eventfd)");
+        }
+        close(reactor->eventfd);
+        reactor->eventfd = -1;
+    }
+    //
+    if(reactor->epollfd >= 0) {
+        close(reactor->epollfd);
+        reactor->epollfd = -1;
+    }
+    //
+    free(reactor->events);
+    reactor->events = NULL;
+    free(reactor->pending);
+    free(reactor->reads);
+    reactor->pending = NULL;
+    reactor->reads   = NULL;
+    //
+    if(reactor->connect_slab.priv) {
+        tcp_server_buffer_free(reactor, &reactor->scratch);
+        pthread_mutex_destroy(&reactor->pool_lock);
+        slab_free(&reactor->connect_slab);
+        slab_free(&reactor->chunk_slab);
+    }
+    for(i = 0; i < POOL_CLASSES; i++) {
+        if(reactor->pools[i].priv) {
+            slab_free(&reactor->pools[i]);
+        }
+    }
+    //
+    return 0;
+}
+
+int tcp_server_stop(tcp_server_private *private) {
+    assert(private);
+    //
+    uint32_t i;
+    pthread_mutex_lock(&private->lock);
+    __atomic_store_n(&private->stopping, 1, __ATOMIC_RELEASE);
+    for(i = 0; i < private->reactor_count; i++) {
+        if(private->reactors[i].eventfd >= 0) {
+            (void) eventfd_write(private->reactors[i].eventfd, 1);
+        }
+    }
+    pthread_mutex_unlock(&private->lock);
+    //
+    return 0;
+}
+
+void* tcp_server_reactor_run(void *ptr) {
+    tcp_server_reactor *reactor = (tcp_server_reactor *)ptr;
+    assert(reactor);
+    //
+    tcp_server_current = reactor;
+#ifdef TCP_SERVER_IO_URING
+    if(reactor->uring) {
+        (void) tcp_server_uring_loop(reactor);
+    } else
+#endif
+    (void) tcp_server_loop(reactor);
+    tcp_server_current = NULL;
+    // one loop going down takes the others with it.
+    (void) tcp_server_stop(reactor->server);
+    //
+    return NULL;
+}
+
+int tcp_server_resolve(const char *host, uint16_t port, struct sockaddr_in *addr) {
+    assert(addr);
+    //
+    struct addrinfo hints, *result;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    int ret = getaddrinfo(host ? host : "127.0.0.1", NULL, &hints, &result);
+    if(ret != 0) {
+        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(ret));
+        return -1;
+    }
+    memcpy(addr, result->ai_addr, sizeof(struct sockaddr_in));
+    addr->sin_port = htons(port);
+    freeaddrinfo(result);
+    //
+    return 0;
+}
+
+// fills in the framing defaults, -1 when the framing asked for can't work.
+int tcp_server_frame_check(tcp_server_attr_t *attrs) {
+    assert(attrs);
+    //
+    if(attrs->frame_max == 0) {
+        attrs->frame_max = FRAME_MAX;
+    }
+    if(attrs->frame_delimiter && attrs->frame_delimiter_len == 0) {
+        attrs->frame_delimiter_len = (uint32_t)strlen(attrs->frame_delimiter);
+    }
+    switch(attrs->framing) {
+    case TCP_SERVER_FRAME_NONE:
+        return 0;
+    case TCP_SERVER_FRAME_FIXED:
+        return attrs->frame_size > 0 ? 0 : -1;
+    case TCP_SERVER_FRAME_LENGTH:
+        if(attrs->frame_prefix != 1 && attrs->frame_prefix != 2 && attrs->frame_prefix != 4 && attrs->frame_prefix != 8) {
+            return -1;
+        }
+        // the prefix and the largest message fit in a uint32_t buffer.
+        return attrs->frame_max <= UINT32_MAX - attrs->frame_prefix ? 0 : -1;
+    case TCP_SERVER_FRAME_DELIMITER:
+        if(attrs->frame_delimiter == NULL || attrs->frame_delimiter_len == 0 ||
+           attrs->frame_delimiter_len > FRAME_DELIMITER_MAX) {
+            return -1;
+        }
+        return attrs->frame_max <= UINT32_MAX - attrs->frame_delimiter_len ? 0 : -1;
+    default:
+        return -1;
+    }
+}
+
+int tcp_server_setup(tcp_server_t *server, uint16_t port, tcp_server_attr_t *atts, void *user)  {
+    assert(server);
+    tcp_server_private *private;
+    private = (tcp_server_private *)malloc(sizeof(tcp_server_private));
+    memset(private, 0, sizeof(tcp_server_private));
+    //
+    private->user = user;
+    if(atts) {
+        memcpy(&private->attrs, atts, sizeof(tcp_server_attr_t));
+    }
+    //
+    private->addr.sin_family = AF_INET;
+    private->addr.sin_addr.s_addr = INADDR_ANY;
+    private->addr.sin_port   = htons(port);
+    //
+    if(private->attrs.upstream_port) {
+        if(tcp_server_resolve(private->attrs.upstream_host, private->attrs.upstream_port, &private->upstream) != 0) {
+            free(private);
+            return -1;
+        }
+        private->proxy = 1;
+    }
+    //
+    if(tcp_server_frame_check(&private->attrs) != 0) {
+        free(private);
+        return -1;
+    }
+    // a batch is the round's reads as they came, on the loop thread.
+    if(private->attrs.on_readable_batch && (private->attrs.framing != TCP_SERVER_FRAME_NONE || private->attrs.workers)) {
+        free(private);
+        return -1;
+    }
+    private->readable = private->attrs.framing == TCP_SERVER_FRAME_NONE ?
+        (private->attrs.on_readable != NULL || private->attrs.on_readable_batch != NULL) : private->attrs.on_message != NULL;
+    if(private->attrs.low_watermark > private->attrs.high_watermark) {
+        private->attrs.low_watermark = private->attrs.high_watermark;
+    }
+    //
+    uint32_t count = private->attrs.threads;
+    if(count == TCP_SERVER_THREADS_AUTO) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        count = online > 0 ? (uint32_t)online : 1;
+    }
+    if(count < 1) {
+        count = 1;
+    }
+    pthread_mutex_init(&private->lock, NULL);
+    (void) shared_map_init(&private->index, 64, 64);
+    if(private->attrs.workers) {
+        (void) pthread_pool_init(&private->pool, private->attrs.workers);
+    }
+    private->reactor_count = count;
+    private->reactors = (tcp_server_reactor *)malloc(sizeof(tcp_server_reactor) * count);
+    //
+    int ret = 0;
+    uint32_t i, inited = 0, started = 1;
+    for(i = 0; i < count; i++) {
+        inited += 1;
+        if(tcp_server_reactor_init(&private->reactors[i], private) != 0) {
+            ret = -1;
+            goto FINISH;
+        }
+    }
+    //
+    server->priv = private;
+    //
+    for(; started < count; started++) {
+        if(pthread_create(&private->reactors[started].thread, NULL,
+                          tcp_server_reactor_run, &private->reactors[started]) != 0) {
+            perror("pthread_create");
+            ret = -1;
+            (void) tcp_server_stop(private);
+            break;
+        }
+    }
+    // the calling thread drives the first loop.
+    if(ret == 0) {
+        (void) tcp_server_reactor_run(&private->reactors[0]);
+    }
+    //
+    for(i = 1; i < started; i++) {
+        pthread_join(private->reactors[i].thread, NULL);
+    }
+    //
+FINISH:
+    // batches still out post their replies back, the loops run those
+    // while they are freed.
+    if(private->pool.priv) {
+        while(__atomic_load_n(&private->offloaded, __ATOMIC_ACQUIRE) > 0) {
+            usleep(1000);
+        }
+        (void) pthread_pool_destroy(&private->pool);
+    }
+    //
+    pthread_mutex_lock(&private->lock);
+    server->priv = NULL;
+    pthread_mutex_unlock(&private->lock);
+    // every loop closes first, a writer blocked on one loop's connection
+    // would keep the others from ever freeing theirs.
+    for(i = 0; i < inited; i++) {
+        (void) tcp_server_reactor_close(&private->reactors[i]);
+    }
+    for(i = 0; i < inited; i++) {
+        tcp_server_reactor_free(&private->reactors[i]);
+    }
+    //
+    pthread_mutex_destroy(&private->lock);
+    (void) shared_map_free(&private->index);
+    free(private->reactors);
+    free(private);
+    //
+
+    return ret;
+}
+
+// the connection behind sfd, on this loop or another. callers use it
+// between shared_map_enter and shared_map_leave on the index, so the
+// loop that owns it can't free it under them.
+tcp_server_connect* tcp_server_lookup(tcp_server_private *private, int sfd) {
+    assert(private);
+    //
+    tcp_server_connect *connect = NULL;
+    tcp_server_reactor *reactor = tcp_server_current;
+    if(reactor != NULL && reactor->server == private) {
+        connect = tcp_server_find(reactor, sfd);
+    }
+    //
+    // other loops' tables are only safe to read on their own thread.
+    if(connect == NULL && sfd >= 0) {
+        connect = (tcp_server_connect *)shared_map_get(&private->index, (uint32_t)sfd);
+    }
+    //
+    return connect;
+}
+
+int tcp_server_write_connect(tcp_server_connect *connect, void *data, uint32_t len, int blocking) {
+    assert(connect);
+    tcp_server_reactor *reactor = connect->reactor;
+    //
+    // replies of a batch wait for it to end, so there is nothing to block on.
+    if(tcp_server_worker_current == connect) {
+        if(tcp_server_queue_append(reactor, &connect->replies, (const char *)data, len) != 0) {
+            return -1;
+        }
+        return tcp_server_reply_fill(connect);
+    }
+#ifdef TCP_SERVER_IO_URING
+    if(reactor->uring) {
+        // sqes may only be queued from the loop thread.
+        assert(tcp_server_current == reactor);
+        return tcp_server_uring_write(reactor, connect, data, len);
+    }
+#endif
+    //
+    int local = tcp_server_current == reactor;
+    int corked = local && connect->corked;
+    const char *bytes = (const char *)data;
+    ssize_t count;
+    int ret = 0;
+    pthread_mutex_lock(&connect->mutex);
+    // proxied connections carry nothing but spliced bytes.
+    if(connect->closing || connect->peer) {
+        ret = -1;
+        goto FINISH;
+    }
+    // nothing queued, try sending straight from the caller's memory.
+    if(connect->out.head == NULL && !corked && !connect->connecting && len > 0) {
+        count = send(connect->handle, bytes, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if(local) {
+            TCP_SERVER_STAT_ADD(reactor, syscalls, 1);
+        }
+        if(count < 0) {
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                ret = -1;
+                goto FINISH;
+            }
+            count = 0;
+        }
+        else if(count > 0) {
+            tcp_server_connect_wrote(connect);
+        }
+        bytes += count;
+        len   -= (uint32_t)count;
+    }
+    //
+    if(len > 0) {
+        if(tcp_server_queue_append(connect->reactor, &connect->out, bytes, len) != 0) {
+            ret = -1;
+            goto FINISH;
+        }
+        ret = tcp_server_connect_fill(connect);
+        // the loop flushes corked connections itself once the callback returns.
+        if(!corked && tcp_server_connect_arm(connect, 1) != 0) {
+            ret = -1;
+            goto FINISH;
+        }
+    }
+    // the loop thread can't wait on itself.
+    if(blocking && !local) {
+        while(connect->out.head && !connect->closing) {
+            pthread_cond_wait(&connect->cond, &connect->mutex);
+        }
+    }
+    //
+FINISH:
+    pthread_mutex_unlock(&connect->mutex);
+    //
+    return ret;
+}
 
-            }
-            else if(event->events & EPOLLOUT) {
-                tcp_server_connect *connect;
-                connect = hash_map_get(&private->connects, event->data.fd);
-                //
-                fprintf(stderr, "write...\n");
-                int state = tcp_server_connect_write(connect);
-                if(state == -1) {
-                    if(private->attrs.on_disconnect) {
-                        private->attrs.on_disconnect(
-                            connect->handle,
-                            private->user
-                        );
-                    }
+int tcp_server_write_ref_connect(tcp_server_connect *connect, void *data, uint32_t len,
+                                 tcp_server_release_fn release, void *user) {
+    assert(connect);
+    tcp_server_reactor *reactor = connect->reactor;
+    // an empty chunk would send nothing, which reads as the peer being gone.
+    if(len == 0) {
+        if(release) {
+            release(data, len, user);
+        }
+        return 0;
+    }
+    if(tcp_server_worker_current == connect) {
+        if(tcp_server_queue_ref(reactor, &connect->replies, data, len, release, user) != 0) {
+            return -1;
+        }
+        return tcp_server_reply_fill(connect);
+    }
+#ifdef TCP_SERVER_IO_URING
+    if(reactor->uring) {
+        // sqes may only be queued from the loop thread.
+        assert(tcp_server_current == reactor);
+        return tcp_server_uring_write_ref(reactor, connect, data, len, release, user);
+    }
+#endif
+    //
+    int corked = tcp_server_current == reactor && connect->corked;
+    int ret = 0;
+    pthread_mutex_lock(&connect->mutex);
+    if(connect->closing || connect->peer || tcp_server_queue_ref(connect->reactor, &connect->out, data, len, release, user) != 0) {
+        ret = -1;
+    }
+    else {
+        (void) tcp_server_connect_fill(connect);
+        // once queued the data is ours, a failed send shows up on the loop.
+        if(!corked && tcp_server_connect_send(connect) == -2) {
+            perror("write failed");
+        }
+        // whatever sending at once left.
+        ret = connect->full ? TCP_SERVER_WRITE_FULL : 0;
+    }
+    pthread_mutex_unlock(&connect->mutex);
+    //
+    return ret;
+}
 
-                    tcp_server_disconnect(private, connect);
-                    continue;
-                }
-                else if(state == -2) {
-                    perror("read failed");
-                    finished = 1;
-                    break;
-                }
-                else {
-                    if(state == connect->wbuffer->len) {
-                        struct epoll_event event = {};
-                        event.data.fd = connect->handle;
-                        event.events  = EPOLLIN;
-                        if(epoll_ctl(private->epollfd, EPOLL_CTL_MOD, connect->handle, &event) < 0) {
-                            perror("epoll_ctl(MOD)");
-                            finished = 1;
-                            break;
-                        }
-                    }
-                }
-            }
+int tcp_server_sendfile_connect(tcp_server_connect *connect, int fd, int64_t offset, uint64_t len) {
+    assert(connect);
+    tcp_server_reactor *reactor = connect->reactor;
+    //
+#ifdef TCP_SERVER_IO_URING
+    // sends there go out one chunk at a time through sqes.
+    if(reactor->uring) {
+        return -1;
+    }
+#endif
+    if(tcp_server_worker_current == connect) {
+        if(tcp_server_queue_file(reactor, &connect->replies, fd, offset, len) != 0) {
+            return -1;
+        }
+        return tcp_server_reply_fill(connect);
+    }
+    //
+    int corked = tcp_server_current == reactor && connect->corked;
+    int ret = 0;
+    pthread_mutex_lock(&connect->mutex);
+    if(connect->closing || connect->peer || tcp_server_queue_file(connect->reactor, &connect->out, fd, offset, len) != 0) {
+        ret = -1;
+    }
+    else {
+        (void) tcp_server_connect_fill(connect);
+        if(!corked && tcp_server_connect_send(connect) == -2) {
+            perror("sendfile failed");
+        }
+        ret = connect->full ? TCP_SERVER_WRITE_FULL : 0;
+    }
+    pthread_mutex_unlock(&connect->mutex);
+    //
+    return ret;
+}
 
+int tcp_server_write_async_connect(tcp_server_connect *connect, void *data, uint32_t len,
+                                   tcp_server_connect_fn done, void *user) {
+    assert(connect);
+    tcp_server_reactor *reactor = connect->reactor;
+    //
+    if(tcp_server_worker_current == connect) {
+        if(tcp_server_queue_append(reactor, &connect->replies, (const char *)data, len) != 0
+           || tcp_server_queue_mark(reactor, &connect->replies, done, user) != 0) {
+            return -1;
+        }
+        return tcp_server_reply_fill(connect);
+    }
+#ifdef TCP_SERVER_IO_URING
+    if(reactor->uring) {
+        assert(tcp_server_current == reactor);
+        if(tcp_server_uring_write(reactor, connect, data, len) < 0
+           || tcp_server_queue_mark(reactor, &connect->out, done, user) != 0) {
+            return -1;
+        }
+        // with a send in flight the mark is reached when it completes.
+        if(!connect->sending && tcp_server_uring_arm_send(reactor, connect) != 0) {
+            return -1;
         }
+        return connect->full ? TCP_SERVER_WRITE_FULL : 0;
     }
+#endif
     //
-    return 0;
+    int corked = tcp_server_current == reactor && connect->corked;
+    int ret = 0;
+    pthread_mutex_lock(&connect->mutex);
+    if((ret = tcp_server_write_connect(connect, data, len, 0)) < 0
+       || tcp_server_queue_mark(reactor, &connect->out, done, user) != 0) {
+        ret = -1;
+    }
+    // the data went out at once, nothing is ahead of the mark.
+    else if(!corked && connect->out.head->kind == TCP_SERVER_CHUNK_MARK) {
+        tcp_server_queue_pop(connect);
+    }
+    pthread_mutex_unlock(&connect->mutex);
+    //
+    return ret;
 }
 
-int tcp_server_setup(tcp_server_t *server, uint16_t port, tcp_server_attr_t *atts, void *user)  {
+int tcp_server_write(tcp_server_t *server, int sfd, void *data, uint32_t len, int blocking) {
     assert(server);
-    tcp_server_private *private;
-    private = (tcp_server_private *)malloc(sizeof(tcp_server_private));
-    memset(private, 0, sizeof(tcp_server_private));
-    server->priv = private;
+    tcp_server_private *private = (tcp_server_private *)server->priv;
     //
-    private->user = user;
-    if(atts) {
-        memcpy(&private->attrs, atts, sizeof(tcp_server_attr_t));
+    assert(private);
+    shared_map_enter(&private->index);
+    tcp_server_connect *connect = tcp_server_lookup(private, sfd);
+    if(connect == NULL || !blocking) {
+        int ret = connect ? tcp_server_write_connect(connect, data, len, blocking) : -1;
+        shared_map_leave(&private->index);
+        return ret;
     }
-    (void) hash_map_init(&private->connects, 32);
+    // a blocking write may wait long, it pins the connection instead of
+    // holding up the epoch every loop frees by.
+    __atomic_add_fetch(&connect->pinned, 1, __ATOMIC_RELAXED);
+    shared_map_leave(&private->index);
+    int ret = tcp_server_write_connect(connect, data, len, blocking);
+    __atomic_sub_fetch(&connect->pinned, 1, __ATOMIC_RELEASE);
     //
-    private->addr[0].sin_family = AF_INET;
-    private->addr[0].sin_addr.s_addr = INADDR_ANY;
-    private->addr[0].sin_port   = htons(port);
+    return ret;
+}
+
+tcp_server_conn_t tcp_server_conn(tcp_server_t *server, int sfd) {
+    assert(server);
+    tcp_server_private *private = (tcp_server_private *)server->priv;
     //
-    private->epollfd = epoll_create(1024);
-    if(private->epollfd < 0) {
-        perror("epoll_create");
-        goto FINISH;
-    }
+    assert(private);
+    shared_map_enter(&private->index);
+    tcp_server_connect *connect = tcp_server_lookup(private, sfd);
+    tcp_server_conn_t conn = connect ? ((uint64_t)connect->generation << 32) | (uint32_t)connect->handle : 0;
+    shared_map_leave(&private->index);
     //
-    private->eventfd = eventfd(0, EFD_NONBLOCK);
-    if(private->eventfd < 0) {
-        perror("eventfd");
-        goto FINISH;
+    return conn;
+}
+
+int tcp_server_write_conn(tcp_server_t *server, tcp_server_conn_t conn, void *data, uint32_t len) {
+    assert(server);
+    tcp_server_private *private = (tcp_server_private *)server->priv;
+    //
+    assert(private);
+    shared_map_enter(&private->index);
+    tcp_server_connect *connect = tcp_server_lookup(private, (int)(uint32_t)conn);
+    int ret = -1;
+    // the fd now belongs to someone else.
+    if(connect != NULL && connect->generation == (uint32_t)(conn >> 32)) {
+        ret = tcp_server_write_connect(connect, data, len, 0);
     }
+    shared_map_leave(&private->index);
     //
-    struct epoll_event event = {};
+    return ret;
+}
+
+int tcp_server_write_ref(tcp_server_t *server, int sfd, void *data, uint32_t len,
+                         tcp_server_release_fn release, void *user) {
+    assert(server);
+    tcp_server_private *private = (tcp_server_private *)server->priv;
     //
-    event.data.fd = private->eventfd;
-    event.events  = EPOLLIN | EPOLLET;
-    if(epoll_ctl(private->epollfd, EPOLL_CTL_ADD, private->eventfd, &event) < 0){
-        perror("epoll_ctl(ADD)");
-        goto FINISH;
+    assert(private);
+    shared_map_enter(&private->index);
+    tcp_server_connect *connect = tcp_server_lookup(private, sfd);
+    int ret = connect ? tcp_server_write_ref_connect(connect, data, len, release, user) : -1;
+    shared_map_leave(&private->index);
+    //
+    return ret;
+}
+
+int tcp_server_write_async(tcp_server_t *server, int sfd, void *data, uint32_t len,
+                           tcp_server_connect_fn done, void *user) {
+    assert(server);
+    assert(done);
+    tcp_server_private *private = (tcp_server_private *)server->priv;
+    //
+    assert(private);
+    shared_map_enter(&private->index);
+    tcp_server_connect *connect = tcp_server_lookup(private, sfd);
+    int ret = connect ? tcp_server_write_async_connect(connect, data, len, done, user) : -1;
+    shared_map_leave(&private->index);
+    //
+    return ret;
+}
+
+int tcp_server_sendfile(tcp_server_t *server, int sfd, int fd, int64_t offset, uint64_t len) {
+    assert(server);
+    assert(fd >= 0);
+    assert(offset >= 0);
+    tcp_server_private *private = (tcp_server_private *)server->priv;
+    //
+    assert(private);
+    shared_map_enter(&private->index);
+    tcp_server_connect *connect = tcp_server_lookup(private, sfd);
+    int ret = connect ? tcp_server_sendfile_connect(connect, fd, offset, len) : -1;
+    shared_map_leave(&private->index);
+    //
+    return ret;
+}
+
+// the loop of this server running on the calling thread, if any.
+tcp_server_reactor* tcp_server_local(tcp_server_private *private) {
+    assert(private);
+    //
+    tcp_server_reactor *reactor = tcp_server_current;
+    if(reactor == NULL || reactor->server != private) {
+        return NULL;
+    }
+#ifdef TCP_SERVER_IO_URING
+    if(reactor->uring) {
+        return NULL;
     }
+#endif
     //
-    private->listenfd = socket(AF_INET, SOCK_STREAM, 0);
-    if(private->listenfd < 0) {
-        perror("socket");
-        goto FINISH;
+    return reactor;
+}
+
+int tcp_server_connect_to(tcp_server_t *server, const char *host, uint16_t port,
+                          uint32_t timeout_ms, tcp_server_connect_fn done, void *user) {
+    assert(server);
+    tcp_server_private *private = (tcp_server_private *)server->priv;
+    //
+    assert(private);
+    tcp_server_reactor *reactor = tcp_server_local(private);
+    struct sockaddr_in addr;
+    if(reactor == NULL || tcp_server_parse(host, port, &addr) != 0) {
+        return -1;
     }
+    tcp_server_connect *connect = tcp_server_connect_open(reactor, &addr, timeout_ms, done, user);
     //
-    if(tcp_server_make_non_blocking(private->listenfd) != 0) {
-        perror("listen non blocking");
-        goto FINISH;
+    return connect ? connect->handle : -1;
+}
+
+int tcp_server_upstream_acquire(tcp_server_t *server, const char *host, uint16_t port,
+                                uint32_t timeout_ms, tcp_server_connect_fn done, void *user) {
+    assert(server);
+    tcp_server_private *private = (tcp_server_private *)server->priv;
+    //
+    assert(private);
+    tcp_server_reactor *reactor = tcp_server_local(private);
+    struct sockaddr_in addr;
+    if(reactor == NULL || tcp_server_parse(host, port, &addr) != 0) {
+        return -1;
     }
     //
-    int opt = 1;
-    if(setsockopt(private->listenfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-        perror("setsockopt");
-        goto FINISH;
+    uint64_t key = ((uint64_t)addr.sin_addr.s_addr << 16) | port;
+    tcp_server_upstream *upstream = (tcp_server_upstream *)hash_map_get(&reactor->upstreams, key);
+    if(upstream == NULL) {
+        upstream = (tcp_server_upstream *)malloc(sizeof(tcp_server_upstream));
+        memset(upstream, 0, sizeof(tcp_server_upstream));
+        (void) hash_map_add(&reactor->upstreams, key, upstream);
     }
     //
-    event.data.fd = private->listenfd;
-    event.events  = EPOLLIN | EPOLLET;
-    if(epoll_ctl(private->epollfd, EPOLL_CTL_ADD, private->listenfd, &event) < 0) {
-        perror("epoll_ctl(MOD)");
-        goto FINISH;
+    tcp_server_connect *connect = upstream->idle_head;
+    if(connect) {
+        upstream->idle_head = connect->idle_next;
+        upstream->idle -= 1;
+        connect->idle        = 0;
+        connect->deadline_ms = 0;
+        connect->read_ms     = reactor->now_ms;
+        __atomic_store_n(&connect->write_ms, reactor->now_ms, __ATOMIC_RELAXED);
+        tcp_server_connect_schedule(reactor, connect);
+        if(done) {
+            done(connect->handle, 0, user);
+        }
+        return connect->handle;
     }
     //
-    socklen_t len = sizeof(private->addr[0]);
-    if(bind(private->listenfd, (struct sockaddr *)&private->addr[0], len) < 0) {
-        perror("bind");
-        goto FINISH;
+    if(private->attrs.upstream_max && upstream->total >= private->attrs.upstream_max) {
+        return -1;
+    }
+    connect = tcp_server_connect_open(reactor, &addr, timeout_ms, done, user);
+    if(connect == NULL) {
+        return -1;
     }
+    connect->host = upstream;
+    upstream->total += 1;
     //
-    if(listen(private->listenfd, 8) < 0) {
-        perror("listen");
-        goto FINISH;
+    return connect->handle;
+}
+
+int tcp_server_upstream_release(tcp_server_t *server, int sfd) {
+    assert(server);
+    tcp_server_private *private = (tcp_server_private *)server->priv;
+    //
+    assert(private);
+    tcp_server_reactor *reactor = tcp_server_local(private);
+    if(reactor == NULL) {
+        return -1;
+    }
+    tcp_server_connect *connect = tcp_server_find(reactor, sfd);
+    if(connect == NULL || connect->host == NULL || connect->idle || connect->connecting || connect->closing) {
+        return -1;
     }
     //
-    (void) tcp_server_loop(private);
+    tcp_server_upstream *upstream = connect->host;
+    connect->idle_next  = upstream->idle_head;
+    upstream->idle_head = connect;
+    upstream->idle += 1;
+    connect->idle = 1;
+    connect->deadline_ms = private->attrs.upstream_idle_ms ? reactor->now_ms + private->attrs.upstream_idle_ms : 0;
+    tcp_server_connect_schedule(reactor, connect);
     //
-FINISH:
+    return 0;
+}
+
+int tcp_server_post(tcp_server_t *server, tcp_server_task_fn fn, void *arg) {
+    assert(server);
+    tcp_server_private *private = (tcp_server_private *)server->priv;
+    //
+    if(private == NULL) {
+        return -1;
+    }
+    tcp_server_reactor *reactor = tcp_server_current;
+    if(reactor == NULL || reactor->server != private) {
+        uint32_t next = __atomic_fetch_add(&private->post_next, 1, __ATOMIC_RELAXED);
+        reactor = &private->reactors[next % private->reactor_count];
+    }
     //
-    hash_map_foreach(&private->connects, tcp_server_foreach_disconnect, private);
-    hash_map_free(&private->connects);
+    return tcp_server_post_reactor(reactor, fn, arg);
+}
+
+int tcp_server_post_conn(tcp_server_t *server, int sfd, tcp_server_task_fn fn, void *arg) {
+    assert(server);
+    tcp_server_private *private = (tcp_server_private *)server->priv;
     //
-    if(epoll_ctl(private->epollfd, EPOLL_CTL_DEL, private->listenfd, NULL) < 0) {
-        perror("epoll_ctl(DEL, listenfd)");
+    if(private == NULL) {
+        return -1;
     }
-    close(private->listenfd);
-    private->listenfd = -1;
+    shared_map_enter(&private->index);
+    tcp_server_connect *connect = tcp_server_lookup(private, sfd);
+    int ret = connect ? tcp_server_post_reactor(connect->reactor, fn, arg) : -1;
+    shared_map_leave(&private->index);
+    //
+    return ret;
+}
+
+void tcp_server_timer_fire(timer_wheel_timer_t *node) {
+    tcp_server_timer_t *timer = (tcp_server_timer_t *)((char *)node - offsetof(tcp_server_timer_t, node));
+    timer->fn(timer->arg);
+}
+
+int tcp_server_timer_add(tcp_server_t *server, tcp_server_timer_t *timer, uint32_t delay_ms,
+                         tcp_server_task_fn fn, void *arg) {
+    assert(server);
+    assert(timer);
+    assert(fn);
+    tcp_server_private *private = (tcp_server_private *)server->priv;
     //
-    if(epoll_ctl(private->epollfd, EPOLL_CTL_DEL, private->eventfd, NULL) < 0) {
-        perror("epoll_ctl(DEL, eventfd)");
+    tcp_server_reactor *reactor = tcp_server_current;
+    if(private == NULL || reactor == NULL || reactor->server != private) {
+        return -1;
     }
-    close(private->eventfd);
-    private->eventfd = -1;
+    timer->fn  = fn;
+    timer->arg = arg;
     //
-    close(private->epollfd);
-    private->epollfd = -1;
+    return timer_wheel_add(&reactor->timers, &timer->node, reactor->now_ms + delay_ms, tcp_server_timer_fire);
+}
+
+int tcp_server_timer_cancel(tcp_server_t *server, tcp_server_timer_t *timer) {
+    assert(server);
+    assert(timer);
+    tcp_server_private *private = (tcp_server_private *)server->priv;
     //
-    free(private);
-    server->priv = NULL;
+    tcp_server_reactor *reactor = tcp_server_current;
+    if(private == NULL || reactor == NULL || reactor->server != private) {
+        return -1;
+    }
     //
+    return timer_wheel_del(&reactor->timers, &timer->node);
+}
 
-    return 0;
+// names a connection for a task posted to its loop.
+typedef struct {
+    int sfd;
+    uint32_t generation;
+} tcp_server_conn_task;
+
+void tcp_server_close_posted(void *arg) {
+    tcp_server_conn_task *task = (tcp_server_conn_task *)arg;
+    tcp_server_reactor *reactor = tcp_server_current;
+    // the loop may be tearing down, then the connection goes with it.
+    if(reactor) {
+        tcp_server_connect *connect = tcp_server_find(reactor, task->sfd);
+        if(connect && connect->generation == task->generation) {
+            tcp_server_disconnect(reactor, connect);
+        }
+    }
+    free(task);
 }
 
-int tcp_server_write(tcp_server_t *server, int sfd, void *data, uint32_t len, int blocking) {
+void tcp_server_watch_posted(void *arg) {
+    tcp_server_conn_task *task = (tcp_server_conn_task *)arg;
+    tcp_server_reactor *reactor = tcp_server_current;
+    if(reactor) {
+        tcp_server_connect *connect = tcp_server_find(reactor, task->sfd);
+        if(connect && connect->generation == task->generation && !connect->closing) {
+            tcp_server_connect_schedule(reactor, connect);
+        }
+    }
+    free(task);
+}
+
+// output started waiting on the socket, the write deadline runs from now.
+// only the loop touches its timers, other threads hand it over.
+void tcp_server_connect_waiting(tcp_server_connect *connect) {
+    assert(connect);
+    tcp_server_reactor *reactor = connect->reactor;
+    //
+    tcp_server_connect_wrote(connect);
+    if(reactor->server->attrs.write_timeout_ms == 0 || connect->upstream) {
+        return;
+    }
+    if(tcp_server_current == reactor) {
+        tcp_server_connect_schedule(reactor, connect);
+        return;
+    }
+    tcp_server_conn_task *task = (tcp_server_conn_task *)malloc(sizeof(tcp_server_conn_task));
+    if(task == NULL) {
+        return;
+    }
+    task->sfd        = connect->handle;
+    task->generation = connect->generation;
+    if(tcp_server_post_reactor(reactor, tcp_server_watch_posted, task) != 0) {
+        free(task);
+    }
+}
+
+void tcp_server_drain_posted(void *arg) {
+    tcp_server_conn_task *task = (tcp_server_conn_task *)arg;
+    tcp_server_reactor *reactor = tcp_server_current;
+    if(reactor) {
+        tcp_server_connect *connect = tcp_server_find(reactor, task->sfd);
+        if(connect && connect->generation == task->generation && !connect->closing) {
+            tcp_server_connect_drained(connect);
+        }
+    }
+    free(task);
+}
+
+// a full connection drained, on_drain runs on its loop. a writer on
+// another thread that sent the queue down hands it over.
+void tcp_server_connect_drained(tcp_server_connect *connect) {
+    assert(connect);
+    tcp_server_reactor *reactor = connect->reactor;
+    tcp_server_private *private = reactor->server;
+    //
+    if(private->attrs.on_drain == NULL || connect->closing) {
+        return;
+    }
+    if(tcp_server_current == reactor) {
+        private->attrs.on_drain(connect->handle, private->user);
+        return;
+    }
+    tcp_server_conn_task *task = (tcp_server_conn_task *)malloc(sizeof(tcp_server_conn_task));
+    if(task == NULL) {
+        return;
+    }
+    task->sfd        = connect->handle;
+    task->generation = connect->generation;
+    if(tcp_server_post_reactor(reactor, tcp_server_drain_posted, task) != 0) {
+        free(task);
+    }
+}
+
+int tcp_server_pause(tcp_server_t *server, int sfd, int paused) {
     assert(server);
     tcp_server_private *private = (tcp_server_private *)server->priv;
     //
     assert(private);
-    tcp_server_buffer *buffer;
-    tcp_server_connect *connect;
-    connect = hash_map_get(&private->connects, sfd);
-    buffer  = connect->wbuffer;
-    //
-    if(blocking) {
-        pthread_mutex_lock(&connect->mutex);
+    tcp_server_reactor *reactor = tcp_server_current;
+    if(reactor == NULL || reactor->server != private) {
+        return -1;
     }
+    tcp_server_connect *connect = tcp_server_find(reactor, sfd);
+    if(connect == NULL || connect->closing || connect->peer) {
+        return -1;
+    }
+    connect->held = paused != 0;
+#ifdef TCP_SERVER_IO_URING
+    if(reactor->uring) {
+        return tcp_server_uring_reading(reactor, connect);
+    }
+#endif
+    // a connect in progress comes up with reads on, arming waits until then.
+    if(connect->connecting) {
+        return 0;
+    }
+    pthread_mutex_lock(&connect->mutex);
+    int ret = tcp_server_connect_arm(connect, connect->armed);
+    pthread_mutex_unlock(&connect->mutex);
+    //
+    return ret;
+}
 
-    memcpy(buffer->data, data, len);
-    buffer->len = len;
-    buffer->pos = 0;
-
-    struct epoll_event event = {};
-    event.data.fd = connect->handle;
-    event.events  = EPOLLIN | EPOLLOUT;
-    if(epoll_ctl(private->epollfd, EPOLL_CTL_MOD, connect->handle, &event) < 0) {
-        perror("epoll_ctl(MOD)");
+int tcp_server_close(tcp_server_t *server, int sfd) {
+    assert(server);
+    tcp_server_private *private = (tcp_server_private *)server->priv;
+    //
+    if(private == NULL) {
+        return -1;
+    }
+    shared_map_enter(&private->index);
+    tcp_server_connect *connect = tcp_server_lookup(private, sfd);
+    tcp_server_reactor *reactor = connect ? connect->reactor : NULL;
+    uint32_t generation = connect ? connect->generation : 0;
+    shared_map_leave(&private->index);
+    if(reactor == NULL) {
+        return -1;
+    }
+    // only the owning loop frees it, so it can't go under its own loop.
+    if(reactor == tcp_server_current) {
+        return tcp_server_disconnect(reactor, connect);
+    }
+    // only the owning loop may take it out of its table.
+    tcp_server_conn_task *task = (tcp_server_conn_task *)malloc(sizeof(tcp_server_conn_task));
+    if(task == NULL) {
         return -1;
     }
+    task->sfd        = sfd;
+    task->generation = generation;
+    if(tcp_server_post_reactor(reactor, tcp_server_close_posted, task) != 0) {
+        free(task);
+        return -1;
+    }
+    //
+    return 0;
+}
 
-    if(blocking) {
-        pthread_cond_wait(&connect->cond, &connect->mutex);
-        pthread_mutex_unlock(&connect->mutex);
+int tcp_server_stats(tcp_server_t *server, tcp_server_stats_t *stats) {
+    assert(server);
+    assert(stats);
+    tcp_server_private *private = (tcp_server_private *)server->priv;
+    //
+    memset(stats, 0, sizeof(tcp_server_stats_t));
+    if(private == NULL) {
+        return -1;
+    }
+    // setup takes the server down under the lock before freeing the loops.
+    pthread_mutex_lock(&private->lock);
+    if(server->priv != private) {
+        pthread_mutex_unlock(&private->lock);
+        return -1;
     }
     //
+    uint32_t i, j;
+    tcp_server_stats_t *counters;
+    tcp_server_reactor *reactor;
+    slab_stats_t occupancy;
+    for(i = 0; i < private->reactor_count; i++) {
+        counters = &private->reactors[i].stats;
+        stats->polls       += __atomic_load_n(&counters->polls, __ATOMIC_RELAXED);
+        stats->wakeups     += __atomic_load_n(&counters->wakeups, __ATOMIC_RELAXED);
+        stats->empty_polls += __atomic_load_n(&counters->empty_polls, __ATOMIC_RELAXED);
+        stats->events      += __atomic_load_n(&counters->events, __ATOMIC_RELAXED);
+        stats->syscalls    += __atomic_load_n(&counters->syscalls, __ATOMIC_RELAXED);
+        stats->connections += __atomic_load_n(&counters->connections, __ATOMIC_RELAXED);
+        stats->zerocopy    += __atomic_load_n(&counters->zerocopy, __ATOMIC_RELAXED);
+        stats->zerocopy_copied += __atomic_load_n(&counters->zerocopy_copied, __ATOMIC_RELAXED);
+        stats->spliced += __atomic_load_n(&counters->spliced, __ATOMIC_RELAXED);
+        stats->posted       += __atomic_load_n(&counters->posted, __ATOMIC_RELAXED);
+        stats->post_batches += __atomic_load_n(&counters->post_batches, __ATOMIC_RELAXED);
+        stats->post_signals += __atomic_load_n(&counters->post_signals, __ATOMIC_RELAXED);
+        stats->offloaded    += __atomic_load_n(&counters->offloaded, __ATOMIC_RELAXED);
+        stats->timeouts     += __atomic_load_n(&counters->timeouts, __ATOMIC_RELAXED);
+        stats->yields       += __atomic_load_n(&counters->yields, __ATOMIC_RELAXED);
+        stats->batches      += __atomic_load_n(&counters->batches, __ATOMIC_RELAXED);
+        stats->batched      += __atomic_load_n(&counters->batched, __ATOMIC_RELAXED);
+        if(stats->post_batch_max < __atomic_load_n(&counters->post_batch_max, __ATOMIC_RELAXED)) {
+            stats->post_batch_max = __atomic_load_n(&counters->post_batch_max, __ATOMIC_RELAXED);
+        }
+        //
+        reactor = &private->reactors[i];
+        stats->post_depth += __atomic_load_n(&reactor->post_pending, __ATOMIC_RELAXED);
+        (void) slab_stats(&reactor->connect_slab, &occupancy);
+        stats->pool_chunks += occupancy.chunks;
+        stats->pool_used   += occupancy.used * occupancy.size;
+        (void) slab_stats(&reactor->chunk_slab, &occupancy);
+        stats->pool_chunks += occupancy.chunks;
+        stats->pool_used   += occupancy.used * occupancy.size;
+        for(j = 0; j < POOL_CLASSES; j++) {
+            (void) slab_stats(&reactor->pools[j], &occupancy);
+            stats->pool_chunks += occupancy.chunks;
+            stats->pool_used   += occupancy.used * occupancy.size;
+        }
+    }
+    pthread_mutex_unlock(&private->lock);
+    stats->pool_bytes = stats->pool_chunks * SLAB_CHUNK_SIZE;
+    //
     return 0;
 }
 
@@ -503,8 +4118,10 @@ int tcp_server_shutdown(tcp_server_t *server) {
     assert(server);
     tcp_server_private *private = (tcp_server_private *)server->priv;
     //
-    assert(private);
-    (void) eventfd_write(private->eventfd, 1);
+    if(private == NULL) {
+        return -1;
+    }
+    (void) tcp_server_stop(private);
     //
     return 0;
 }
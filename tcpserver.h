@@ -7,17 +7,189 @@ extern "C" {
 #endif
 
 #include <stdint.h>
+#include "timerwheel.h"
 
 typedef struct {
     void* priv;
 } tcp_server_t;
 
+// names one connection for its whole life, unlike the fd which the
+// kernel hands out again once it is closed. 0 is never a valid id.
+typedef uint64_t tcp_server_conn_t;
+
+// start one event loop per online cpu.
+#define TCP_SERVER_THREADS_AUTO 0xFFFFFFFFu
+
+// writes return this instead of 0 while the connection's queued output
+// is over high_watermark. the data is queued all the same, but whoever
+// produces it should hold off until on_drain.
+#define TCP_SERVER_WRITE_FULL 1
+
+typedef enum {
+    // sleep in epoll_wait until something happens.
+    TCP_SERVER_POLL_BLOCK = 0,
+    // never sleep, epoll_wait always returns immediately.
+    TCP_SERVER_POLL_BUSY,
+    // busy poll for spin_us after the last event, then block.
+    TCP_SERVER_POLL_ADAPTIVE,
+} tcp_server_poll_t;
+
+typedef enum {
+    TCP_SERVER_BACKEND_EPOLL = 0,
+    // multishot accept/recv with provided buffers and batched sends.
+    // falls back to epoll when the build or the kernel lacks io_uring.
+    // writes must be issued from the loop thread, i.e. from callbacks,
+    // or from a worker to the connection whose on_readable it runs.
+    TCP_SERVER_BACKEND_IO_URING,
+} tcp_server_backend_t;
+
+// which deadline on_timeout hears about.
+typedef enum {
+    // nothing went either way for idle_timeout_ms.
+    TCP_SERVER_TIMEOUT_IDLE = 0,
+    // nothing arrived for read_timeout_ms.
+    TCP_SERVER_TIMEOUT_READ,
+    // pending output made no progress for write_timeout_ms.
+    TCP_SERVER_TIMEOUT_WRITE,
+} tcp_server_timeout_t;
+
+// how reads are cut into messages for on_message.
+typedef enum {
+    // none, on_readable gets the reads as they come.
+    TCP_SERVER_FRAME_NONE = 0,
+    // every frame_size bytes are a message.
+    TCP_SERVER_FRAME_FIXED,
+    // a frame_prefix byte length, then that many bytes of message.
+    TCP_SERVER_FRAME_LENGTH,
+    // messages end with frame_delimiter, "\r\n" say.
+    TCP_SERVER_FRAME_DELIMITER,
+} tcp_server_frame_t;
+
+// one read handed to on_readable_batch.
+typedef struct {
+    int sfd;
+    void* data;
+    uint32_t len;
+} tcp_server_read_t;
+
 typedef struct {
     int (*on_connect)(int sfd, void* user);
     int (*on_readable)(int sfd, void* data, uint32_t len, void* user);
     int (*on_disconnect)(int sfd, void* user);
+    // a tcp_server_sendfile range is done with fd, sent is less than
+    // asked for when the file ended early or the connection went away.
+    int (*on_sendfile)(int sfd, int fd, uint64_t sent, void* user);
+    // a deadline below passed, kind is a tcp_server_timeout_t. the
+    // connection is closed afterwards unless this returns non zero, which
+    // gives it another full period. runs on the loop thread.
+    int (*on_timeout)(int sfd, int kind, void* user);
+    // one whole message when framing is set, in place of on_readable and
+    // wherever that would run. data points into the read buffer and is
+    // only good for the call; length prefixes and delimiters are cut off.
+    int (*on_message)(int sfd, void* data, uint32_t len, void* user);
+    // output that went over high_watermark fell back to low_watermark,
+    // writes take data again and reads resumed. runs on the loop thread.
+    int (*on_drain)(int sfd, void* user);
+    // in place of on_readable: everything a loop read in one round, in the
+    // order it came, so a connection read twice is in there twice. data is
+    // only good for the call, and what it writes to the connections in
+    // there goes out together once it returns. not with framing or
+    // workers. runs on the loop thread.
+    int (*on_readable_batch)(tcp_server_read_t* reads, uint32_t count, void* user);
+    // number of event loops, each with its own epoll set and SO_REUSEPORT
+    // listener; 0 or 1 runs a single loop on the calling thread.
+    // callbacks run on the loop thread that owns the connection.
+    uint32_t threads;
+    // when non zero on_readable runs on a pool of this many threads, so a
+    // slow handler only holds up its own connection. one connection's
+    // reads arrive in order, one call at a time, and what the call writes
+    // to that connection goes out from the loop once it returns.
+    uint32_t workers;
+    // how loops wait for events, see tcp_server_poll_t.
+    tcp_server_poll_t poll;
+    // adaptive spin window in microseconds, 0 uses the default (50us).
+    uint32_t spin_us;
+    // events taken per epoll_wait, 0 uses the default (16).
+    uint32_t max_events;
+    // event source driving the loops, see tcp_server_backend_t.
+    tcp_server_backend_t backend;
+    // back connection and buffer pools with 2 MiB pages when non zero,
+    // fewer tlb misses at the price of faulting whole pages in.
+    uint32_t hugepages;
+    // tcp_server_write_ref payloads of at least this many bytes go out
+    // with MSG_ZEROCOPY on the epoll backend, 0 never uses it. closing a
+    // connection while such sends are unconfirmed resets it, the peer
+    // loses what the kernel had not sent yet.
+    uint32_t zerocopy_min;
+    // proxy mode when upstream_port is non zero: every accepted connection
+    // gets its own connection to upstream_host (127.0.0.1 when NULL) and
+    // bytes move both ways with splice, never entering userspace.
+    // on_readable and writes never see proxied connections. epoll only.
+    const char *upstream_host;
+    uint16_t upstream_port;
+    // tcp_server_upstream_acquire: connections open per address and loop,
+    // 0 for no limit, and how long parked ones are kept, 0 for ever.
+    uint32_t upstream_max;
+    uint32_t upstream_idle_ms;
+    // per connection deadlines, 0 for none. reads and writes only note
+    // the time, so keeping them costs nothing per byte.
+    uint32_t idle_timeout_ms;
+    uint32_t read_timeout_ms;
+    uint32_t write_timeout_ms;
+    // cuts reads into messages for on_message, see tcp_server_frame_t.
+    // messages are handed over in place, only the start of one that a
+    // read cut off is kept until the rest arrives. one over frame_max
+    // bytes, 0 uses the default (1 MiB), closes the connection.
+    tcp_server_frame_t framing;
+    uint32_t frame_size;
+    uint32_t frame_max;
+    // 1, 2, 4 or 8 bytes, big endian unless frame_little is set.
+    uint32_t frame_prefix;
+    uint32_t frame_little;
+    // up to 16 bytes, frame_delimiter_len 0 takes its strlen.
+    const char *frame_delimiter;
+    uint32_t frame_delimiter_len;
+    // output watermarks in bytes, a high_watermark of 0 for none. while a
+    // connection's queue holds more than high_watermark its writes return
+    // TCP_SERVER_WRITE_FULL and it isn't read from, until it drains to
+    // low_watermark, which is capped at high_watermark. only bytes held in
+    // memory count, ranges queued by tcp_server_sendfile don't.
+    uint32_t high_watermark;
+    uint32_t low_watermark;
+    // what one event may do on a connection before the loop moves on:
+    // bytes read or written and recv/send calls, 0 uses the defaults
+    // (256k, 16). connections are level triggered, so one cut short is
+    // reported again behind the others already ready. epoll backend.
+    uint32_t event_bytes;
+    uint32_t event_syscalls;
 } tcp_server_attr_t;
 
+typedef struct {
+    uint64_t polls;       // epoll_wait calls
+    uint64_t wakeups;     // waits that slept and returned with events
+    uint64_t empty_polls; // epoll_wait calls that returned nothing
+    uint64_t events;      // events handled
+    uint64_t syscalls;    // syscalls made on the io path
+    uint64_t connections; // connections currently open, closed ones waiting to be freed aside
+    uint64_t pool_chunks; // 2 MiB chunks held by the connection, chunk and buffer pools
+    uint64_t pool_bytes;  // bytes mapped by those chunks
+    uint64_t pool_used;   // bytes handed out from them
+    uint64_t zerocopy;    // sends made with MSG_ZEROCOPY
+    uint64_t zerocopy_copied; // of those, sends the kernel copied anyway
+    uint64_t spliced;     // bytes the proxy moved between sockets
+    uint64_t posted;      // tasks run from tcp_server_post
+    uint64_t post_batches; // drains that ran them, posted / post_batches per wakeup
+    uint64_t post_signals; // eventfd writes made by posters
+    uint64_t post_depth;  // tasks waiting to run right now
+    uint64_t post_batch_max; // largest batch run at once
+    uint64_t offloaded;   // on_readable batches handed to the workers
+    uint64_t timeouts;    // connect, parked, idle, read and write deadlines that passed
+    uint64_t yields;      // events cut short by event_bytes or event_syscalls
+    uint64_t batches;     // on_readable_batch calls
+    uint64_t batched;     // reads they were handed, batched / batches per call
+} tcp_server_stats_t;
+
+
 
 int tcp_server_setup(
     tcp_server_t *server,
@@ -26,6 +198,10 @@ int tcp_server_setup(
     void* user
 );
 
+// queues data for sfd behind anything already pending. blocking waits
+// until the queue drains, except on the loop thread and on a worker
+// writing to its own connection, where it returns at once. this and the
+// other writes return TCP_SERVER_WRITE_FULL past high_watermark.
 int tcp_server_write(
     tcp_server_t *server,
     int sfd,
@@ -34,6 +210,173 @@ int tcp_server_write(
     int blocking
 );
 
+// id of the connection currently behind sfd, 0 when there is none.
+tcp_server_conn_t tcp_server_conn(
+    tcp_server_t *server,
+    int sfd
+);
+
+// like tcp_server_write, but fails instead of writing to whoever
+// holds the fd now if the connection is gone.
+int tcp_server_write_conn(
+    tcp_server_t *server,
+    tcp_server_conn_t conn,
+    void *data,
+    uint32_t len
+);
+
+// gets the memory back from tcp_server_write_ref.
+typedef void (*tcp_server_release_fn)(void *data, uint32_t len, void *user);
+
+// like tcp_server_write, but sends straight from data instead of copying
+// it. the server owns data until release runs, which happens once the
+// kernel is done with it or the connection is gone, on the loop thread
+// or on the calling thread when it all goes out at once. release may be
+// NULL. on failure release is not called and data stays with the caller.
+// an empty write is released at once.
+int tcp_server_write_ref(
+    tcp_server_t *server,
+    int sfd,
+    void *data,
+    uint32_t len,
+    tcp_server_release_fn release,
+    void *user
+);
+
+// reports how an operation on sfd went, error is 0 or an errno value.
+typedef void (*tcp_server_connect_fn)(int sfd, int error, void *user);
+
+// like tcp_server_write, then done runs once data and everything queued
+// before it went to the kernel, with EPIPE if the connection went first.
+// nothing blocks: done runs on the loop thread, or before this returns
+// when it all went out at once. on failure done is not called.
+int tcp_server_write_async(
+    tcp_server_t *server,
+    int sfd,
+    void *data,
+    uint32_t len,
+    tcp_server_connect_fn done,
+    void *user
+);
+
+// streams len bytes of fd from offset with sendfile(2), queued after any
+// pending output and resumed whenever the socket has room. fd must stay
+// open until on_sendfile reports the range done, its file offset is left
+// alone. epoll backend only.
+int tcp_server_sendfile(
+    tcp_server_t *server,
+    int sfd,
+    int fd,
+    int64_t offset,
+    uint64_t len
+);
+
+// opens a connection to host:port without blocking the loop, done hears
+// how it went, with ETIMEDOUT when the timeout passed first; on error sfd
+// is already gone and on_disconnect never hears of it. once it is up it
+// works like an accepted one, on_readable, writes and on_disconnect
+// included; writes made before that are queued. host is a numeric IPv4
+// address, timeout_ms 0 leaves it to the kernel. only callable from a loop
+// thread, which then owns the connection; epoll backend only. returns the
+// new sfd, or -1 in which case done is not called.
+int tcp_server_connect_to(
+    tcp_server_t *server,
+    const char *host,
+    uint16_t port,
+    uint32_t timeout_ms,
+    tcp_server_connect_fn done,
+    void *user
+);
+
+// like tcp_server_connect_to, but reuses a connection the calling loop
+// has parked for host:port, calling done before it returns, and fails
+// once upstream_max connections to it are open.
+int tcp_server_upstream_acquire(
+    tcp_server_t *server,
+    const char *host,
+    uint16_t port,
+    uint32_t timeout_ms,
+    tcp_server_connect_fn done,
+    void *user
+);
+
+// parks an acquired connection for the next acquire. anything it reads
+// while parked, a close included, drops it, as does upstream_idle_ms.
+int tcp_server_upstream_release(
+    tcp_server_t *server,
+    int sfd
+);
+
+typedef void (*tcp_server_task_fn)(void *arg);
+
+// runs fn(arg) later on a loop thread, the caller's own loop when called
+// from one, otherwise the loops take turns. posts are lock free, and a
+// burst of them costs the loop one wakeup. fn must not block. tasks still
+// queued when the server stops run while it tears down.
+int tcp_server_post(
+    tcp_server_t *server,
+    tcp_server_task_fn fn,
+    void *arg
+);
+
+// like tcp_server_post, on the loop that owns sfd, where fn may use the
+// loop-only calls on it.
+int tcp_server_post_conn(
+    tcp_server_t *server,
+    int sfd,
+    tcp_server_task_fn fn,
+    void *arg
+);
+
+// a timer the caller owns, set up by tcp_server_timer_add. it starts
+// zeroed and stays put while armed; the fields are the server's.
+typedef struct {
+    timer_wheel_timer_t node;
+    tcp_server_task_fn fn;
+    void *arg;
+} tcp_server_timer_t;
+
+// runs fn(arg) on the calling loop once delay_ms passed, moving timer
+// if it is armed already. no allocation and no syscall, so it is fine
+// to push a timer back on every read. only callable from a loop thread,
+// tcp_server_post_conn gets there from elsewhere; the timer belongs to
+// that loop until it ran or was cancelled.
+int tcp_server_timer_add(
+    tcp_server_t *server,
+    tcp_server_timer_t *timer,
+    uint32_t delay_ms,
+    tcp_server_task_fn fn,
+    void *arg
+);
+
+// from the loop that armed timer, 0 when it was armed and won't run now.
+int tcp_server_timer_cancel(
+    tcp_server_t *server,
+    tcp_server_timer_t *timer
+);
+
+// stops reading from sfd while paused is non zero and starts again once
+// it is 0, so a pipeline can hold its source back while the sink is full.
+// apart from the pause high_watermark makes. only callable from the loop
+// that owns sfd.
+int tcp_server_pause(
+    tcp_server_t *server,
+    int sfd,
+    int paused
+);
+
+// closes sfd from any thread, on_disconnect runs on its loop.
+int tcp_server_close(
+    tcp_server_t *server,
+    int sfd
+);
+
+// sums the counters of every loop, safe to call from any thread.
+int tcp_server_stats(
+    tcp_server_t *server,
+    tcp_server_stats_t *stats
+);
+
 int tcp_server_shutdown(
     tcp_server_t *server
 );
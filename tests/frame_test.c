@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "test_server.h"
+
+// usage: frame-test
+//
+// delimiter framing with a small frame_max, on both backends. a frame that
+// goes over frame_max once a read cut it off, "abc" and then a run with no
+// delimiter in it, must close the connection and nothing else, while
+// frames within the limit are echoed back.
+
+static int test_on_message(int sfd, void *data, uint32_t len, void *user) {
+    tcp_server_write((tcp_server_t *)user, sfd, data, len, 0);
+    tcp_server_write((tcp_server_t *)user, sfd, "\n", 1, 0);
+    return 0;
+}
+
+static int test_run(tcp_server_backend_t backend) {
+    const char *name = test_backend_name(backend);
+    tcp_server_attr_t attrs;
+    char buf[64], big[40];
+    int fd, failed = 0;
+    memset(&attrs, 0, sizeof(attrs));
+    attrs.on_message      = test_on_message;
+    attrs.backend         = backend;
+    attrs.framing         = TCP_SERVER_FRAME_DELIMITER;
+    attrs.frame_delimiter = "\r\n";
+    attrs.frame_max       = 16;
+    test_server_start(&attrs);
+    //
+    // within the limit, split across reads.
+    fd = test_connect();
+    send(fd, "hel", 3, 0);
+    usleep(50000);
+    send(fd, "lo\r\n", 4, 0);
+    if(test_read(fd, buf, 6) != 6 || memcmp(buf, "hello\n", 6) != 0) {
+        printf("%s: split frame not echoed\n", name);
+        failed = 1;
+    }
+    close(fd);
+    // a cut off start, then more than frame_max with no end in sight.
+    fd = test_connect();
+    send(fd, "abc", 3, 0);
+    usleep(50000);
+    memset(big, 'x', sizeof(big));
+    send(fd, big, sizeof(big), 0);
+    if(!test_closed(fd)) {
+        printf("%s: oversized split frame kept the connection\n", name);
+        failed = 1;
+    }
+    close(fd);
+    // the server is still there for others.
+    fd = test_connect();
+    send(fd, "ok\r\n", 4, 0);
+    if(test_read(fd, buf, 3) != 3 || memcmp(buf, "ok\n", 3) != 0) {
+        printf("%s: server gone after an oversized frame\n", name);
+        failed = 1;
+    }
+    close(fd);
+    //
+    test_server_stop();
+    printf("%s: %s\n", name, failed ? "FAILED" : "ok");
+    return failed;
+}
+
+int main(void) {
+    int failed = 0;
+    failed |= test_run(TCP_SERVER_BACKEND_EPOLL);
+    failed |= test_run(TCP_SERVER_BACKEND_IO_URING);
+    return failed;
+}
@@ -0,0 +1,134 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../hashmap.h"
+#include "../bench/chained_map.h"
+
+// usage: hashmap-test
+//
+// random adds, replaces, deletes and lookups on hash_map checked against
+// the chained map after every step. the map starts small and rounds swing
+// between growing and shrinking, so deletes keep landing on both tables
+// while a resize is being drained, next to slots already moved.
+
+#define TEST_KEYS 24000
+#define TEST_ROUNDS 12
+#define TEST_STEPS 40000
+
+static uint32_t seed = 2463534242u;
+
+static uint32_t test_random(void) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+typedef struct {
+    chained_map_t *reference;
+    uint32_t seen;
+    int failed;
+} test_walk;
+
+static int test_visit(uint64_t key, void *value, void *user) {
+    test_walk *walk = (test_walk *)user;
+    walk->seen += 1;
+    if(key > UINT32_MAX || chained_map_get(walk->reference, (uint32_t)key) != value) {
+        walk->failed = 1;
+    }
+    return 0;
+}
+
+// every key in the universe agrees, and foreach sees exactly what is there.
+static int test_check(hash_map_t *map, chained_map_t *reference, uint32_t *keys, uint32_t size) {
+    uint32_t i;
+    for(i = 0; i < TEST_KEYS; i++) {
+        if(hash_map_get(map, keys[i]) != chained_map_get(reference, keys[i])) {
+            printf("key %u: lookup disagrees\n", keys[i]);
+            return 1;
+        }
+    }
+    if(hash_map_size(map) != size) {
+        printf("size %u, want %u\n", hash_map_size(map), size);
+        return 1;
+    }
+    test_walk walk = {reference, 0, 0};
+    (void) hash_map_foreach(map, test_visit, &walk);
+    if(walk.failed || walk.seen != size) {
+        printf("foreach saw %u, want %u%s\n", walk.seen, size, walk.failed ? ", some wrong" : "");
+        return 1;
+    }
+    return 0;
+}
+
+int main(void) {
+    hash_map_t map;
+    chained_map_t reference;
+    (void) hash_map_init(&map, 16);
+    (void) chained_map_init(&reference, 1024);
+    // half of the keys run in sequence and cluster, the rest are spread.
+    uint32_t *keys = malloc(sizeof(uint32_t) * TEST_KEYS);
+    uint32_t i, round, step, size = 0;
+    for(i = 0; i < TEST_KEYS; i++) {
+        keys[i] = i % 2 ? test_random() | 1 : 1000000 + i;
+    }
+    //
+    int failed = 0;
+    for(round = 0; round < TEST_ROUNDS && !failed; round++) {
+        // even rounds mostly add, odd ones mostly delete.
+        uint32_t adds = round % 2 ? 30 : 70;
+        for(step = 0; step < TEST_STEPS && !failed; step++) {
+            uint32_t key = keys[test_random() % TEST_KEYS], op = test_random() % 100;
+            void *want = chained_map_get(&reference, key), *got;
+            if(op < adds) {
+                void *value = (void *)(uintptr_t)(((uint64_t)test_random() << 1) | 1);
+                (void) hash_map_add(&map, key, value);
+                if(want) {
+                    (void) chained_map_del(&reference, key);
+                } else {
+                    size += 1;
+                }
+                (void) chained_map_add(&reference, key, value);
+            } else if(op < 95) {
+                got = hash_map_del(&map, key);
+                (void) chained_map_del(&reference, key);
+                size -= want != NULL;
+                if(got != want) {
+                    printf("round %u step %u: del %u returned the wrong value\n", round, step, key);
+                    failed = 1;
+                }
+            } else if(hash_map_get(&map, key) != want) {
+                printf("round %u step %u: get %u returned the wrong value\n", round, step, key);
+                failed = 1;
+            }
+            if(!failed && step % 4000 == 0) {
+                failed = test_check(&map, &reference, keys, size);
+            }
+        }
+        if(!failed) {
+            failed = test_check(&map, &reference, keys, size);
+        }
+    }
+    // emptied out, maybe halfway through a drain, the map is as good as new.
+    if(!failed) {
+        (void) hash_map_clear(&map);
+        for(i = 0; i < TEST_KEYS; i++) {
+            (void) chained_map_del(&reference, keys[i]);
+        }
+        failed = test_check(&map, &reference, keys, 0);
+    }
+    for(i = 0; i < TEST_KEYS && !failed; i += 2) {
+        (void) hash_map_add(&map, keys[i], &keys[i]);
+        (void) chained_map_add(&reference, keys[i], &keys[i]);
+    }
+    if(!failed) {
+        failed = test_check(&map, &reference, keys, TEST_KEYS / 2);
+    }
+    //
+    (void) hash_map_free(&map);
+    (void) chained_map_free(&reference);
+    free(keys);
+    printf("hash_map: %s\n", failed ? "FAILED" : "ok");
+    return failed;
+}
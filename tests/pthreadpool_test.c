@@ -0,0 +1,214 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../pthreadpool.h"
+
+// usage: pthreadpool-test
+//
+// every task must run exactly once, whichever way it got in and whoever
+// took it. a tree of tasks spawned from the workers races owners taking
+// from their deques against thieves stealing from them, with batches
+// bigger than a deque holds; futures and parallel_for are checked on the
+// same pool. then an elastic pool is grown by slow bursts, left idle until
+// its extra workers retire, and grown again, a few times over.
+
+#define TEST_FANOUT 4
+#define TEST_DEPTH 7
+#define TEST_BATCH 300
+#define TEST_RANGE 1000000
+
+static pthread_pool_t pool;
+static pthread_pool_group_t group;
+static uint32_t *ran;
+static uint32_t nodes = 0;
+static uint32_t done = 0;
+
+// node n of the tree has children n * TEST_FANOUT + 1 onwards.
+static void* test_node(void *arg) {
+    uint32_t node = (uint32_t)(uintptr_t)arg, i;
+    __atomic_add_fetch(&ran[node], 1, __ATOMIC_RELAXED);
+    for(i = 1; i <= TEST_FANOUT; i++) {
+        uint64_t child = (uint64_t)node * TEST_FANOUT + i;
+        if(child < nodes) {
+            (void) pthread_pool_group_spawn(&pool, &group, test_node, (void *)(uintptr_t)child);
+        }
+    }
+    return NULL;
+}
+
+static void* test_leaf(void *arg) {
+    __atomic_add_fetch(&ran[(uint32_t)(uintptr_t)arg], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// more at once than a worker's deque holds.
+static void* test_batch(void *arg) {
+    uint32_t base = (uint32_t)(uintptr_t)arg, i;
+    void *args[TEST_BATCH];
+    for(i = 0; i < TEST_BATCH; i++) {
+        args[i] = (void *)(uintptr_t)(base + i);
+    }
+    (void) pthread_pool_spawn_batch(&pool, test_leaf, args, TEST_BATCH);
+    return NULL;
+}
+
+static void* test_square(void *arg) {
+    uintptr_t value = (uintptr_t)arg;
+    return (void *)(value * value);
+}
+
+// a future waited on inside the pool, the waiter runs tasks meanwhile.
+static void* test_nested(void *arg) {
+    pthread_pool_future_t future;
+    void *result = NULL;
+    memset(&future, 0, sizeof(future));
+    (void) pthread_pool_submit(&pool, &future, test_square, arg);
+    (void) pthread_pool_future_wait(&pool, &future, &result);
+    return (void *)((uintptr_t)result + 1);
+}
+
+static void test_range(uint64_t begin, uint64_t end, void *user) {
+    uint8_t *seen = (uint8_t *)user;
+    for(; begin < end; begin++) {
+        __atomic_add_fetch(&seen[begin], 1, __ATOMIC_RELAXED);
+    }
+}
+
+static int test_once(uint32_t count, const char *what) {
+    uint32_t i;
+    for(i = 0; i < count; i++) {
+        if(__atomic_load_n(&ran[i], __ATOMIC_RELAXED) != 1) {
+            printf("%s: task %u ran %u times\n", what, i, ran[i]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int test_work_stealing(void) {
+    uint32_t i, depth, width = 1;
+    int failed = 0;
+    for(depth = 0; depth < TEST_DEPTH; depth++) {
+        nodes += width;
+        width *= TEST_FANOUT;
+    }
+    ran = calloc(nodes + TEST_BATCH * 64, sizeof(uint32_t));
+    (void) pthread_pool_init(&pool, 4);
+    //
+    memset(&group, 0, sizeof(group));
+    (void) pthread_pool_group_spawn(&pool, &group, test_node, (void *)(uintptr_t)0);
+    (void) pthread_pool_group_wait(&pool, &group);
+    failed |= test_once(nodes, "tree");
+    //
+    memset(ran, 0, sizeof(uint32_t) * TEST_BATCH * 64);
+    memset(&group, 0, sizeof(group));
+    done = 0;
+    for(i = 0; i < 64; i++) {
+        (void) pthread_pool_group_spawn(&pool, &group, test_batch, (void *)(uintptr_t)(i * TEST_BATCH));
+    }
+    (void) pthread_pool_group_wait(&pool, &group);
+    // the batches were spawned, not joined, wait for them to drain.
+    for(i = 0; i < 5000 && __atomic_load_n(&done, __ATOMIC_ACQUIRE) < TEST_BATCH * 64; i++) {
+        usleep(1000);
+    }
+    // a task run twice would show up meanwhile.
+    usleep(10000);
+    failed |= test_once(TEST_BATCH * 64, "batch");
+    //
+    pthread_pool_future_t futures[256];
+    void *result;
+    memset(futures, 0, sizeof(futures));
+    for(i = 0; i < 256; i++) {
+        (void) pthread_pool_submit(&pool, &futures[i], test_nested, (void *)(uintptr_t)i);
+    }
+    for(i = 0; i < 256; i++) {
+        (void) pthread_pool_future_wait(&pool, &futures[i], &result);
+        if((uintptr_t)result != (uintptr_t)i * i + 1) {
+            printf("future %u returned %lu\n", i, (unsigned long)(uintptr_t)result);
+            failed = 1;
+            break;
+        }
+    }
+    //
+    uint8_t *seen = calloc(TEST_RANGE, 1);
+    (void) pthread_pool_parallel_for(&pool, 0, TEST_RANGE, 64, test_range, seen);
+    for(i = 0; i < TEST_RANGE; i++) {
+        if(seen[i] != 1) {
+            printf("parallel_for: index %u covered %u times\n", i, seen[i]);
+            failed = 1;
+            break;
+        }
+    }
+    free(seen);
+    //
+    (void) pthread_pool_destroy(&pool);
+    free(ran);
+    printf("work stealing: %s\n", failed ? "FAILED" : "ok");
+    return failed;
+}
+
+static void* test_slow(void *arg) {
+    usleep(5000);
+    return test_leaf(arg);
+}
+
+static int test_elastic(void) {
+    pthread_pool_attr_t attr;
+    pthread_pool_stats_t stats;
+    uint64_t grown = 0, retired = 0;
+    uint32_t cycle, i, count = 48;
+    int failed = 0;
+    memset(&attr, 0, sizeof(attr));
+    attr.min_threads     = 1;
+    attr.max_threads     = 6;
+    attr.grow_after_us   = 200;
+    attr.idle_timeout_ms = 50;
+    (void) pthread_pool_init_attr(&pool, &attr);
+    ran = calloc(count, sizeof(uint32_t));
+    //
+    for(cycle = 0; cycle < 3 && !failed; cycle++) {
+        memset(ran, 0, sizeof(uint32_t) * count);
+        memset(&group, 0, sizeof(group));
+        for(i = 0; i < count; i++) {
+            (void) pthread_pool_group_spawn(&pool, &group, test_slow, (void *)(uintptr_t)i);
+        }
+        (void) pthread_pool_group_wait(&pool, &group);
+        failed |= test_once(count, "elastic");
+        (void) pthread_pool_stats(&pool, &stats);
+        if(stats.grown <= grown) {
+            printf("cycle %u: a slow burst added no workers\n", cycle);
+            failed = 1;
+        }
+        grown = stats.grown;
+        // parked past idle_timeout_ms, the extra workers go.
+        for(i = 0; i < 200; i++) {
+            usleep(10000);
+            (void) pthread_pool_stats(&pool, &stats);
+            if(stats.threads == attr.min_threads) {
+                break;
+            }
+        }
+        if(stats.threads != attr.min_threads || stats.retired <= retired) {
+            printf("cycle %u: %u workers left after idling, want %u\n", cycle, stats.threads, attr.min_threads);
+            failed = 1;
+        }
+        retired = stats.retired;
+    }
+    //
+    (void) pthread_pool_destroy(&pool);
+    free(ran);
+    printf("elastic: %s\n", failed ? "FAILED" : "ok");
+    return failed;
+}
+
+int main(void) {
+    int failed = 0;
+    failed |= test_work_stealing();
+    failed |= test_elastic();
+    return failed;
+}
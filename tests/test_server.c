@@ -0,0 +1,77 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "test_server.h"
+
+tcp_server_t test_server;
+
+static tcp_server_attr_t test_attrs;
+static uint16_t test_port = 0;
+static pthread_t test_thread;
+
+static void* test_server_run(void *arg) {
+    (void)arg;
+    tcp_server_setup(&test_server, test_port, &test_attrs, &test_server);
+    return NULL;
+}
+
+int test_server_start(tcp_server_attr_t *attrs) {
+    // tests running side by side start from different ports.
+    if(test_port == 0) {
+        test_port = (uint16_t)(20000 + (getpid() % 1000) * 20);
+    }
+    test_attrs = *attrs;
+    return pthread_create(&test_thread, NULL, test_server_run, NULL) == 0 ? 0 : -1;
+}
+
+int test_server_stop(void) {
+    tcp_server_shutdown(&test_server);
+    pthread_join(test_thread, NULL);
+    test_port += 1;
+    return 0;
+}
+
+const char* test_backend_name(tcp_server_backend_t backend) {
+    return backend == TCP_SERVER_BACKEND_IO_URING ? "io_uring" : "epoll";
+}
+
+int test_connect(void) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(test_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    //
+    struct timeval timeout = {5, 0};
+    int retry;
+    for(retry = 0; retry < 200; retry++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            return fd;
+        }
+        close(fd);
+        usleep(10000);
+    }
+    return -1;
+}
+
+int test_read(int fd, char *buf, int want) {
+    int got = 0, count;
+    while(got < want && (count = (int)recv(fd, buf + got, want - got, 0)) > 0) {
+        got += count;
+    }
+    return got;
+}
+
+int test_closed(int fd) {
+    char byte;
+    ssize_t count = recv(fd, &byte, 1, 0);
+    return count == 0 || (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+}
@@ -0,0 +1,27 @@
+#ifndef TEST_SERVER_H
+#define TEST_SERVER_H
+
+#include "../tcpserver.h"
+
+// a server on its own thread for tests that talk to it over loopback.
+// every run gets a port the runs before it didn't use, callbacks get the
+// server as their user.
+
+extern tcp_server_t test_server;
+
+int test_server_start(tcp_server_attr_t *attrs);
+
+int test_server_stop(void);
+
+const char* test_backend_name(tcp_server_backend_t backend);
+
+// a blocking socket to the running server, reads on it time out after 5s.
+int test_connect(void);
+
+// reads until want bytes are in or the peer is gone, how many came.
+int test_read(int fd, char *buf, int want);
+
+// 1 once the server closed fd, 0 when it kept it open past the timeout.
+int test_closed(int fd);
+
+#endif // TEST_SERVER_H
@@ -0,0 +1,185 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../timerwheel.h"
+
+// usage: timerwheel-test
+//
+// arms, moves and cancels timers at random distances, from already passed
+// to far past what the top level reaches, and advances the wheel by steps
+// both short and long. every advance is checked against a plain list of
+// due ticks: each timer fires in the first advance that reaches its tick,
+// never before, exactly once, and timer_wheel_next never overshoots the
+// earliest one. some timers arm themselves again from their fn.
+
+#define TEST_TIMERS 1024
+#define TEST_STEPS 30000
+
+typedef struct {
+    timer_wheel_timer_t timer;
+    uint64_t expires;
+    // the tick it fires by, the one after now when armed for a passed one.
+    uint64_t due;
+    int armed;
+    int rearm;
+} test_timer;
+
+static test_timer timers[TEST_TIMERS];
+static timer_wheel_t wheel;
+static uint64_t now = 1000, target = 1000;
+static uint64_t seed = 88172645463325252ull;
+static uint32_t armed = 0, fired = 0;
+static int failed = 0;
+
+static uint64_t test_random(void) {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+// distances that land on every level, the clamp past the top and the past.
+static uint64_t test_distance(void) {
+    switch(test_random() % 8) {
+    case 0:
+        return 0;
+    case 1:
+        return test_random() % 64;
+    case 2:
+        return test_random() % 4096;
+    case 3:
+        return test_random() % (1ull << 18);
+    case 4:
+        return test_random() % (1ull << 30);
+    case 5:
+        return (1ull << 36) + test_random() % (1ull << 38);
+    default:
+        return 1 + test_random() % 200;
+    }
+}
+
+static void test_arm(test_timer *entry, uint64_t expires);
+
+static void test_fire(timer_wheel_timer_t *timer) {
+    test_timer *entry = (test_timer *)timer;
+    if(!entry->armed) {
+        printf("timer %ld fired while not armed\n", (long)(entry - timers));
+        failed = 1;
+        return;
+    }
+    if(entry->due > target) {
+        printf("timer %ld due at %lu fired early, advancing to %lu\n", (long)(entry - timers),
+               (unsigned long)entry->due, (unsigned long)target);
+        failed = 1;
+    }
+    if(timer_wheel_pending(timer)) {
+        printf("timer %ld still armed inside its fn\n", (long)(entry - timers));
+        failed = 1;
+    }
+    entry->armed = 0;
+    armed  -= 1;
+    fired  += 1;
+    if(entry->rearm) {
+        test_arm(entry, target + 1 + test_distance());
+    }
+}
+
+static void test_arm(test_timer *entry, uint64_t expires) {
+    if(!entry->armed) {
+        armed += 1;
+    }
+    entry->armed   = 1;
+    entry->expires = expires;
+    entry->due     = expires > now ? expires : now + 1;
+    entry->rearm   = test_random() % 4 == 0;
+    (void) timer_wheel_add(&wheel, &entry->timer, expires, test_fire);
+}
+
+// nothing due by now is left, and next is no later than the earliest tick.
+static void test_check(void) {
+    uint64_t earliest = UINT64_MAX;
+    uint32_t i;
+    for(i = 0; i < TEST_TIMERS; i++) {
+        if(!timers[i].armed) {
+            continue;
+        }
+        if(timers[i].due <= now) {
+            printf("timer %u due at %lu missed, now %lu\n", i,
+                   (unsigned long)timers[i].due, (unsigned long)now);
+            failed = 1;
+        }
+        if(timers[i].due < earliest) {
+            earliest = timers[i].due;
+        }
+    }
+    if(timer_wheel_next(&wheel) > earliest) {
+        printf("next %lu is past the earliest %lu\n", (unsigned long)timer_wheel_next(&wheel), (unsigned long)earliest);
+        failed = 1;
+    }
+    if(timer_wheel_size(&wheel) != armed) {
+        printf("size %u, want %u\n", timer_wheel_size(&wheel), armed);
+        failed = 1;
+    }
+}
+
+int main(void) {
+    uint32_t step, i;
+    memset(timers, 0, sizeof(timers));
+    (void) timer_wheel_init(&wheel, now);
+    //
+    for(step = 0; step < TEST_STEPS && !failed; step++) {
+        test_timer *entry = &timers[test_random() % TEST_TIMERS];
+        uint64_t op = test_random() % 10;
+        if(op < 5) {
+            // arming again moves it, ticks already passed fire next time.
+            uint64_t distance = test_distance();
+            test_arm(entry, op == 0 && now > distance ? now - distance : now + distance);
+        } else if(op < 7) {
+            int was = timer_wheel_del(&wheel, &entry->timer) == 0;
+            if(was != entry->armed) {
+                printf("del of timer %ld said %d, want %d\n", (long)(entry - timers), was, entry->armed);
+                failed = 1;
+            }
+            armed -= entry->armed;
+            entry->armed = 0;
+        } else {
+            // mostly short steps, now and then halfway or straight to a
+            // timer far out.
+            if(op == 9 && entry->armed) {
+                target = entry->due;
+            } else if(op == 8 && entry->armed) {
+                target = now + (entry->due - now) / 2;
+            } else {
+                target = now + test_distance();
+            }
+            uint32_t before = fired;
+            uint32_t count = timer_wheel_advance(&wheel, target);
+            now = target;
+            if(count != fired - before) {
+                printf("advance said %u fired, saw %u\n", count, fired - before);
+                failed = 1;
+            }
+            test_check();
+        }
+    }
+    // run everything left out, the clamped ones come round eventually.
+    for(i = 0; i < TEST_TIMERS; i++) {
+        timers[i].rearm = 0;
+    }
+    for(step = 0; step < TEST_STEPS && armed > 0 && !failed; step++) {
+        target = timer_wheel_next(&wheel);
+        (void) timer_wheel_advance(&wheel, target);
+        now = target;
+        test_check();
+    }
+    if(!failed && armed > 0) {
+        printf("%u timers never fired\n", armed);
+        failed = 1;
+    }
+    //
+    (void) timer_wheel_free(&wheel);
+    printf("timer_wheel: %s\n", failed ? "FAILED" : "ok");
+    return failed;
+}
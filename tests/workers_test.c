@@ -0,0 +1,112 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "test_server.h"
+
+// usage: workers-test
+//
+// on_readable on the workers echoes what it is handed, now and then after
+// a short sleep so batches of different connections finish out of order.
+// several connections stream numbered tokens in reads of random size at
+// once, on both backends, and each must get its own stream back whole
+// and in order.
+
+#define TEST_CONNECTIONS 8
+#define TEST_TOKENS 20000
+#define TEST_WINDOW 32768
+
+static int test_on_readable(int sfd, void *data, uint32_t len, void *user) {
+    if(len % 7 == 0) {
+        usleep(200);
+    }
+    tcp_server_write((tcp_server_t *)user, sfd, data, len, 0);
+    return 0;
+}
+
+typedef struct {
+    uint32_t id;
+    int failed;
+} test_stream;
+
+static void* test_client(void *arg) {
+    test_stream *stream = (test_stream *)arg;
+    uint32_t seed = 2463534242u + stream->id, k;
+    char *data = malloc(TEST_TOKENS * 16), *back = malloc(TEST_TOKENS * 16);
+    int total = 0, sent = 0, got = 0, count, size;
+    for(k = 0; k < TEST_TOKENS; k++) {
+        total += sprintf(data + total, "%u:%u;", stream->id, k);
+    }
+    //
+    int fd = test_connect();
+    while(got < total && fd >= 0) {
+        if(sent < total && sent - got < TEST_WINDOW) {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            size = 1 + (int)(seed % 3000);
+            size = size < total - sent ? size : total - sent;
+            if(send(fd, data + sent, size, 0) != size) {
+                break;
+            }
+            sent += size;
+        }
+        // read what is there, or wait for it once the window is full.
+        int flags = sent == total || sent - got >= TEST_WINDOW ? 0 : MSG_DONTWAIT;
+        count = (int)recv(fd, back + got, total - got, flags);
+        if(count == 0 || (count < 0 && flags == 0)) {
+            break;
+        }
+        got += count > 0 ? count : 0;
+    }
+    if(got != total || memcmp(data, back, total) != 0) {
+        printf("connection %u: got %d of %d bytes%s\n", stream->id, got, total,
+               got == total ? ", out of order" : "");
+        stream->failed = 1;
+    }
+    if(fd >= 0) {
+        close(fd);
+    }
+    free(data);
+    free(back);
+    return NULL;
+}
+
+static int test_run(tcp_server_backend_t backend) {
+    const char *name = test_backend_name(backend);
+    tcp_server_attr_t attrs;
+    pthread_t threads[TEST_CONNECTIONS];
+    test_stream streams[TEST_CONNECTIONS];
+    uint32_t i;
+    int failed = 0;
+    memset(&attrs, 0, sizeof(attrs));
+    attrs.on_readable = test_on_readable;
+    attrs.backend     = backend;
+    attrs.threads     = 2;
+    attrs.workers     = 4;
+    test_server_start(&attrs);
+    //
+    for(i = 0; i < TEST_CONNECTIONS; i++) {
+        streams[i].id     = i;
+        streams[i].failed = 0;
+        pthread_create(&threads[i], NULL, test_client, &streams[i]);
+    }
+    for(i = 0; i < TEST_CONNECTIONS; i++) {
+        pthread_join(threads[i], NULL);
+        failed |= streams[i].failed;
+    }
+    //
+    test_server_stop();
+    printf("%s: %s\n", name, failed ? "FAILED" : "ok");
+    return failed;
+}
+
+int main(void) {
+    int failed = 0;
+    failed |= test_run(TCP_SERVER_BACKEND_EPOLL);
+    failed |= test_run(TCP_SERVER_BACKEND_IO_URING);
+    return failed;
+}
@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "test_server.h"
+
+// usage: write-ref-test
+//
+// an empty tcp_server_write_ref ahead of every reply, on both backends.
+// it must hand the memory straight back and leave the connection alone,
+// the replies after it still arrive and the connection stays open.
+
+static uint32_t released = 0;
+
+static void test_release(void *data, uint32_t len, void *user) {
+    (void)data;
+    (void)len;
+    (void)user;
+    __atomic_add_fetch(&released, 1, __ATOMIC_RELAXED);
+}
+
+static int test_on_readable(int sfd, void *data, uint32_t len, void *user) {
+    (void)data;
+    (void)len;
+    static char empty[1];
+    tcp_server_write_ref((tcp_server_t *)user, sfd, empty, 0, test_release, NULL);
+    tcp_server_write((tcp_server_t *)user, sfd, "ok", 2, 0);
+    return 0;
+}
+
+static int test_run(tcp_server_backend_t backend) {
+    const char *name = test_backend_name(backend);
+    tcp_server_attr_t attrs;
+    char buf[8];
+    int fd, round, failed = 0;
+    memset(&attrs, 0, sizeof(attrs));
+    attrs.on_readable = test_on_readable;
+    attrs.backend     = backend;
+    released = 0;
+    test_server_start(&attrs);
+    //
+    fd = test_connect();
+    for(round = 0; round < 3 && !failed; round++) {
+        send(fd, "hi", 2, 0);
+        if(test_read(fd, buf, 2) != 2 || memcmp(buf, "ok", 2) != 0) {
+            printf("%s: no reply after an empty write_ref, round %d\n", name, round);
+            failed = 1;
+        }
+    }
+    close(fd);
+    if(!failed && __atomic_load_n(&released, __ATOMIC_RELAXED) != 3) {
+        printf("%s: %u empty writes released, want 3\n", name, released);
+        failed = 1;
+    }
+    //
+    test_server_stop();
+    printf("%s: %s\n", name, failed ? "FAILED" : "ok");
+    return failed;
+}
+
+int main(void) {
+    int failed = 0;
+    failed |= test_run(TCP_SERVER_BACKEND_EPOLL);
+    failed |= test_run(TCP_SERVER_BACKEND_IO_URING);
+    return failed;
+}
@@ -0,0 +1,237 @@
+#include "timerwheel.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// TIMER_WHEEL_LEVELS wheels of 64 slots. a timer due in [64^l, 64^(l+1))
+// ticks sits on level l, in the slot its due tick maps to there. when the
+// wheel reaches the start of a level's slot that slot is cascaded, its
+// timers go down to where they now belong, so each one moves at most
+// once per level before it fires from level 0. a bit per non empty slot
+// lets next find the earliest one without walking the slots, and advance
+// skip straight to it. timers further out than the top level reaches wait
+// in its farthest slot and are placed again when that comes round.
+
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1u << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS 6
+// the farthest a timer can be placed, 2^36 ticks is over two years of ms.
+#define TIMER_WHEEL_SPAN (1ull << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+typedef struct {
+    timer_wheel_timer_t *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    uint64_t used[TIMER_WHEEL_LEVELS];
+    // every timer due up to now has fired.
+    uint64_t now;
+    uint32_t size;
+} timer_wheel_private;
+
+
+uint32_t timer_wheel_level(uint64_t delta) {
+    if(delta < TIMER_WHEEL_SLOTS) {
+        return 0;
+    }
+    uint32_t level = (63 - __builtin_clzll(delta)) / TIMER_WHEEL_BITS;
+    return level < TIMER_WHEEL_LEVELS ? level : TIMER_WHEEL_LEVELS - 1;
+}
+
+// at is never before now, and only equal to it while cascading.
+void timer_wheel_link(timer_wheel_private *private, timer_wheel_timer_t *timer, uint64_t at) {
+    if(at - private->now >= TIMER_WHEEL_SPAN) {
+        at = private->now + TIMER_WHEEL_SPAN - 1;
+    }
+    uint32_t level = timer_wheel_level(at - private->now);
+    uint32_t index = (uint32_t)(at >> (level * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK;
+    timer_wheel_timer_t **head = &private->slots[level][index];
+    //
+    timer->slot = level * TIMER_WHEEL_SLOTS + index;
+    timer->next = *head;
+    if(*head) {
+        (*head)->link = &timer->next;
+    }
+    timer->link = head;
+    *head = timer;
+    private->used[level] |= 1ull << index;
+}
+
+void timer_wheel_unlink(timer_wheel_private *private, timer_wheel_timer_t *timer) {
+    uint32_t level = timer->slot / TIMER_WHEEL_SLOTS;
+    uint32_t index = timer->slot % TIMER_WHEEL_SLOTS;
+    //
+    *timer->link = timer->next;
+    if(timer->next) {
+        timer->next->link = timer->link;
+    }
+    if(private->slots[level][index] == NULL) {
+        private->used[level] &= ~(1ull << index);
+    }
+    timer->next = NULL;
+    timer->link = NULL;
+}
+
+uint64_t timer_wheel_rotate(uint64_t bits, uint32_t count) {
+    return count == 0 ? bits : (bits >> count) | (bits << (64 - count));
+}
+
+uint64_t timer_wheel_earliest(timer_wheel_private *private) {
+    uint64_t best = UINT64_MAX, block, at;
+    uint32_t level, shift, current, distance;
+    for(level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        if(private->used[level] == 0) {
+            continue;
+        }
+        // the first used slot after the current one; the current one
+        // itself only holds timers a full turn ahead.
+        shift    = level * TIMER_WHEEL_BITS;
+        block    = private->now >> shift;
+        current  = (uint32_t)block & TIMER_WHEEL_MASK;
+        distance = __builtin_ctzll(timer_wheel_rotate(private->used[level], (current + 1) & TIMER_WHEEL_MASK)) + 1;
+        at = (block + distance) << shift;
+        if(at < best) {
+            best = at;
+        }
+    }
+    //
+    return best;
+}
+
+// spreads a slot of a higher level over the ones below.
+void timer_wheel_cascade(timer_wheel_private *private, uint32_t level, uint32_t index) {
+    timer_wheel_timer_t *timer = private->slots[level][index], *next;
+    private->slots[level][index] = NULL;
+    private->used[level] &= ~(1ull << index);
+    for(; timer; timer = next) {
+        next = timer->next;
+        timer_wheel_link(private, timer, timer->expires < private->now ? private->now : timer->expires);
+    }
+}
+
+uint32_t timer_wheel_tick(timer_wheel_private *private) {
+    uint64_t now = private->now;
+    uint32_t level, fired = 0;
+    for(level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        if(now & ((1ull << (level * TIMER_WHEEL_BITS)) - 1)) {
+            break;
+        }
+        timer_wheel_cascade(private, level, (uint32_t)(now >> (level * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK);
+    }
+    // fn may add to or take from this very slot, so pop one at a time.
+    timer_wheel_timer_t *timer, **head = &private->slots[0][now & TIMER_WHEEL_MASK];
+    while((timer = *head) != NULL) {
+        timer_wheel_unlink(private, timer);
+        // parked in the top level for lack of reach.
+        if(timer->expires > now) {
+            timer_wheel_link(private, timer, timer->expires);
+            continue;
+        }
+        private->size -= 1;
+        fired += 1;
+        timer->fn(timer);
+    }
+    //
+    return fired;
+}
+
+int timer_wheel_init(timer_wheel_t *wheel, uint64_t now) {
+    assert(wheel);
+    //
+    timer_wheel_private *private = (timer_wheel_private *)malloc(sizeof(timer_wheel_private));
+    if(private == NULL) {
+        return -1;
+    }
+    memset(private, 0, sizeof(timer_wheel_private));
+    private->now = now;
+    //
+    wheel->priv = private;
+    //
+    return 0;
+}
+
+int timer_wheel_add(timer_wheel_t *wheel, timer_wheel_timer_t *timer, uint64_t expires, timer_wheel_fn fn) {
+    assert(wheel);
+    assert(timer);
+    assert(fn);
+    timer_wheel_private *private = (timer_wheel_private *)wheel->priv;
+    assert(private);
+    //
+    if(timer->link) {
+        timer_wheel_unlink(private, timer);
+    } else {
+        private->size += 1;
+    }
+    timer->expires = expires;
+    timer->fn      = fn;
+    timer_wheel_link(private, timer, expires > private->now ? expires : private->now + 1);
+    //
+    return 0;
+}
+
+int timer_wheel_del(timer_wheel_t *wheel, timer_wheel_timer_t *timer) {
+    assert(wheel);
+    assert(timer);
+    timer_wheel_private *private = (timer_wheel_private *)wheel->priv;
+    assert(private);
+    //
+    if(timer->link == NULL) {
+        return -1;
+    }
+    timer_wheel_unlink(private, timer);
+    private->size -= 1;
+    //
+    return 0;
+}
+
+int timer_wheel_pending(timer_wheel_timer_t *timer) {
+    assert(timer);
+    //
+    return timer->link != NULL;
+}
+
+uint32_t timer_wheel_advance(timer_wheel_t *wheel, uint64_t now) {
+    assert(wheel);
+    timer_wheel_private *private = (timer_wheel_private *)wheel->priv;
+    assert(private);
+    //
+    uint64_t next;
+    uint32_t fired = 0;
+    while(private->now < now) {
+        // nothing to fire or cascade before next, skip the empty ticks.
+        next = timer_wheel_earliest(private);
+        if(next > now) {
+            private->now = now;
+            break;
+        }
+        private->now = next;
+        fired += timer_wheel_tick(private);
+    }
+    //
+    return fired;
+}
+
+uint64_t timer_wheel_next(timer_wheel_t *wheel) {
+    assert(wheel);
+    timer_wheel_private *private = (timer_wheel_private *)wheel->priv;
+    assert(private);
+    //
+    return timer_wheel_earliest(private);
+}
+
+uint32_t timer_wheel_size(timer_wheel_t *wheel) {
+    assert(wheel);
+    timer_wheel_private *private = (timer_wheel_private *)wheel->priv;
+    assert(private);
+    //
+    return private->size;
+}
+
+int timer_wheel_free(timer_wheel_t *wheel) {
+    assert(wheel);
+    timer_wheel_private *private = (timer_wheel_private *)wheel->priv;
+    assert(private);
+    //
+    free(private);
+    wheel->priv = NULL;
+    //
+    return 0;
+}
@@ -0,0 +1,80 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+// hierarchical timing wheel counting in whatever ticks its owner feeds
+// it. timers live inside the owner's objects, so arming one never
+// allocates; arming, moving and cancelling are O(1). one wheel has one
+// owner, nothing here takes a lock.
+
+typedef struct {
+    void *priv;
+} timer_wheel_t;
+
+typedef struct timer_wheel_timer {
+    struct timer_wheel_timer *next;
+    // whatever points at this timer, NULL while it is not armed.
+    struct timer_wheel_timer **link;
+    uint64_t expires;
+    void (*fn)(struct timer_wheel_timer *timer);
+    uint32_t slot;
+} timer_wheel_timer_t;
+
+typedef void (*timer_wheel_fn)(timer_wheel_timer_t *timer);
+
+int timer_wheel_init(timer_wheel_t *wheel, uint64_t now);
+
+// arms timer to call fn at tick expires, moving it if it already was.
+// ticks already passed fire on the next advance. a zeroed timer is not
+// armed.
+int timer_wheel_add(
+    timer_wheel_t *wheel,
+    timer_wheel_timer_t *timer,
+    uint64_t expires,
+    timer_wheel_fn fn
+);
+
+// 0 when it was armed, -1 when it had fired or never was.
+int timer_wheel_del(
+    timer_wheel_t *wheel,
+    timer_wheel_timer_t *timer
+);
+
+int timer_wheel_pending(
+    timer_wheel_timer_t *timer
+);
+
+// moves the wheel on to now and calls fn for every timer due by then,
+// in no particular order. timers are disarmed before their fn runs, fn
+// may arm and cancel any timer but must not advance. returns how many fired.
+uint32_t timer_wheel_advance(
+    timer_wheel_t *wheel,
+    uint64_t now
+);
+
+// a tick by which advance has something to do, never later than the
+// first timer due; UINT64_MAX when none is armed.
+uint64_t timer_wheel_next(
+    timer_wheel_t *wheel
+);
+
+// armed timers.
+uint32_t timer_wheel_size(
+    timer_wheel_t *wheel
+);
+
+// timers still armed are simply forgotten.
+int timer_wheel_free(
+    timer_wheel_t *wheel
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TIMERWHEEL_H
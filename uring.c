@@ -0,0 +1,340 @@
+#include "uring.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+typedef struct {
+    uint32_t *khead;
+    uint32_t *ktail;
+    uint32_t *array;
+    uint32_t mask;
+    uint32_t entries;
+    uint32_t sqe_head;
+    uint32_t sqe_tail;
+    struct io_uring_sqe *sqes;
+} uring_sq;
+
+typedef struct {
+    uint32_t *khead;
+    uint32_t *ktail;
+    uint32_t mask;
+    struct io_uring_cqe *cqes;
+} uring_cq;
+
+typedef struct {
+    int fd;
+    uring_sq sq;
+    uring_cq cq;
+    void *sq_ptr;
+    size_t sq_size;
+    void *cq_ptr;
+    size_t cq_size;
+    size_t sqes_size;
+    //
+    struct io_uring_buf_ring *br;
+    size_t br_size;
+    uint16_t br_mask;
+    uint16_t br_tail;
+    uint32_t buf_size;
+    char *bufs;
+    //
+    uint64_t enters;
+} uring_private;
+
+
+int uring_setup(uint32_t entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+int uring_enter(uring_private *private, uint32_t submit, uint32_t wait, uint32_t flags) {
+    private->enters += 1;
+    return (int)syscall(__NR_io_uring_enter, private->fd, submit, wait, flags, NULL, 0);
+}
+
+int uring_register(uring_private *private, uint32_t opcode, void *arg, uint32_t nr) {
+    return (int)syscall(__NR_io_uring_register, private->fd, opcode, arg, nr);
+}
+
+int uring_init(uring_t *ring, uint32_t entries) {
+    assert(ring);
+    assert(entries > 0);
+    //
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = entries * 4;
+    //
+    int fd = uring_setup(entries, &params);
+    if(fd < 0 && errno == EINVAL) {
+        // COOP_TASKRUN needs 5.19.
+        memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = entries * 4;
+        fd = uring_setup(entries, &params);
+    }
+    if(fd < 0) {
+        perror("io_uring_setup");
+        return -1;
+    }
+    //
+    uring_private *private = (uring_private *)malloc(sizeof(uring_private));
+    memset(private, 0, sizeof(uring_private));
+    private->fd = fd;
+    //
+    private->sq_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    private->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        if(private->cq_size > private->sq_size) {
+            private->sq_size = private->cq_size;
+        }
+        private->cq_size = private->sq_size;
+    }
+    //
+    private->sq_ptr = mmap(NULL, private->sq_size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if(private->sq_ptr == MAP_FAILED) {
+        perror("mmap(sq)");
+        goto FAILED;
+    }
+    //
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        private->cq_ptr = private->sq_ptr;
+    } else {
+        private->cq_ptr = mmap(NULL, private->cq_size, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if(private->cq_ptr == MAP_FAILED) {
+            perror("mmap(cq)");
+            private->cq_ptr = NULL;
+            goto FAILED;
+        }
+    }
+    //
+    private->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    private->sq.sqes = (struct io_uring_sqe *)mmap(NULL, private->sqes_size, PROT_READ | PROT_WRITE,
+                                                   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(private->sq.sqes == MAP_FAILED) {
+        perror("mmap(sqes)");
+        private->sq.sqes = NULL;
+        goto FAILED;
+    }
+    //
+    char *sq = (char *)private->sq_ptr;
+    private->sq.khead   = (uint32_t *)(sq + params.sq_off.head);
+    private->sq.ktail   = (uint32_t *)(sq + params.sq_off.tail);
+    private->sq.array   = (uint32_t *)(sq + params.sq_off.array);
+    private->sq.mask    = *(uint32_t *)(sq + params.sq_off.ring_mask);
+    private->sq.entries = *(uint32_t *)(sq + params.sq_off.ring_entries);
+    private->sq.sqe_head = *private->sq.ktail;
+    private->sq.sqe_tail = private->sq.sqe_head;
+    // sqes are always used in ring order.
+    uint32_t i;
+    for(i = 0; i < private->sq.entries; i++) {
+        private->sq.array[i] = i;
+    }
+    //
+    char *cq = (char *)private->cq_ptr;
+    private->cq.khead = (uint32_t *)(cq + params.cq_off.head);
+    private->cq.ktail = (uint32_t *)(cq + params.cq_off.tail);
+    private->cq.mask  = *(uint32_t *)(cq + params.cq_off.ring_mask);
+    private->cq.cqes  = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    //
+    ring->priv = private;
+    //
+    return 0;
+    //
+FAILED:
+    ring->priv = private;
+    uring_free(ring);
+    //
+    return -1;
+}
+
+struct io_uring_sqe* uring_get_sqe(uring_t *ring) {
+    assert(ring);
+    uring_private *private = (uring_private *)ring->priv;
+    assert(private);
+    //
+    uring_sq *sq = &private->sq;
+    uint32_t head = __atomic_load_n(sq->khead, __ATOMIC_ACQUIRE);
+    int ret;
+    while(sq->sqe_tail - head >= sq->entries) {
+        ret = uring_submit(ring, 0);
+        if(ret < 0 && ret != -EINTR && ret != -EAGAIN && ret != -EBUSY) {
+            return NULL;
+        }
+        head = __atomic_load_n(sq->khead, __ATOMIC_ACQUIRE);
+    }
+    //
+    struct io_uring_sqe *sqe = &sq->sqes[sq->sqe_tail & sq->mask];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sq->sqe_tail += 1;
+    //
+    return sqe;
+}
+
+int uring_submit(uring_t *ring, uint32_t wait) {
+    assert(ring);
+    uring_private *private = (uring_private *)ring->priv;
+    assert(private);
+    //
+    uring_sq *sq = &private->sq;
+    uint32_t submit = sq->sqe_tail - sq->sqe_head;
+    if(submit > 0) {
+        __atomic_store_n(sq->ktail, sq->sqe_tail, __ATOMIC_RELEASE);
+        sq->sqe_head = sq->sqe_tail;
+    }
+    // completions already waiting satisfy the caller without sleeping.
+    if(wait > 0) {
+        uint32_t ready = __atomic_load_n(private->cq.ktail, __ATOMIC_ACQUIRE) - *private->cq.khead;
+        if(ready > 0) {
+            wait = 0;
+        }
+    }
+    if(submit == 0 && wait == 0) {
+        return 0;
+    }
+    //
+    int ret = uring_enter(private, submit, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0);
+    if(ret < 0) {
+        return -errno;
+    }
+    //
+    return 0;
+}
+
+int uring_foreach(uring_t *ring, uring_handler handler, void* user) {
+    assert(ring);
+    assert(handler);
+    uring_private *private = (uring_private *)ring->priv;
+    assert(private);
+    //
+    uring_cq *cq = &private->cq;
+    uint32_t head = *cq->khead;
+    uint32_t tail = __atomic_load_n(cq->ktail, __ATOMIC_ACQUIRE);
+    int count = 0;
+    while(head != tail) {
+        (void) handler(&cq->cqes[head & cq->mask], user);
+        head += 1;
+        count += 1;
+        // release the slot right away, handlers may queue more work.
+        __atomic_store_n(cq->khead, head, __ATOMIC_RELEASE);
+        if(head == tail) {
+            tail = __atomic_load_n(cq->ktail, __ATOMIC_ACQUIRE);
+        }
+    }
+    //
+    return count;
+}
+
+int uring_buffers_init(uring_t *ring, uint16_t count, uint32_t size) {
+    assert(ring);
+    assert(count > 0);
+    assert((count & (count - 1)) == 0);
+    uring_private *private = (uring_private *)ring->priv;
+    assert(private);
+    assert(private->br == NULL);
+    //
+    private->br_size = sizeof(struct io_uring_buf) * count;
+    void *br = mmap(NULL, private->br_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(br == MAP_FAILED) {
+        perror("mmap(buf_ring)");
+        return -1;
+    }
+    //
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr    = (uint64_t)(uintptr_t)br;
+    reg.ring_entries = count;
+    reg.bgid         = URING_BUFFER_GROUP;
+    if(uring_register(private, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        perror("io_uring_register(PBUF_RING)");
+        munmap(br, private->br_size);
+        return -1;
+    }
+    //
+    private->br       = (struct io_uring_buf_ring *)br;
+    private->br_mask  = count - 1;
+    private->br_tail  = 0;
+    private->buf_size = size;
+    private->bufs     = (char *)malloc((size_t)count * size);
+    //
+    uint16_t i;
+    for(i = 0; i < count; i++) {
+        struct io_uring_buf *buf = &private->br->bufs[private->br_tail & private->br_mask];
+        buf->addr = (uint64_t)(uintptr_t)(private->bufs + (size_t)i * size);
+        buf->len  = size;
+        buf->bid  = i;
+        private->br_tail += 1;
+    }
+    __atomic_store_n(&private->br->tail, private->br_tail, __ATOMIC_RELEASE);
+    //
+    return 0;
+}
+
+void* uring_buffer(uring_t *ring, uint16_t bid) {
+    assert(ring);
+    uring_private *private = (uring_private *)ring->priv;
+    assert(private);
+    //
+    return private->bufs + (size_t)bid * private->buf_size;
+}
+
+int uring_buffer_recycle(uring_t *ring, uint16_t bid) {
+    assert(ring);
+    uring_private *private = (uring_private *)ring->priv;
+    assert(private);
+    //
+    struct io_uring_buf *buf = &private->br->bufs[private->br_tail & private->br_mask];
+    buf->addr = (uint64_t)(uintptr_t)(private->bufs + (size_t)bid * private->buf_size);
+    buf->len  = private->buf_size;
+    buf->bid  = bid;
+    private->br_tail += 1;
+    __atomic_store_n(&private->br->tail, private->br_tail, __ATOMIC_RELEASE);
+    //
+    return 0;
+}
+
+uint64_t uring_enters(uring_t *ring) {
+    assert(ring);
+    uring_private *private = (uring_private *)ring->priv;
+    assert(private);
+    //
+    return private->enters;
+}
+
+int uring_free(uring_t *ring) {
+    assert(ring);
+    uring_private *private = (uring_private *)ring->priv;
+    assert(private);
+    //
+    if(private->br) {
+        struct io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.bgid = URING_BUFFER_GROUP;
+        (void) uring_register(private, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+        munmap(private->br, private->br_size);
+        free(private->bufs);
+    }
+    if(private->sq.sqes) {
+        munmap(private->sq.sqes, private->sqes_size);
+    }
+    if(private->cq_ptr && private->cq_ptr != private->sq_ptr) {
+        munmap(private->cq_ptr, private->cq_size);
+    }
+    if(private->sq_ptr && private->sq_ptr != MAP_FAILED) {
+        munmap(private->sq_ptr, private->sq_size);
+    }
+    close(private->fd);
+    free(private);
+    //
+    ring->priv = NULL;
+    //
+    return 0;
+}
@@ -0,0 +1,50 @@
+#ifndef URING_H
+#define URING_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+// buffer group used by uring_buffers_init.
+#define URING_BUFFER_GROUP 0
+
+typedef struct {
+    void *priv;
+} uring_t;
+
+typedef int (*uring_handler)(struct io_uring_cqe *cqe, void* user);
+
+int uring_init(uring_t *ring, uint32_t entries);
+
+// returns a zeroed sqe, flushing the submission queue first when it is full.
+struct io_uring_sqe* uring_get_sqe(uring_t *ring);
+
+// submits pending sqes and waits for at least `wait` completions.
+// returns 0 or a negative errno.
+int uring_submit(uring_t *ring, uint32_t wait);
+
+// hands every ready completion to handler, returns how many were reaped.
+int uring_foreach(uring_t *ring, uring_handler handler, void* user);
+
+// registers `count` (power of two) provided buffers of `size` bytes
+// in URING_BUFFER_GROUP.
+int uring_buffers_init(uring_t *ring, uint16_t count, uint32_t size);
+
+void* uring_buffer(uring_t *ring, uint16_t bid);
+
+// gives a consumed provided buffer back to the kernel.
+int uring_buffer_recycle(uring_t *ring, uint16_t bid);
+
+// number of io_uring_enter calls made so far.
+uint64_t uring_enters(uring_t *ring);
+
+int uring_free(uring_t *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // URING_H